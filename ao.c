@@ -6,11 +6,25 @@
 
 #ifdef WIN32
 #include "win32_utf8/win32_utf8.h"
+#include <fcntl.h>
+#include <io.h>
+#include <stdio.h>
 #else
+#include <dirent.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #endif
+#include <stdlib.h>
+#include <string.h>
+#include "ao.h"
+
+// ao.h redirects these to the wrappers below.
+#undef fopen
+#undef mkdir
 
 FILE* ao_fopen(const char *fn, const char *mode)
 {
@@ -28,6 +42,61 @@ int ao_mkdir(const char *dirname)
 #endif
 }
 
+// Stands in for the contents of empty files, which can't be mapped.
+static uint8 ao_file_empty;
+
+uint8* ao_file_map(FILE *file, uint64 *size)
+{
+	uint8 *data = NULL;
+#ifdef WIN32
+	HANDLE handle = (HANDLE)_get_osfhandle(_fileno(file));
+	LARGE_INTEGER file_size;
+
+	if(GetFileSizeEx(handle, &file_size)) {
+		*size = (uint64)file_size.QuadPart;
+		if(*size == 0) {
+			data = &ao_file_empty;
+		} else if(*size <= (SIZE_T)-1) {
+			// A copy-on-write view, since some engines patch their input.
+			HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+			if(mapping) {
+				data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+				CloseHandle(mapping);
+			}
+		}
+	}
+#else
+	struct stat st;
+
+	if((fstat(fileno(file), &st) == 0) && S_ISREG(st.st_mode)) {
+		*size = (uint64)st.st_size;
+		if(*size == 0) {
+			data = &ao_file_empty;
+		} else if(*size <= (size_t)-1) {
+			// A private mapping, since some engines patch their input.
+			data = mmap(NULL, (size_t)*size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(file), 0);
+			if(data == MAP_FAILED) {
+				data = NULL;
+			}
+		}
+	}
+#endif
+	fclose(file);
+	return data;
+}
+
+void ao_file_unmap(uint8 *data, uint64 size)
+{
+	if(!data || (data == &ao_file_empty)) {
+		return;
+	}
+#ifdef WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap(data, (size_t)size);
+#endif
+}
+
 void ao_sleep(unsigned int msecs)
 {
 #ifdef WIN32
@@ -36,3 +105,360 @@ void ao_sleep(unsigned int msecs)
 	usleep((useconds_t)(msecs) * 1000);
 #endif
 }
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define ao_cas(ptr, oldval, newval) _InterlockedCompareExchange(ptr, newval, oldval)
+#define ao_fetch_add(ptr, val) _InterlockedExchangeAdd(ptr, val)
+#else
+#define ao_cas(ptr, oldval, newval) __sync_val_compare_and_swap(ptr, oldval, newval)
+#define ao_fetch_add(ptr, val) __sync_fetch_and_add(ptr, val)
+#endif
+
+long ao_atomic_add(volatile long *target, long val)
+{
+	return ao_fetch_add(target, val);
+}
+
+void ao_once(ao_once_t *once, void (*func)(void))
+{
+	long state;
+	while((state = ao_cas(once, 0, 1)) != 2) {
+		if(state == 0) {
+			func();
+			ao_cas(once, 1, 2);
+			return;
+		}
+		ao_sleep(1);
+	}
+}
+
+void ao_srand(ao_rand_t *rng, uint32 seed)
+{
+	int32 word;
+	int i;
+
+	rng->r[0] = seed ? seed : 1;
+	for(i = 1; i < 31; i++) {
+		// 16807 * r[i - 1] % 2147483647, without overflowing 31 bits
+		word = rng->r[i - 1];
+		word = 16807 * (word % 127773) - 2836 * (word / 127773);
+		if(word < 0) {
+			word += 2147483647;
+		}
+		rng->r[i] = word;
+	}
+	rng->f = 3;
+	rng->b = 0;
+	for(i = 0; i < 310; i++) {
+		ao_rand(rng);
+	}
+}
+
+int32 ao_rand(ao_rand_t *rng)
+{
+	uint32 val = (rng->r[rng->f] += rng->r[rng->b]);
+	rng->f = (rng->f + 1) % 31;
+	rng->b = (rng->b + 1) % 31;
+	return val >> 1;
+}
+
+struct ao_thread {
+#ifdef WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+	void (*func)(void *param);
+	void *param;
+};
+
+#ifdef WIN32
+static DWORD WINAPI ao_thread_proc(void *param)
+#else
+static void* ao_thread_proc(void *param)
+#endif
+{
+	ao_thread_t *thread = (ao_thread_t*)param;
+	thread->func(thread->param);
+	return 0;
+}
+
+ao_thread_t* ao_thread_start(void (*func)(void *param), void *param)
+{
+	ao_thread_t *thread = malloc(sizeof(ao_thread_t));
+	if(!thread) {
+		return NULL;
+	}
+	thread->func = func;
+	thread->param = param;
+#ifdef WIN32
+	thread->handle = CreateThread(NULL, 0, ao_thread_proc, thread, 0, NULL);
+	if(!thread->handle) {
+		free(thread);
+		return NULL;
+	}
+#else
+	if(pthread_create(&thread->handle, NULL, ao_thread_proc, thread) != 0) {
+		free(thread);
+		return NULL;
+	}
+#endif
+	return thread;
+}
+
+void ao_thread_join(ao_thread_t *thread)
+{
+#ifdef WIN32
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+#else
+	pthread_join(thread->handle, NULL);
+#endif
+	free(thread);
+}
+
+struct ao_sem {
+#ifdef WIN32
+	HANDLE handle;
+#else
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	long count;
+#endif
+};
+
+ao_sem_t* ao_sem_create(long count)
+{
+	ao_sem_t *sem = malloc(sizeof(ao_sem_t));
+	if(!sem) {
+		return NULL;
+	}
+#ifdef WIN32
+	sem->handle = CreateSemaphoreA(NULL, count, 0x7fffffff, NULL);
+	if(!sem->handle) {
+		free(sem);
+		return NULL;
+	}
+#else
+	// POSIX semaphores would be simpler, but macOS doesn't support unnamed
+	// ones.
+	if(pthread_mutex_init(&sem->mutex, NULL) != 0) {
+		free(sem);
+		return NULL;
+	}
+	if(pthread_cond_init(&sem->cond, NULL) != 0) {
+		pthread_mutex_destroy(&sem->mutex);
+		free(sem);
+		return NULL;
+	}
+	sem->count = count;
+#endif
+	return sem;
+}
+
+void ao_sem_wait(ao_sem_t *sem)
+{
+#ifdef WIN32
+	WaitForSingleObject(sem->handle, INFINITE);
+#else
+	pthread_mutex_lock(&sem->mutex);
+	while(sem->count == 0) {
+		pthread_cond_wait(&sem->cond, &sem->mutex);
+	}
+	sem->count--;
+	pthread_mutex_unlock(&sem->mutex);
+#endif
+}
+
+void ao_sem_post(ao_sem_t *sem)
+{
+#ifdef WIN32
+	ReleaseSemaphore(sem->handle, 1, NULL);
+#else
+	pthread_mutex_lock(&sem->mutex);
+	sem->count++;
+	pthread_cond_signal(&sem->cond);
+	pthread_mutex_unlock(&sem->mutex);
+#endif
+}
+
+void ao_sem_free(ao_sem_t *sem)
+{
+#ifdef WIN32
+	CloseHandle(sem->handle);
+#else
+	pthread_cond_destroy(&sem->cond);
+	pthread_mutex_destroy(&sem->mutex);
+#endif
+	free(sem);
+}
+
+unsigned int ao_cpu_count(void)
+{
+#ifdef WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors;
+#else
+	long ret = sysconf(_SC_NPROCESSORS_ONLN);
+	return (ret > 0) ? ret : 1;
+#endif
+}
+
+#define AO_PARALLEL_MAX 16
+
+typedef struct {
+	volatile long next;
+	int count;
+	void (*func)(void *param, int i);
+	void *param;
+} ao_parallel_t;
+
+// Threads that ao_parallel() may start on top of the calling ones, shared
+// by all callers and reduced by ao_parallel_reserve().
+static ao_once_t ao_parallel_once;
+static volatile long ao_parallel_budget;
+
+static void ao_parallel_init(void)
+{
+	ao_parallel_budget = (long)ao_cpu_count() - 1;
+}
+
+void ao_parallel_reserve(long threads)
+{
+	ao_once(&ao_parallel_once, ao_parallel_init);
+	ao_atomic_add(&ao_parallel_budget, -threads);
+}
+
+// Takes up to [wanted] threads out of the budget, and returns how many it
+// got.
+static long ao_parallel_take(long wanted)
+{
+	long avail;
+	do {
+		avail = ao_parallel_budget;
+		if(avail <= 0) {
+			return 0;
+		}
+		if(wanted > avail) {
+			wanted = avail;
+		}
+	} while(ao_cas(&ao_parallel_budget, avail, avail - wanted) != avail);
+	return wanted;
+}
+
+static void ao_parallel_worker(void *param)
+{
+	ao_parallel_t *job = (ao_parallel_t*)param;
+	long i;
+	while((i = ao_atomic_add(&job->next, 1)) < job->count) {
+		job->func(job->param, (int)i);
+	}
+}
+
+void ao_parallel(int count, void (*func)(void *param, int i), void *param)
+{
+	ao_parallel_t job = { 0, count, func, param };
+	ao_thread_t *threads[AO_PARALLEL_MAX] = { NULL };
+	int workers = count;
+	int i;
+
+	if(workers > AO_PARALLEL_MAX) {
+		workers = AO_PARALLEL_MAX;
+	}
+	ao_once(&ao_parallel_once, ao_parallel_init);
+	workers = (workers > 1) ? (1 + (int)ao_parallel_take(workers - 1)) : 1;
+	// The calling thread works as well, and finishes everything on its own
+	// if no other threads can be created.
+	for(i = 1; i < workers; i++) {
+		threads[i] = ao_thread_start(ao_parallel_worker, &job);
+	}
+	ao_parallel_worker(&job);
+	for(i = 1; i < workers; i++) {
+		if(threads[i]) {
+			ao_thread_join(threads[i]);
+		}
+	}
+	ao_atomic_add(&ao_parallel_budget, workers - 1);
+}
+
+double ao_time(void)
+{
+#ifdef WIN32
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (double)now.QuadPart / freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+#endif
+}
+
+FILE* ao_stdout_claim(void)
+{
+	FILE *ret;
+	int fd;
+
+	fflush(stdout);
+#ifdef WIN32
+	fd = _dup(_fileno(stdout));
+	if(fd < 0) {
+		return NULL;
+	}
+	_setmode(fd, _O_BINARY);
+	_dup2(_fileno(stderr), _fileno(stdout));
+	ret = _fdopen(fd, "wb");
+#else
+	fd = dup(STDOUT_FILENO);
+	if(fd < 0) {
+		return NULL;
+	}
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+	ret = fdopen(fd, "wb");
+#endif
+	return ret;
+}
+
+ao_bool ao_dir_iterate(
+	const char *dirname, void (*func)(const char *fn, void *param), void *param
+)
+{
+#ifdef WIN32
+	WIN32_FIND_DATAA w32fd;
+	HANDLE hFind;
+	char *pattern = malloc(strlen(dirname) + 3);
+
+	if(!pattern) {
+		return false;
+	}
+	sprintf(pattern, "%s\\*", dirname);
+	hFind = FindFirstFileA(pattern, &w32fd);
+	free(pattern);
+	if(hFind == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	do {
+		if(!(w32fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+			func(w32fd.cFileName, param);
+		}
+	} while(FindNextFileA(hFind, &w32fd));
+	FindClose(hFind);
+#else
+	struct dirent *entry;
+	DIR *dir = opendir(dirname);
+
+	if(!dir) {
+		return false;
+	}
+	while((entry = readdir(dir))) {
+		if(entry->d_type != DT_DIR) {
+			func(entry->d_name, param);
+		}
+	}
+	closedir(dir);
+#endif
+	return true;
+}
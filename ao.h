@@ -14,6 +14,9 @@
 #define AO_FAIL_DECOMPRESSION		-1
 
 #define AUDIO_RATE					(44100)
+// Samples in one 1/60th of a second frame at AUDIO_RATE, after which the
+// engine's frame function is called.
+#define AUDIO_FRAME_SAMPLES			(AUDIO_RATE / 60)
 
 enum
 {
@@ -25,7 +28,15 @@ enum
 	COMMAND_HAS_NEXT,
 	COMMAND_GET_MIN,
 	COMMAND_GET_MAX,
-	COMMAND_JUMP
+	COMMAND_JUMP,
+	// Skips [parameter] samples ahead, ending up in exactly the same state as
+	// if they had been rendered. Just like regular playback, the engine's
+	// frame function is called after every 1/60th of a second, so
+	// [parameter] should be a multiple of that to stay in sync.
+	// Only the final output mix is skipped; the sound CPU, the voices, and
+	// any reverb or DSP unit still have to be emulated, so this still takes
+	// about 75-100% of the time of regular playback.
+	COMMAND_SEEK
 };
 
 /* Compiler defines for Xcode */
@@ -134,6 +145,19 @@ typedef unsigned long long	UINT64;
 #endif
 #endif
 
+// Engine state is kept in thread-local storage, which allows independent songs
+// to be rendered concurrently on separate threads of the same process. A song
+// must be started, rendered and stopped on the same thread. Define this to
+// nothing to go back to process-wide state, e.g. on toolchains that only
+// emulate TLS through a function call on every access.
+#ifndef AO_THREAD_LOCAL
+#if defined(_MSC_VER)
+#define AO_THREAD_LOCAL __declspec(thread)
+#else
+#define AO_THREAD_LOCAL __thread
+#endif
+#endif
+
 INLINE uint16 SWAP16(uint16 x)
 {
 	return (
@@ -189,24 +213,98 @@ typedef struct {
 	int16 r;
 } stereo_sample_t;
 
+typedef volatile long ao_once_t;
+
+typedef struct {
+	uint32 r[31];
+	int f, b;
+} ao_rand_t;
+
 int ao_get_lib(const char *filename, uint8 **buffer, uint64 *length);
 
 #endif // AO_H
 
-extern volatile ao_bool ao_song_done;
+extern AO_THREAD_LOCAL volatile ao_bool ao_song_done;
 
 /// Portability functions defined in ao.c
 /// -------------------------------------
 FILE* ao_fopen(const char *fn, const char *mode);
 
+// Maps all of [file] into memory and closes it, returning NULL on failure.
+// The mapping is private, so writes to it never reach the file. Release it
+// with ao_file_unmap() and the [size] returned here.
+uint8* ao_file_map(FILE *file, uint64 *size);
+void ao_file_unmap(uint8 *data, uint64 size);
+
 // We don't care about permissions, even on Linux
 int ao_mkdir(const char *dirname);
 
 void ao_sleep(unsigned int seconds);
 
+// Calls [func] exactly once per process, for initializing read-only tables
+// shared by all threads. [once] has to start out as 0, and all other callers
+// wait until [func] has finished.
+void ao_once(ao_once_t *once, void (*func)(void));
+
+// Reentrant replacement for rand()/srand(), which keeps its state in [rng]
+// rather than in a process-wide variable. Uses the same additive feedback
+// generator as glibc, so the sequences match the ones we used to get from
+// rand() on Linux.
+void ao_srand(ao_rand_t *rng, uint32 seed);
+int32 ao_rand(ao_rand_t *rng);
+#define AO_RAND_MAX 0x7fffffff
+
+// Atomically adds [val] to [target], returning the previous value.
+long ao_atomic_add(volatile long *target, long val);
+
+// Starts a new thread that runs [func] with the given [param]. Returns NULL
+// on failure.
+typedef struct ao_thread ao_thread_t;
+ao_thread_t* ao_thread_start(void (*func)(void *param), void *param);
+
+// Waits for [thread] to finish, then frees it.
+void ao_thread_join(ao_thread_t *thread);
+
+// Counting semaphore. ao_sem_create() returns NULL on failure.
+typedef struct ao_sem ao_sem_t;
+ao_sem_t* ao_sem_create(long count);
+void ao_sem_wait(ao_sem_t *sem);
+void ao_sem_post(ao_sem_t *sem);
+void ao_sem_free(ao_sem_t *sem);
+
+// Returns the number of logical processors in the system.
+unsigned int ao_cpu_count(void);
+
+// Calls [func] with every index from 0 to [count] - 1, spread across up to
+// ao_cpu_count() threads including the calling one, and returns once all
+// calls have finished. [func] must not use any thread-local state.
+// Additional threads come out of a process-wide budget, so concurrent calls
+// never run more than ao_cpu_count() threads in total.
+void ao_parallel(int count, void (*func)(void *param, int i), void *param);
+
+// Removes [threads] from the ao_parallel() budget, for threads that are
+// kept busy elsewhere. Pass a negative number to give them back.
+void ao_parallel_reserve(long threads);
+
+// Returns a monotonic timestamp in seconds.
+double ao_time(void);
+
+// Returns a binary stream for the original standard output, and redirects
+// [stdout] to [stderr], so that status messages don't end up in the data
+// piped to another program. Returns NULL on failure.
+FILE* ao_stdout_claim(void);
+
+// Calls [func] with the name of every non-directory entry in [dirname].
+ao_bool ao_dir_iterate(
+	const char *dirname, void (*func)(const char *fn, void *param), void *param
+);
+
 #define fopen ERROR_use_ao_fopen_instead!
 #define mkdir ERROR_Use_ao_mkdir_instead!
 /// -------------------------------------
 
 #include "wavedump.h"
 #include "sampledump.h"
+#include "state.h"
+#include "songend.h"
+#include "profile.h"
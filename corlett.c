@@ -81,9 +81,10 @@ The following data is optional and may be omitted:
 
 #define DECOMP_MAX_SIZE		((32 * 1024 * 1024) + 12)
 
-uint32 total_samples;
-uint32 decaybegin;
-uint32 decayend;
+AO_THREAD_LOCAL uint32 total_samples;
+AO_THREAD_LOCAL uint32 decaybegin;
+AO_THREAD_LOCAL uint32 decayend;
+static AO_THREAD_LOCAL uint32 sample_rate = AUDIO_RATE;
 
 static int corlett_decode_tags(corlett_t *c, uint8 *input, uint32 input_len)
 {
@@ -157,54 +158,58 @@ static int corlett_decode_tags(corlett_t *c, uint8 *input, uint32 input_len)
 	return true;
 }
 
-static int corlett_decode_lib(int libnum, uint8 *input, uint32 input_len, uint8 **output, uint64 *size, corlett_t *c, corlett_lib_callback_t *lib_callback)
+// Compressed program section of a PSF file, inflated by corlett_inflate().
+typedef struct
+{
+	const uint8 *comp;
+	uLong comp_length;
+	uint32 comp_crc;
+	uint8 *output;
+	uLongf size;
+	ao_bool stream;	// only check the CRC, corlett_stream_read() inflates
+	int ret;
+} corlett_program_t;
+
+struct corlett_stream
+{
+	z_stream z;
+	int zret;
+	// already decompressed data, read instead of [z] if not NULL
+	const uint8 *mem;
+	uint32 mem_left;
+	// copy of everything inflated from [z] so far, for the library cache
+	uint8 *tee;
+	uLongf tee_size;
+	uLongf tee_cap;
+};
+
+// Checks the header of a PSF file and decodes its reserved section and tags
+// into [c]. The program section is only located, for corlett_inflate().
+static int corlett_parse(uint8 *input, uint32 input_len, corlett_t *c, corlett_program_t *prog)
 {
-	int ret = AO_SUCCESS;
 	uint32 *buf;
-	uint32 res_area, comp_crc,  actual_crc;
-	uint8 *decomp_dat;
-	uLongf decomp_length, comp_length;
+	uint32 res_area;
 
 	// 32-bit pointer to data
 	buf = (uint32 *)input;
 
 	// Check we have a PSF format file.
-	if ((input[0] != 'P') || (input[1] != 'S') || (input[2] != 'F'))
+	if ((input_len < 16) || (input[0] != 'P') || (input[1] != 'S') || (input[2] != 'F'))
 	{
 		return AO_FAIL;
 	}
 
 	// Get our values
 	res_area = LE32(buf[1]);
-	comp_length = LE32(buf[2]);
-	comp_crc = LE32(buf[3]);
+	prog->comp_length = LE32(buf[2]);
+	prog->comp_crc = LE32(buf[3]);
+	prog->comp = (uint8 *)&buf[4+(res_area/4)];
+	prog->ret = AO_SUCCESS;
 
-	if (comp_length > 0)
+	// Check length
+	if ((prog->comp_length > 0) && (input_len < prog->comp_length + 16))
 	{
-		// Check length
-		if (input_len < comp_length + 16)
-			return AO_FAIL;
-
-		// Check CRC is correct
-		actual_crc = crc32(0, (unsigned char *)&buf[4+(res_area/4)], comp_length);
-		if (actual_crc != comp_crc)
-			return AO_FAIL;
-
-		// Decompress data if any
-		decomp_dat = malloc(DECOMP_MAX_SIZE);
-		decomp_length = DECOMP_MAX_SIZE;
-		if (uncompress(decomp_dat, &decomp_length, (unsigned char *)&buf[4+(res_area/4)], comp_length) != Z_OK)
-		{
-			goto err_free;
-		}
-
-		// Resize memory buffer to what we actually need
-		decomp_dat = realloc(decomp_dat, (size_t)decomp_length + 1);
-	}
-	else
-	{
-		decomp_dat = NULL;
-		decomp_length =  0;
+		return AO_FAIL;
 	}
 
 	memset(c, 0, sizeof(corlett_t));
@@ -213,117 +218,520 @@ static int corlett_decode_lib(int libnum, uint8 *input, uint32 input_len, uint8
 	c->res_section = &buf[4];
 	c->res_size = res_area;
 
-	// Return it
-	*output = decomp_dat;
-	*size = decomp_length;
-
 	// Next check for tags
-	input_len -= (comp_length + 16 + res_area);
-	input += (comp_length + res_area + 16);
+	input_len -= (prog->comp_length + 16 + res_area);
+	input += (prog->comp_length + res_area + 16);
 
 	#ifdef DEBUG
 	printf("New corlett: input len %d\n", input_len);
 	#endif
 
-	if (corlett_decode_tags(c, input, input_len) != AO_SUCCESS)
+	return corlett_decode_tags(c, input, input_len);
+}
+
+// Checks the CRC of a program section and decompresses it. Called through
+// ao_parallel() on an array of program pointers.
+static void corlett_inflate(void *param, int i)
+{
+	corlett_program_t *prog = ((corlett_program_t **)param)[i];
+
+	// Check CRC is correct
+	if (crc32(0, prog->comp, prog->comp_length) != prog->comp_crc)
 	{
-		goto err_free;
+		prog->ret = AO_FAIL;
+		return;
+	}
+	if (prog->stream)
+	{
+		return;
 	}
 
-	// Fully recursive loading of libraries is probably a bad idea anyway.
-	if (libnum == 0)
+	// Decompress data if any
+	prog->output = malloc(DECOMP_MAX_SIZE);
+	prog->size = DECOMP_MAX_SIZE;
+	if (!prog->output || uncompress(prog->output, &prog->size, prog->comp, prog->comp_length) != Z_OK)
 	{
-		int i;
-		char lib_tag_name[6] = "_lib";
-		uint8 *lib_raw[9] = {0};
-		uint8 *lib_data[9] = {0};
-		corlett_t lib_tags[9] = {{0}};
+		free(prog->output);
+		prog->output = NULL;
+		prog->ret = AO_FAIL;
+		return;
+	}
 
-		for(i = 0; i < 9; i++) {
-			#define BREAK_ON_ERR(call) \
-				ret = call; \
-				if(ret != AO_SUCCESS) { \
-					break; \
-			}
+	// Resize memory buffer to what we actually need
+	prog->output = realloc(prog->output, (size_t)prog->size + 1);
+}
 
-			uint64 lib_len, lib_raw_length;
+// Libraries that were already decompressed for an earlier song, shared by
+// all threads. Entries are matched by the size of the library file and the
+// length and CRC of its compressed program section, as given in its header.
+// The least recently used ones are dropped once the cache holds more than
+// CORLETT_CACHE_MAX bytes, unless a song is still being decoded from them.
+#define CORLETT_CACHE_MAX	(64 * 1024 * 1024)
 
-			if (i >= 1 && i <= 8)
-			{
-				lib_tag_name[4] = '0' + i + 1;
-			}
+typedef struct corlett_cache_entry
+{
+	struct corlett_cache_entry *prev, *next;
+	uint64 raw_len;
+	uLong comp_length;
+	uint32 comp_crc;
+	uint8 *output;
+	uLongf size;
+	long refs;
+} corlett_cache_entry_t;
+
+static ao_once_t corlett_cache_once = 0;
+static ao_sem_t *corlett_cache_lock;
+// Most recently used first
+static corlett_cache_entry_t *corlett_cache_head, *corlett_cache_tail;
+static uint64 corlett_cache_bytes;
+
+static void corlett_cache_init(void)
+{
+	corlett_cache_lock = ao_sem_create(1);
+}
 
-			const char *libfile = corlett_tag_lookup(c, lib_tag_name);
-			if(!libfile)
-			{
-				continue;
-			}
+static void corlett_cache_unlink(corlett_cache_entry_t *entry)
+{
+	if (entry->prev)
+	{
+		entry->prev->next = entry->next;
+	}
+	else
+	{
+		corlett_cache_head = entry->next;
+	}
+	if (entry->next)
+	{
+		entry->next->prev = entry->prev;
+	}
+	else
+	{
+		corlett_cache_tail = entry->prev;
+	}
+}
+
+static void corlett_cache_link(corlett_cache_entry_t *entry)
+{
+	entry->prev = NULL;
+	entry->next = corlett_cache_head;
+	if (corlett_cache_head)
+	{
+		corlett_cache_head->prev = entry;
+	}
+	else
+	{
+		corlett_cache_tail = entry;
+	}
+	corlett_cache_head = entry;
+}
 
-			#ifdef DEBUG
-			printf("Loading library #%d: %s\n", 1 + i, libfile);
-			#endif
+// Looks up the entry for a library file of [raw_len] bytes with the program
+// section [prog], and adds a reference to it. Must be called with the lock
+// held.
+static corlett_cache_entry_t* corlett_cache_find(uint64 raw_len, const corlett_program_t *prog)
+{
+	corlett_cache_entry_t *entry;
 
-			BREAK_ON_ERR(ao_get_lib(libfile, &lib_raw[i], &lib_raw_length));
-			BREAK_ON_ERR(corlett_decode_lib(1 + i, lib_raw[i], lib_raw_length, &lib_data[i], &lib_len, &lib_tags[i], lib_callback));
+	for (entry = corlett_cache_head; entry; entry = entry->next)
+	{
+		if (
+			(entry->raw_len == raw_len) &&
+			(entry->comp_length == prog->comp_length) &&
+			(entry->comp_crc == prog->comp_crc)
+		)
+		{
+			corlett_cache_unlink(entry);
+			corlett_cache_link(entry);
+			entry->refs++;
+			break;
 		}
+	}
+	return entry;
+}
 
-		if (ret == AO_SUCCESS)
+// Returns the cached entry for a library file of [raw_len] bytes with the
+// program section [prog], with an additional reference, or NULL if there is
+// none.
+static corlett_cache_entry_t* corlett_cache_get(uint64 raw_len, const corlett_program_t *prog)
+{
+	corlett_cache_entry_t *entry;
+
+	ao_once(&corlett_cache_once, corlett_cache_init);
+	if (!corlett_cache_lock)
+	{
+		return NULL;
+	}
+	ao_sem_wait(corlett_cache_lock);
+	entry = corlett_cache_find(raw_len, prog);
+	ao_sem_post(corlett_cache_lock);
+	return entry;
+}
+
+// Drops a reference to [entry], and evicts unreferenced entries while the
+// cache is over budget.
+static void corlett_cache_release(corlett_cache_entry_t *entry)
+{
+	corlett_cache_entry_t *victim, *prev;
+
+	ao_sem_wait(corlett_cache_lock);
+	entry->refs--;
+	for (victim = corlett_cache_tail; victim && (corlett_cache_bytes > CORLETT_CACHE_MAX); victim = prev)
+	{
+		prev = victim->prev;
+		if (victim->refs == 0)
+		{
+			corlett_cache_unlink(victim);
+			corlett_cache_bytes -= victim->size;
+			free(victim->output);
+			free(victim);
+		}
+	}
+	ao_sem_post(corlett_cache_lock);
+}
+
+// Adds the decompressed program section of a library file of [raw_len]
+// bytes to the cache, which takes ownership of [prog]'s output. If another
+// thread has added the same library in the meantime, that entry is used
+// instead, and [prog]'s output is freed. Returns the entry with one
+// reference, or NULL if the library couldn't be cached, in which case the
+// caller keeps ownership.
+static corlett_cache_entry_t* corlett_cache_put(uint64 raw_len, corlett_program_t *prog)
+{
+	corlett_cache_entry_t *entry, *existing;
+
+	if (!corlett_cache_lock || (prog->size > CORLETT_CACHE_MAX))
+	{
+		return NULL;
+	}
+	entry = malloc(sizeof(corlett_cache_entry_t));
+	if (!entry)
+	{
+		return NULL;
+	}
+	entry->raw_len = raw_len;
+	entry->comp_length = prog->comp_length;
+	entry->comp_crc = prog->comp_crc;
+	entry->output = prog->output;
+	entry->size = prog->size;
+	entry->refs = 1;
+
+	ao_sem_wait(corlett_cache_lock);
+	existing = corlett_cache_find(raw_len, prog);
+	if (!existing)
+	{
+		corlett_cache_link(entry);
+		corlett_cache_bytes += entry->size;
+	}
+	ao_sem_post(corlett_cache_lock);
+	if (existing)
+	{
+		free(entry);
+		free(prog->output);
+		entry = existing;
+	}
+	prog->output = entry->output;
+	prog->size = entry->size;
+	return entry;
+}
+
+void corlett_cache_free(void)
+{
+	corlett_cache_entry_t *entry, *next;
+
+	if (!corlett_cache_lock)
+	{
+		return;
+	}
+	ao_sem_wait(corlett_cache_lock);
+	for (entry = corlett_cache_head; entry; entry = next)
+	{
+		next = entry->next;
+		free(entry->output);
+		free(entry);
+	}
+	corlett_cache_head = corlett_cache_tail = NULL;
+	corlett_cache_bytes = 0;
+	ao_sem_post(corlett_cache_lock);
+}
+
+// Appends [len] bytes of freshly inflated data at [src] to the copy in
+// [program]. Drops the copy if it doesn't fit into memory or would have been
+// too large for uncompress() anyway.
+static void corlett_stream_tee(corlett_stream_t *program, const uint8 *src, uint32 len)
+{
+	uLongf size = program->tee_size + len;
+
+	if (size + 1 > program->tee_cap)
+	{
+		uLongf cap = program->tee_cap;
+		uint8 *tee = NULL;
+
+		while (cap < size + 1)
+		{
+			cap *= 2;
+		}
+		if (cap <= DECOMP_MAX_SIZE + 1)
+		{
+			tee = realloc(program->tee, cap);
+		}
+		if (!tee)
+		{
+			free(program->tee);
+			program->tee = NULL;
+			return;
+		}
+		program->tee = tee;
+		program->tee_cap = cap;
+	}
+	memcpy(program->tee + program->tee_size, src, len);
+	program->tee_size = size;
+}
+
+uint32 corlett_stream_read(corlett_stream_t *program, uint8 *dst, uint32 len)
+{
+	if (program->mem)
+	{
+		len = (len < program->mem_left) ? len : program->mem_left;
+		memcpy(dst, program->mem, len);
+		program->mem += len;
+		program->mem_left -= len;
+		return len;
+	}
+	program->z.next_out = dst;
+	program->z.avail_out = len;
+	while ((program->zret == Z_OK) && (program->z.avail_out > 0))
+	{
+		program->zret = inflate(&program->z, Z_NO_FLUSH);
+	}
+	len -= program->z.avail_out;
+	if (program->tee)
+	{
+		corlett_stream_tee(program, dst, len);
+	}
+	return len;
+}
+
+// Runs [stream_callback] for [prog], then checks that the rest of its data
+// decompresses as well, as uncompress() would have. The data of libraries is
+// also collected in [prog]'s output along the way, so that they can be
+// cached.
+static int corlett_stream_run(int libnum, corlett_program_t *prog, corlett_t *c, corlett_stream_callback_t *stream_callback)
+{
+	corlett_stream_t program;
+	int ret;
+
+	memset(&program, 0, sizeof(program));
+	if (prog->output)
+	{
+		program.mem = prog->output;
+		program.mem_left = prog->size;
+		return stream_callback(libnum, &program, c);
+	}
+	if (prog->comp_length == 0)
+	{
+		program.zret = Z_STREAM_END;
+	}
+	else
+	{
+		program.z.next_in = (Bytef *)prog->comp;
+		program.z.avail_in = prog->comp_length;
+		program.zret = inflateInit(&program.z);
+	}
+	if ((program.zret != Z_OK) && (program.zret != Z_STREAM_END))
+	{
+		return AO_FAIL;
+	}
+
+	if ((libnum > 0) && (prog->comp_length > 0))
+	{
+		// Compressed data usually inflates to several times its size.
+		program.tee_cap = prog->comp_length * 4;
+		program.tee = malloc(program.tee_cap);
+	}
+
+	ret = stream_callback(libnum, &program, c);
+	if (ret == AO_SUCCESS)
+	{
+		uint8 skip[4096];
+
+		while (corlett_stream_read(&program, skip, sizeof(skip)) == sizeof(skip))
+		{
+		}
+		if (program.zret != Z_STREAM_END)
 		{
-			ret = lib_callback(libnum, decomp_dat, decomp_length, c);
+			printf("Decompress fail: %d!\n", program.zret);
+			ret = AO_FAIL;
 		}
+	}
+	if (prog->comp_length > 0)
+	{
+		inflateEnd(&program.z);
+	}
+	if ((ret == AO_SUCCESS) && program.tee)
+	{
+		prog->output = realloc(program.tee, (size_t)program.tee_size + 1);
+		prog->size = program.tee_size;
+	}
+	else
+	{
+		free(program.tee);
+	}
+	return ret;
+}
+
+static int corlett_callback(int libnum, corlett_program_t *prog, corlett_t *c, corlett_lib_callback_t *lib_callback, corlett_stream_callback_t *stream_callback)
+{
+	if (prog->ret != AO_SUCCESS)
+	{
+		return prog->ret;
+	}
+	if (stream_callback)
+	{
+		return corlett_stream_run(libnum, prog, c, stream_callback);
+	}
+	return lib_callback(libnum, prog->output, prog->size, c);
+}
+
+static int corlett_decode_ex(uint8 *input, uint32 input_len, corlett_t *c, corlett_lib_callback_t *lib_callback, corlett_stream_callback_t *stream_callback)
+{
+	int ret, i;
+	char lib_tag_name[6] = "_lib";
+	// [0] is the file itself, followed by _lib to _lib9
+	corlett_program_t progs[10] = {{0}};
+	uint8 *lib_raw[9] = {0};
+	uint64 lib_raw_length[9] = {0};
+	corlett_cache_entry_t *lib_cached[9] = {0};
+	corlett_t lib_tags[9] = {{0}};
+
+	ret = corlett_parse(input, input_len, c, &progs[0]);
+
+	// The library files are read and parsed first, so that all program
+	// sections can then be decompressed in parallel. Fully recursive loading
+	// of libraries is probably a bad idea anyway.
+	for (i = 0; (i < 9) && (ret == AO_SUCCESS); i++)
+	{
+		const char *libfile;
+
+		if (i >= 1 && i <= 8)
+		{
+			lib_tag_name[4] = '0' + i + 1;
+		}
+
+		libfile = corlett_tag_lookup(c, lib_tag_name);
+		if (!libfile)
+		{
+			continue;
+		}
+
+		#ifdef DEBUG
+		printf("Loading library #%d: %s\n", 1 + i, libfile);
+		#endif
+
+		ret = ao_get_lib(libfile, &lib_raw[i], &lib_raw_length[i]);
+		if (ret != AO_SUCCESS)
+		{
+			break;
+		}
+		ret = corlett_parse(lib_raw[i], lib_raw_length[i], &lib_tags[i], &progs[1 + i]);
 		if (ret == AO_SUCCESS)
 		{
-			// now figure out the time in samples for the length/fade
-			double length_seconds = psfTimeToSeconds(corlett_tag_lookup(c, "length"));
-			double fade_seconds = psfTimeToSeconds(corlett_tag_lookup(c, "fade"));
+			lib_cached[i] = corlett_cache_get(lib_raw_length[i], &progs[1 + i]);
+		}
+		if (lib_cached[i])
+		{
+			progs[1 + i].output = lib_cached[i]->output;
+			progs[1 + i].size = lib_cached[i]->size;
+		}
+	}
 
-			#ifdef DEBUG
-			printf("length %f fade %f\n", length_seconds, fade_seconds);
-			#endif
+	if (ret == AO_SUCCESS)
+	{
+		corlett_program_t *jobs[10];
+		int num_jobs = 0;
 
-			corlett_length_set(length_seconds, fade_seconds);
+		for (i = 0; i < 10; i++)
+		{
+			if ((progs[i].comp_length > 0) && !((i > 0) && lib_cached[i - 1]))
+			{
+				progs[i].stream = (stream_callback != NULL);
+				jobs[num_jobs++] = &progs[i];
+			}
 		}
+		ao_parallel(num_jobs, corlett_inflate, jobs);
 
 		for (i = 0; i < 9; i++)
 		{
-			if (lib_data[i])
+			if (lib_raw[i] && !lib_cached[i] && !progs[1 + i].stream && (progs[1 + i].ret == AO_SUCCESS))
 			{
-				free(lib_data[i]);
+				lib_cached[i] = corlett_cache_put(lib_raw_length[i], &progs[1 + i]);
 			}
-			if (lib_raw[i])
+		}
+	}
+
+	// Libraries are passed on in the order of their tags, before the file
+	// itself. Streamed libraries are only cached once they have been fully
+	// inflated.
+	for (i = 0; (i < 9) && (ret == AO_SUCCESS); i++)
+	{
+		if (lib_raw[i])
+		{
+			ret = corlett_callback(1 + i, &progs[1 + i], &lib_tags[i], lib_callback, stream_callback);
+			if ((ret == AO_SUCCESS) && !lib_cached[i] && progs[1 + i].output)
 			{
-				free(lib_raw[i]);
+				lib_cached[i] = corlett_cache_put(lib_raw_length[i], &progs[1 + i]);
 			}
-			corlett_free(&lib_tags[i]);
 		}
 	}
-	else
+	if (ret == AO_SUCCESS)
 	{
-		ret = lib_callback(libnum, decomp_dat, decomp_length, c);
+		ret = corlett_callback(0, &progs[0], c, lib_callback, stream_callback);
 	}
+	if (ret == AO_SUCCESS)
+	{
+		// now figure out the time in samples for the length/fade
+		double length_seconds = psfTimeToSeconds(corlett_tag_lookup(c, "length"));
+		double fade_seconds = psfTimeToSeconds(corlett_tag_lookup(c, "fade"));
 
-	return ret;
+		#ifdef DEBUG
+		printf("length %f fade %f\n", length_seconds, fade_seconds);
+		#endif
 
-err_free:
-	free(decomp_dat);
-	return AO_FAIL;
+		corlett_length_set(length_seconds, fade_seconds);
+	}
+
+	free(progs[0].output);
+	for (i = 0; i < 9; i++)
+	{
+		if (lib_cached[i])
+		{
+			corlett_cache_release(lib_cached[i]);
+		}
+		else
+		{
+			free(progs[1 + i].output);
+		}
+		ao_file_unmap(lib_raw[i], lib_raw_length[i]);
+		corlett_free(&lib_tags[i]);
+	}
+	return ret;
 }
 
 int corlett_decode(uint8 *input, uint32 input_len, corlett_t *c, corlett_lib_callback_t *lib_callback)
 {
-	int ret = AO_FAIL;
-	uint8 *output = NULL;
-	uint64 size;
+	if (!lib_callback)
+	{
+		return AO_FAIL;
+	}
+	return corlett_decode_ex(input, input_len, c, lib_callback, NULL);
+}
 
-	if (lib_callback)
+int corlett_decode_stream(uint8 *input, uint32 input_len, corlett_t *c, corlett_stream_callback_t *stream_callback)
+{
+	if (!stream_callback)
 	{
-		ret = corlett_decode_lib(0, input, input_len, &output, &size, c, lib_callback);
-		if(output)
-		{
-			free(output);
-		}
+		return AO_FAIL;
 	}
-	return ret;
+	return corlett_decode_ex(input, input_len, c, NULL, stream_callback);
 }
 
 void corlett_free(corlett_t *c)
@@ -357,6 +765,11 @@ const char *corlett_tag_lookup(corlett_t *c, const char *tag)
 	return ret ? *ret : NULL;
 }
 
+void corlett_sample_rate_set(uint32 rate)
+{
+	sample_rate = rate;
+}
+
 void corlett_length_set(double length_seconds, double fade_seconds)
 {
 	total_samples = 0;
@@ -366,8 +779,8 @@ void corlett_length_set(double length_seconds, double fade_seconds)
 	}
 	else
 	{
-		uint32 length_samples = length_seconds * 44100;
-		uint32 fade_samples = fade_seconds * 44100;
+		uint32 length_samples = length_seconds * sample_rate;
+		uint32 fade_samples = fade_seconds * sample_rate;
 
 		decaybegin = length_samples;
 		decayend = length_samples + fade_samples;
@@ -386,23 +799,65 @@ uint32 corlett_sample_total(void)
 
 void corlett_sample_fade(stereo_sample_t *sample)
 {
-	if(total_samples >= decaybegin)
+	corlett_render_fade(sample, 1);
+}
+
+void corlett_skip(uint32 count)
+{
+	total_samples += count;
+	if(total_samples >= decaybegin && total_samples >= decayend)
 	{
-		int32 fader;
-		if(total_samples >= decayend)
-		{
-			ao_song_done = 1;
-			sample->l = 0;
-			sample->r = 0;
-		}
-		else
+		ao_song_done = 1;
+	}
+}
+
+ao_bool corlett_length_known(void)
+{
+	return decaybegin != (uint32)~0;
+}
+
+void corlett_fade_start(double fade_seconds)
+{
+	decaybegin = total_samples;
+	decayend = total_samples + (uint32)(fade_seconds * sample_rate);
+}
+
+void corlett_state(state_t *state)
+{
+	STATE_VAR(state, total_samples);
+	STATE_VAR(state, decaybegin);
+	STATE_VAR(state, decayend);
+}
+
+void corlett_render_fade(stereo_sample_t *buf, uint32 count)
+{
+	uint32 i;
+
+	// Nothing to do for the entire block before the fade starts
+	if(total_samples + count <= decaybegin)
+	{
+		total_samples += count;
+		return;
+	}
+	for(i = 0; i < count; i++, total_samples++)
+	{
+		if(total_samples >= decaybegin)
 		{
-			fader = 256 - (256 * (total_samples - decaybegin) / (decayend - decaybegin));
-			sample->l = (sample->l * fader) >> 8;
-			sample->r = (sample->r * fader) >> 8;
+			int32 fader;
+			if(total_samples >= decayend)
+			{
+				ao_song_done = 1;
+				buf[i].l = 0;
+				buf[i].r = 0;
+			}
+			else
+			{
+				fader = 256 - (256 * (total_samples - decaybegin) / (decayend - decaybegin));
+				buf[i].l = (buf[i].l * fader) >> 8;
+				buf[i].r = (buf[i].r * fader) >> 8;
+			}
 		}
 	}
-	total_samples++;
 }
 
 double psfTimeToSeconds(const char *str)
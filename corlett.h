@@ -41,6 +41,26 @@ typedef struct
 typedef int corlett_lib_callback_t(int libnum, uint8 *lib, uint64 size, corlett_t *c);
 
 int corlett_decode(uint8 *input, uint32 input_len, corlett_t *c, corlett_lib_callback_t *lib_callback);
+
+// Alternative to corlett_lib_callback_t for engines that decompress the
+// program sections straight into their own memory, rather than receiving
+// them in a temporary buffer. Called in the same order, with a stream that
+// can be read using corlett_stream_read(). Any data that the function
+// doesn't read is skipped afterwards.
+typedef struct corlett_stream corlett_stream_t;
+typedef int corlett_stream_callback_t(int libnum, corlett_stream_t *program, corlett_t *c);
+
+int corlett_decode_stream(uint8 *input, uint32 input_len, corlett_t *c, corlett_stream_callback_t *stream_callback);
+
+// Decompresses up to [len] bytes of the next data in [program] into [dst].
+// Returns the number of bytes written, which is only less than [len] at the
+// end of the program section or if its data is corrupt. In the latter case,
+// corlett_decode_stream() fails once the callback has returned.
+uint32 corlett_stream_read(corlett_stream_t *program, uint8 *dst, uint32 len);
+
+// Frees all libraries that corlett_decode() and corlett_decode_stream() kept
+// for later songs. Must not be called while any song is being decoded.
+void corlett_cache_free(void);
 void corlett_free(corlett_t *c);
 
 // Returns a writable pointer to the tag data, which is created if it doesn't
@@ -51,10 +71,24 @@ const char** corlett_tag_get(corlett_t *c, const char *tag);
 const char* corlett_tag_lookup(corlett_t *c, const char *tag);
 
 int corlett_tag_recognize(corlett_t *c, const char **target_value, int tag_num, const char *key);
+// Sets the rate of the samples counted by all functions below, for engines
+// that don't render at AUDIO_RATE. Has to be called before corlett_decode()
+// to apply to the length given in the tags, and reset after the song.
+void corlett_sample_rate_set(uint32 rate);
 void corlett_length_set(double length_seconds, double fade_seconds);
 uint32 corlett_sample_count(void);
 uint32 corlett_sample_total(void);
 void corlett_sample_fade(stereo_sample_t *sample);
+// Applies the fade to a whole block of [count] samples.
+void corlett_render_fade(stereo_sample_t *buf, uint32 count);
+// Advances the fade position by [count] samples without rendering them.
+void corlett_skip(uint32 count);
+// Returns whether the song has a length, i.e. will end by itself.
+ao_bool corlett_length_known(void);
+// Starts fading out the song right away.
+void corlett_fade_start(double fade_seconds);
+// Saves or restores the fade position.
+void corlett_state(state_t *state);
 double psfTimeToSeconds(const char *str);
 
 #ifdef __cplusplus
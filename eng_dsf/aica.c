@@ -10,10 +10,12 @@
 
 #include <assert.h>
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 #include "ao.h"
 #include "cpuintrf.h"
 #include "aica.h"
+#include "arm7.h"
 #include "dc_hw.h"
 #include "mididump.h"
 
@@ -128,7 +130,8 @@ static void AICA_MIDI_NoteOff(struct _SLOT *slot)
 }
 /// -----------------
 
-struct _AICA AICA;
+// Allocated on the heap, since the pan tables alone take up 1 MB.
+static AO_THREAD_LOCAL struct _AICA *AICA_chip;
 
 static void aica_exec_dma(struct _AICA *aica);       /*state DMA transfer function*/
 
@@ -342,13 +345,6 @@ int AICA_DumpSample(const UINT8 *ram, uint32 SA, uint16 LSA, uint16 LEA, AICA_SA
 		return 0;
 	}
 
-	sprintf(fn, "[0x%04x]_0x%06x", LEA, SA_real);
-	if (!wavedump_open(&wave, fn))
-	{
-		return 0;
-	}
-	wavedump_loop_set(&wave, LSA);
-
 	switch (PCMS)
 	{
 		case ST_PCM_16:
@@ -362,6 +358,13 @@ int AICA_DumpSample(const UINT8 *ram, uint32 SA, uint16 LSA, uint16 LEA, AICA_SA
 			InitADPCM(&adpcm);
 	}
 
+	sprintf(fn, "[0x%04x]_0x%06x", LEA, SA_real);
+	if (!wavedump_open(&wave, fn, 44100, byterate * 8, 1))
+	{
+		return 0;
+	}
+	wavedump_loop_set(&wave, LSA);
+
 	// just copy the sample if it's saved as raw PCM
 	if(PCMS < ST_ADPCM)
 	{
@@ -405,7 +408,7 @@ int AICA_DumpSample(const UINT8 *ram, uint32 SA, uint16 LSA, uint16 LEA, AICA_SA
 			wavedump_append(&wave, byterate, &adpcm.cur_sample);
 		}
 	}
-	wavedump_finish(&wave, 44100, byterate * 8, 1);
+	wavedump_finish(&wave);
 	return 1;
 }
 
@@ -443,6 +446,20 @@ static void AICA_StartSlot(struct _AICA *AICA, struct _SLOT *slot)
 	}
 }
 
+// Reports a key-on to the song end detection. Leaves out the KEYONEX bit,
+// which is only set on the slot whose register write triggered the key-on,
+// and the mixer registers, which drivers tend to only set after the key-on.
+static void AICA_SongEndKeyOn(struct _SLOT *slot)
+{
+	UINT16 regs[0x40];
+
+	memcpy(regs, slot->udata.data, sizeof(regs));
+	regs[0] &= ~0x8000;
+	regs[0x20/2] = 0;
+	regs[0x24/2] = 0;
+	songend_keyon(regs, sizeof(regs));
+}
+
 static void AICA_StopSlot(struct _SLOT *slot,int keyoff)
 {
 	if(keyoff /*&& slot->EG.state!=RELEASE*/)
@@ -461,6 +478,23 @@ static void AICA_StopSlot(struct _SLOT *slot,int keyoff)
 
 #define log_base_2(n) (log((float) n)/log((float) 2))
 
+// Tables that don't depend on any chip state, shared by all threads
+static ao_once_t tables_once;
+
+static void AICA_InitTables(void)
+{
+	int i;
+
+	for(i=0; i<0x400; ++i)
+	{
+		float envDB=((float)(3*(i-0x3ff)))/32.0;
+		float scale=(float)(1<<SHIFT);
+		EG_TABLE[i]=(INT32)(pow(10.0,envDB/20.0)*scale);
+	}
+
+	AICALFO_Init();
+}
+
 static void AICA_Init(struct _AICA *AICA, const struct AICAinterface *intf)
 {
 	int i=0;
@@ -493,13 +527,6 @@ static void AICA_Init(struct _AICA *AICA, const struct AICAinterface *intf)
 		}
 	}
 
-	for(i=0; i<0x400; ++i)
-	{
-		float envDB=((float)(3*(i-0x3ff)))/32.0;
-		float scale=(float)(1<<SHIFT);
-		EG_TABLE[i]=(INT32)(pow(10.0,envDB/20.0)*scale);
-	}
-
 	for(i=0; i<0x20000; ++i)
 	{
 		int iTL =(i>>0x0)&0xff;
@@ -582,7 +609,7 @@ static void AICA_Init(struct _AICA *AICA, const struct AICAinterface *intf)
 		AICA->Slots[i].lpend=1;
 	}
 
-	AICALFO_Init();
+	ao_once(&tables_once, AICA_InitTables);
 
 	// no "pend"
 	AICA[0].udata.data[0xa0/2] = 0;
@@ -609,6 +636,7 @@ static void AICA_UpdateSlotReg(struct _AICA *AICA,int s,int r)
 						if(KEYONB(s2) && s2->EG.state==RELEASE/*&& !s2->active*/)
 						{
 							s2->lpend = 0;
+							AICA_SongEndKeyOn(s2);
 							AICA_StartSlot(AICA, s2);
 							#ifdef DEBUG
 							printf("StartSlot[%02X]:   SSCTL %01X SA %06X LSA %04X LEA %04X PCMS %01X LPCTL %01X\n",sl,SSCTL(s2),SA(s2),LSA(s2),LEA(s2),PCMS(s2),LPCTL(s2));
@@ -1065,7 +1093,10 @@ void AICA_TimersAddTicks(struct _AICA *AICA, int ticks)
 	}
 }
 
-INLINE INT32 AICA_UpdateSlot(struct _AICA *AICA, struct _SLOT *slot)
+// With [render] set to 0, PCM sample data is not fetched, and the returned
+// sample is meaningless. Everything that has state (addresses, ADPCM
+// decoding, LFOs and the envelope) is still updated.
+INLINE INT32 AICA_UpdateSlot(struct _AICA *AICA, struct _SLOT *slot, int render)
 {
 	INT32 sample, fpart;
 	int cur_sample;       //current sample
@@ -1093,7 +1124,11 @@ INLINE INT32 AICA_UpdateSlot(struct _AICA *AICA, struct _SLOT *slot)
 		addr2=slot->nxt_addr>>SHIFT;
 	}
 
-	if(PCMS(slot) == 1)	// 8-bit signed
+	if(!render && PCMS(slot) < 2)
+	{
+		cur_sample = nxt_sample = 0;
+	}
+	else if(PCMS(slot) == 1)	// 8-bit signed
 	{
 		INT8 *p1=(signed char *) (AICA->AICARAM+(((SA(slot)+addr1))&0x7fffff));
 		INT8 *p2=(signed char *) (AICA->AICARAM+(((SA(slot)+addr2))&0x7fffff));
@@ -1210,12 +1245,17 @@ INLINE INT32 AICA_UpdateSlot(struct _AICA *AICA, struct _SLOT *slot)
 	return sample;
 }
 
-static void AICA_DoMasterSample(struct _AICA *AICA, stereo_sample_t *sample)
+// Passing NULL for [sample] only advances the state that later samples
+// depend on. Slots that don't feed the effect DSP skip fetching their sample
+// data, and the direct and DSP output mix is skipped entirely.
+INLINE void AICA_DoMasterSample(struct _AICA *AICA, stereo_sample_t *sample)
 {
 	int sl, i;
 	INT32 smpl, smpr;
+	int render = (sample != NULL);
 
 	smpl = smpr = 0;
+	songend_clock++;
 
 	// mix slots' direct output
 	for(sl=0; sl<64; ++sl)
@@ -1226,12 +1266,18 @@ static void AICA_DoMasterSample(struct _AICA *AICA, stereo_sample_t *sample)
 			unsigned int Enc;
 			signed int sample;
 
-			sample=AICA_UpdateSlot(AICA, slot);
+			if(!render && !IMXL(slot))
+			{
+				AICA_UpdateSlot(AICA, slot, 0);
+				continue;
+			}
+			sample=AICA_UpdateSlot(AICA, slot, 1);
 
 			Enc=((TL(slot))<<0x0)|((IMXL(slot))<<0xd);
 			AICADSP_SetSample(&AICA->DSP,(sample*AICA->LPANTABLE[Enc])>>(SHIFT-2),ISEL(slot),IMXL(slot));
-			Enc=((TL(slot))<<0x0)|((DIPAN(slot))<<0x8)|((DISDL(slot))<<0xd);
+			if(render)
 			{
+				Enc=((TL(slot))<<0x0)|((DIPAN(slot))<<0x8)|((DISDL(slot))<<0xd);
 				smpl+=(sample*AICA->LPANTABLE[Enc])>>SHIFT;
 				smpr+=(sample*AICA->RPANTABLE[Enc])>>SHIFT;
 			}
@@ -1239,21 +1285,26 @@ static void AICA_DoMasterSample(struct _AICA *AICA, stereo_sample_t *sample)
 	}
 
 	// process the DSP
+	PROFILE_ENTER(PROFILE_DSP);
 	AICADSP_Step(&AICA->DSP);
+	PROFILE_LEAVE();
 
-	// mix DSP output
-	for(i=0; i<16; ++i)
+	if(render)
 	{
-		if(EFSDL(i))
+		// mix DSP output
+		for(i=0; i<16; ++i)
 		{
-			unsigned int Enc=((EFPAN(i))<<0x8)|((EFSDL(i))<<0xd);
-			smpl+=(AICA->DSP.EFREG[i]*AICA->LPANTABLE[Enc])>>SHIFT;
-			smpr+=(AICA->DSP.EFREG[i]*AICA->RPANTABLE[Enc])>>SHIFT;
+			if(EFSDL(i))
+			{
+				unsigned int Enc=((EFPAN(i))<<0x8)|((EFSDL(i))<<0xd);
+				smpl+=(AICA->DSP.EFREG[i]*AICA->LPANTABLE[Enc])>>SHIFT;
+				smpr+=(AICA->DSP.EFREG[i]*AICA->RPANTABLE[Enc])>>SHIFT;
+			}
 		}
-	}
 
-	sample->l = ICLIP16(smpl>>3);
-	sample->r = ICLIP16(smpr>>3);
+		sample->l = ICLIP16(smpl>>3);
+		sample->r = ICLIP16(smpr>>3);
+	}
 
 	AICA_TimersAddTicks(AICA, 1);
 	CheckPendingIRQ(AICA);
@@ -1262,7 +1313,7 @@ static void AICA_DoMasterSample(struct _AICA *AICA, stereo_sample_t *sample)
 /* TODO: this needs to be timer-ized */
 static void aica_exec_dma(struct _AICA *aica)
 {
-	static UINT16 tmp_dma[4];
+	static AO_THREAD_LOCAL UINT16 tmp_dma[4];
 	int i;
 
 	printf("AICA: DMA transfer START\n"
@@ -1285,6 +1336,7 @@ static void aica_exec_dma(struct _AICA *aica)
 		{
 			for(i=0; i < aica->dma.dlg; i+=2)
 			{
+				ARM7_Invalidate(aica->dma.dmea);
 				aica->AICARAM[aica->dma.dmea] = 0;
 				aica->AICARAM[aica->dma.dmea+1] = 0;
 				aica->dma.dmea+=2;
@@ -1296,6 +1348,7 @@ static void aica_exec_dma(struct _AICA *aica)
 			{
 				UINT16 tmp;
 				tmp = AICA_r16(aica, aica->dma.drga);;
+				ARM7_Invalidate(aica->dma.dmea);
 				aica->AICARAM[aica->dma.dmea] = tmp & 0xff;
 				aica->AICARAM[aica->dma.dmea+1] = tmp>>8;
 				aica->dma.dmea+=4;
@@ -1348,36 +1401,66 @@ int AICA_IRQCB(void *param)
 
 void AICA_Update(void *param, INT16 **inputs, stereo_sample_t *sample)
 {
-	AICA_DoMasterSample(&AICA, sample);
+	AICA_DoMasterSample(AICA_chip, sample);
+}
+
+void AICA_Skip(void)
+{
+	AICA_DoMasterSample(AICA_chip, NULL);
 }
 
 void *aica_start(const void *config)
 {
 	const struct AICAinterface *intf = config;
 
-	memset(&AICA, 0, sizeof(struct _AICA));
+	if (!AICA_chip)
+	{
+		AICA_chip = malloc(sizeof(struct _AICA));
+		if (!AICA_chip)
+		{
+			return NULL;
+		}
+	}
+	memset(AICA_chip, 0, sizeof(struct _AICA));
 
 	// init the emulation
-	AICA_Init(&AICA, intf);
+	AICA_Init(AICA_chip, intf);
 
 	// set up the IRQ callbacks
-	AICA.IntARMCB = intf->irq_callback[0];
-	// AICA.stream = stream_create(0, 2, 44100, AICA, AICA_Update);
+	AICA_chip->IntARMCB = intf->irq_callback[0];
+	// AICA_chip->stream = stream_create(0, 2, 44100, AICA_chip, AICA_Update);
+
+	return AICA_chip;
+}
+
+void aica_stop(void)
+{
+	free(AICA_chip);
+	AICA_chip = NULL;
+}
+
+void AICA_State(state_t *state)
+{
+	// The pan tables are constant, and take up most of the structure.
+	uint8 *chip = (uint8 *)AICA_chip;
+	size_t tables_start = offsetof(struct _AICA, LPANTABLE);
+	size_t tables_end = offsetof(struct _AICA, TimPris);
 
-	return &AICA;
+	state_data(state, chip, tables_start);
+	state_data(state, chip + tables_end, sizeof(struct _AICA) - tables_end);
 }
 
 void AICA_set_ram_base(int which, void *base)
 {
-	AICA.AICARAM = base;
-	AICA.RAM_MASK = AICA.AICARAM_LENGTH-1;
-	AICA.RAM_MASK16 = AICA.RAM_MASK & 0x7ffffe;
-	AICA.DSP.AICARAM = base;
+	AICA_chip->AICARAM = base;
+	AICA_chip->RAM_MASK = AICA_chip->AICARAM_LENGTH-1;
+	AICA_chip->RAM_MASK16 = AICA_chip->RAM_MASK & 0x7ffffe;
+	AICA_chip->DSP.AICARAM = base;
 }
 
 READ16_HANDLER( AICA_0_r )
 {
-	UINT16 res = AICA_r16(&AICA, offset*2);
+	UINT16 res = AICA_r16(AICA_chip, offset*2);
 
 //	printf("Read AICA @ %x => %x (PC=%x, R5=%x)\n", offset*2, res, arm7_get_register(15), arm7_get_register(5));
 
@@ -1388,21 +1471,21 @@ extern UINT32* stv_scu;
 
 WRITE16_HANDLER( AICA_0_w )
 {
-	UINT16 tmp = AICA_r16(&AICA, offset*2);
+	UINT16 tmp = AICA_r16(AICA_chip, offset*2);
 	COMBINE_DATA(&tmp);
-	AICA_w16(&AICA,offset*2, tmp);
+	AICA_w16(AICA_chip,offset*2, tmp);
 }
 
 WRITE16_HANDLER( AICA_MidiIn )
 {
-	AICA.MidiStack[AICA.MidiW++]=data;
-	AICA.MidiW &= 15;
+	AICA_chip->MidiStack[AICA_chip->MidiW++]=data;
+	AICA_chip->MidiW &= 15;
 }
 
 READ16_HANDLER( AICA_MidiOutR )
 {
-	unsigned char val = AICA.MidiStack[AICA.MidiR++];
-	AICA.MidiR&=7;
+	unsigned char val = AICA_chip->MidiStack[AICA_chip->MidiR++];
+	AICA_chip->MidiR&=7;
 	return val;
 }
 
@@ -230,8 +230,6 @@ struct _AICA
 	struct _AICADSP DSP;
 };
 
-extern struct _AICA AICA;
-
 // AICA sample types (value of PCMS)
 typedef enum
 {
@@ -250,7 +248,12 @@ struct AICAinterface
 };
 
 void *aica_start(const void *config);
+void aica_stop(void);
 void AICA_Update(void *param, INT16 **inputs, stereo_sample_t *sample);
+// Advances the chip by one sample without generating any output.
+void AICA_Skip(void);
+// Saves or restores the chip state.
+void AICA_State(state_t *state);
 int AICA_DumpSample(const UINT8 *ram, uint32 SA, uint16 LSA, uint16 LEA, AICA_SAMPLE_TYPE PCMS);
 
 #define READ16_HANDLER(name)	data16_t name(offs_t offset, data16_t mem_mask)
@@ -3,6 +3,7 @@
 #include "ao.h"
 #include "cpuintrf.h"
 #include "aica.h"
+#include "arm7.h"
 
 static UINT16 PACK(INT32 val)
 {
@@ -303,6 +304,7 @@ void AICADSP_Step(struct _AICADSP *DSP)
 			}
 			if(MWT && (step&1))
 			{
+				ARM7_Invalidate(ADDR << 1);
 				if(NOFL)
 					DSP->AICARAM[ADDR]=SHIFTED>>8;
 				else
@@ -29,6 +29,9 @@ static int ASCALES[8][256];
 void AICALFO_Init(void)
 {
 	int i,s;
+	ao_rand_t rng;
+
+	ao_srand(&rng, 1);
 	for(i=0; i<256; ++i)
 	{
 		int a,p;
@@ -74,7 +77,7 @@ void AICALFO_Init(void)
 
 		//noise
 		//a=lfo_noise[i];
-		a=rand()&0xff;
+		a=ao_rand(&rng)&0xff;
 		p=128-a;
 		ALFO_NOI[i]=a;
 		PLFO_NOI[i]=p;
@@ -29,7 +29,7 @@ static void Reset (void);
   // public variables
 
   /** ARM7 state. */
-struct sARM7 ARM7;
+AO_THREAD_LOCAL struct sARM7 ARM7;
 
   // private variables
 
@@ -56,11 +56,22 @@ void ARM7_Init ()
   ARM7.flagi = FALSE;
   ARM7.cykle = 0;
 
+  // memory contents are new as well
+  ARM7i_Flush ();
+
   // reset will do the rest
   ARM7_HardReset ();
   }
   //--------------------------------------------------------------------------
 
+  //--------------------------------------------------------------------------
+  /** Frees the instruction cache. */
+void ARM7_Exit ()
+  {
+  ARM7i_Flush ();
+  }
+  //--------------------------------------------------------------------------
+
   //--------------------------------------------------------------------------
   /** Power-ON reset. */
 void ARM7_HardReset ()
@@ -131,6 +142,7 @@ void ARM7_SetCPSR (ARM7_REG sr)
 
   // new CPSR value
   ARM7.Rx [ARM7_CPSR] = sr;
+  ARM7_efekty++;
 
   // mode change could've enabled interrups, so we test for those and set
   // appropriate flag for the instruction loop to catch
@@ -243,14 +255,23 @@ int ARM7_Execute (int n)
   while (ARM7.cykle < n)
     {
     ARM7_CheckIRQ ();
-    while (!ARM7.flagi && ARM7.cykle < n)
-      // make one step, sum up cycles
-      ARM7.cykle += ARM7i_Step ();
+    ARM7i_Run (n);
     }
   return ARM7.cykle;
   }
   //--------------------------------------------------------------------------
 
+  //--------------------------------------------------------------------------
+  /** Saves or restores the processor state. */
+void ARM7_State (state_t *state)
+  {
+  STATE_VAR (state, ARM7);
+  // restored memory might contain different code
+  if (state->mode == STATE_LOAD)
+    ARM7i_Flush ();
+  }
+  //--------------------------------------------------------------------------
+
 
   // private functions
 
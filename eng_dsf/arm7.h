@@ -120,7 +120,54 @@ struct sARM7
 
   //--------------------------------------------------------------------------
   /** ARM7 state. */
-extern struct sARM7 ARM7;
+extern AO_THREAD_LOCAL struct sARM7 ARM7;
+  //--------------------------------------------------------------------------
+
+  //--------------------------------------------------------------------------
+  // decoded instruction cache
+
+  /** Instructions in the first ARM7_CACHE_SIZE bytes of the address space are
+ decoded once, and cached in pages of (1 << ARM7_CACHE_SHIFT) bytes that are
+ allocated on first execution. */
+#define ARM7_CACHE_SIZE 0x800000
+#define ARM7_CACHE_SHIFT 12
+#define ARM7_CACHE_PAGES (ARM7_CACHE_SIZE >> ARM7_CACHE_SHIFT)
+#define ARM7_CACHE_INSNS (1 << (ARM7_CACHE_SHIFT - 2))
+
+  /** Decoded ARM instruction. */
+struct sARM7_Insn
+  {
+  /** Handler, NULL if the instruction has to be decoded again. */
+  void (*op) (const struct sARM7_Insn *insn);
+  /** Instruction code. */
+  UINT32 kod;
+  /** Pre-decoded operand (immediate, offset or branch displacement). */
+  UINT32 arg;
+  /** Condition and register numbers. */
+  UINT8 war, Rn, Rd;
+  };
+
+  /** Cache pages, NULL if nothing was executed from them yet. */
+extern AO_THREAD_LOCAL struct sARM7_Insn *ARM7_cache [ARM7_CACHE_PAGES];
+
+  /** Number of events so far that can make an instruction behave differently
+ when it is executed again with the same registers: memory writes, reads
+ with side effects and mode changes. Used for idle loop detection. */
+extern AO_THREAD_LOCAL UINT32 ARM7_efekty;
+
+  /** Invalidates the cached instruction at the given address. Must be called
+ for every write to memory that the ARM7 can execute from. */
+INLINE void ARM7_Invalidate (UINT32 adres)
+  {
+  struct sARM7_Insn *page;
+  ARM7_efekty++;
+  if (adres < ARM7_CACHE_SIZE)
+    {
+    page = ARM7_cache [adres >> ARM7_CACHE_SHIFT];
+    if (page)
+      page [(adres >> 2) & (ARM7_CACHE_INSNS - 1)].op = NULL;
+    }
+  }
   //--------------------------------------------------------------------------
 
   //--------------------------------------------------------------------------
@@ -128,6 +175,8 @@ extern struct sARM7 ARM7;
 
   /** ARM7 emulator init. */
 void ARM7_Init (void);
+  /** Frees the instruction cache. */
+void ARM7_Exit (void);
 
   /** Power-ON reset. */
 void ARM7_HardReset (void);
@@ -150,6 +199,9 @@ void ARM7_Step (void);
   /** Runs emulation for at least n cycles, returns actual amount of cycles
  burned - normal interpreter. */
 int ARM7_Execute (int n);
+
+  /** Saves or restores the processor state. */
+void ARM7_State (state_t *state);
   //--------------------------------------------------------------------------
 
 enum
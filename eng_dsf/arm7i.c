@@ -4,6 +4,8 @@
 // (c) Radoslaw Balcewicz
 //
 
+#include <stdlib.h>
+#include <string.h>
 #include "arm7.h"
 #include "arm7i.h"
 
@@ -129,6 +131,11 @@ static void R_G111 (void);
   /** Halfword and Signed Data Transfer. */
 static void R_HSDT ();
 #endif
+
+  /** Step without the instruction cache. */
+static int R_StepUncached (void);
+  /** Fills a cache entry for the given instruction code. */
+static void R_Decode (struct sARM7_Insn *insn, UINT32 kod);
   //--------------------------------------------------------------------------
 
   //--------------------------------------------------------------------------
@@ -145,7 +152,36 @@ static int s_tabAL [16] = {FALSE, FALSE, TRUE, TRUE, TRUE, TRUE, TRUE, TRUE,
  FALSE, FALSE, TRUE, TRUE, FALSE, FALSE, FALSE, FALSE};
 
   /** Cycles it took for current instruction to complete. */
-static int s_cykle;
+static AO_THREAD_LOCAL int s_cykle;
+
+  /** Conditions as bit masks, indexed by the NZCV flags. */
+static const UINT16 s_tabWarBity [16] = {0xf0f0, 0x0f0f, 0xcccc, 0x3333,
+ 0xff00, 0x00ff, 0xaaaa, 0x5555, 0x0c0c, 0xf3f3, 0xaa55, 0x55aa, 0x0a05,
+ 0xf5fa, 0xffff, 0x0000};
+
+  /** Decoded instruction cache pages. */
+AO_THREAD_LOCAL struct sARM7_Insn *ARM7_cache [ARM7_CACHE_PAGES];
+
+  /** Side effect counter for idle loop detection. */
+AO_THREAD_LOCAL UINT32 ARM7_efekty;
+
+  /** Longest loop, in bytes, that is checked for being idle. */
+#define IDLE_PETLA_MAX 64
+
+  /** State at the last short backward branch. If the next iteration of the
+ loop ends in the same state without any side effects, all further
+ iterations will do the same until an interrupt arrives, which can only
+ happen outside of ARM7i_Run (). */
+static AO_THREAD_LOCAL struct
+  {
+  int wazny;
+  int cykle;
+  UINT32 efekty;
+  ARM7_REG Rx [18];
+  } s_idle;
+
+  /** Cycle count at which ARM7i_Run () returns. */
+static AO_THREAD_LOCAL int s_cel;
   //--------------------------------------------------------------------------
 
 
@@ -155,6 +191,71 @@ static int s_cykle;
   //--------------------------------------------------------------------------
   /** Single step, returns number of burned cycles. */
 int ARM7i_Step ()
+  {
+  UINT32 pc = ARM7.Rx [ARM7_PC] & ~3;
+  struct sARM7_Insn *page, *insn;
+
+  if (pc >= ARM7_CACHE_SIZE)
+    return R_StepUncached ();
+  page = ARM7_cache [pc >> ARM7_CACHE_SHIFT];
+  if (!page)
+    {
+    page = calloc (ARM7_CACHE_INSNS, sizeof (struct sARM7_Insn));
+    if (!page)
+      return R_StepUncached ();
+    ARM7_cache [pc >> ARM7_CACHE_SHIFT] = page;
+    }
+  insn = &page [(pc >> 2) & (ARM7_CACHE_INSNS - 1)];
+  if (!insn->op)
+    R_Decode (insn, arm7_read_32 (pc));
+
+  ARM7.kod = insn->kod;
+  ARM7.Rx [ARM7_PC] += 4;
+  s_cykle = 2;
+  if ((s_tabWarBity [insn->war] >> ((UINT32)ARM7.Rx [ARM7_CPSR] >> 28)) & 1)
+    insn->op (insn);
+  return s_cykle;
+  }
+  //--------------------------------------------------------------------------
+
+  //--------------------------------------------------------------------------
+  /** Steps until n cycles are burned in total or an interrupt is pending,
+ skipping idle loops. */
+void ARM7i_Run (int n)
+  {
+  // memory and AICA registers might have changed since the last call
+  s_idle.wazny = FALSE;
+  s_cel = n;
+  while (!ARM7.flagi && ARM7.cykle < n)
+    {
+    // make one step, sum up cycles
+    PROFILE_INSN ();
+    ARM7.cykle += ARM7i_Step ();
+    }
+  }
+  //--------------------------------------------------------------------------
+
+  //--------------------------------------------------------------------------
+  /** Discards all decoded instructions. */
+void ARM7i_Flush ()
+  {
+  int i;
+
+  for (i = 0; i < ARM7_CACHE_PAGES; i++)
+    {
+    free (ARM7_cache [i]);
+    ARM7_cache [i] = NULL;
+    }
+  }
+  //--------------------------------------------------------------------------
+
+
+  // private functions
+
+
+  //--------------------------------------------------------------------------
+  /** Step without the instruction cache. */
+int R_StepUncached ()
   {
   ARM7.kod = arm7_read_32 (ARM7.Rx [ARM7_PC] & ~3);
 
@@ -169,10 +270,6 @@ int ARM7i_Step ()
   }
   //--------------------------------------------------------------------------
 
-
-  // private functions
-
-
   //--------------------------------------------------------------------------
   /** Condition EQ. */
 int R_WEQ ()
@@ -1339,3 +1436,336 @@ void R_HSDT ()
   }
   //--------------------------------------------------------------------------
 #endif
+
+  //--------------------------------------------------------------------------
+  // decoded instruction handlers
+
+  /** Instructions that are executed the same way as without the cache. */
+#define R_BEZ_DEKODOWANIA(nazwa) \
+static void nazwa##_i (const struct sARM7_Insn *insn) \
+  { \
+  nazwa (); \
+  }
+
+#ifdef ARM7_THUMB
+R_BEZ_DEKODOWANIA (R_G00x)
+#else
+R_BEZ_DEKODOWANIA (R_SWP)
+R_BEZ_DEKODOWANIA (R_MUL_MLA)
+R_BEZ_DEKODOWANIA (R_PSR)
+#endif
+R_BEZ_DEKODOWANIA (R_SDT)
+R_BEZ_DEKODOWANIA (R_BDT)
+R_BEZ_DEKODOWANIA (R_G110)
+R_BEZ_DEKODOWANIA (R_G111)
+
+#undef R_BEZ_DEKODOWANIA
+
+  //--------------------------------------------------------------------------
+  /** First operand of data processing instructions. */
+INLINE ARM7_REG R_DP_Arg1 (const struct sARM7_Insn *insn)
+  {
+  if (insn->Rn != ARM7_PC)
+    return ARM7.Rx [insn->Rn];
+  // register or immediate shift?
+  if ((insn->kod & ((1 << 25) | (1 << 4))) == (1 << 4))
+    return (ARM7.Rx [ARM7_PC] & ~3) + 12 + PC_ADJUSTMENT;
+  return (ARM7.Rx [ARM7_PC] & ~3) + 8 + PC_ADJUSTMENT;
+  }
+  //--------------------------------------------------------------------------
+
+  //--------------------------------------------------------------------------
+  /** Data processing result writeback, with flags only if requested. */
+INLINE void R_DP_Wynik (const struct sARM7_Insn *insn, ARM7_REG w)
+  {
+  if (insn->kod & (1 << 20))
+    R_WynikDP (w);
+  else
+    ARM7.Rx [insn->Rd] = w;
+  }
+  //--------------------------------------------------------------------------
+
+  /** Data processing instructions, with the second operand either as a
+ pre-rotated immediate or from the barrel shifter. */
+#define R_DP_OP(nazwa, kod) \
+static void R_##nazwa##_imm (const struct sARM7_Insn *insn) \
+  { \
+  ARM7_REG arg1 = R_DP_Arg1 (insn); \
+  ARM7_REG arg2 = insn->arg; \
+  /* preload carry out from C */ \
+  ARM7.carry = (ARM7.Rx [ARM7_CPSR] & ARM7_CPSR_C) ? 1 : 0; \
+  kod \
+  } \
+static void R_##nazwa##_reg (const struct sARM7_Insn *insn) \
+  { \
+  ARM7_REG arg1 = R_DP_Arg1 (insn); \
+  ARM7_REG arg2 = WyliczPrzes (); \
+  kod \
+  }
+
+R_DP_OP (AND, R_DP_Wynik (insn, arg1 & arg2);)
+R_DP_OP (EOR, R_DP_Wynik (insn, arg1 ^ arg2);)
+R_DP_OP (SUB,
+  ARM7_REG w = arg1 - arg2;
+  ARM7.carry = SUBCARRY (arg1, arg2, w);
+  ARM7.overflow = SUBOVERFLOW (arg1, arg2, w);
+  R_DP_Wynik (insn, w);
+)
+R_DP_OP (RSB,
+  ARM7_REG w = arg2 - arg1;
+  ARM7.carry = SUBCARRY (arg2, arg1, w);
+  ARM7.overflow = SUBOVERFLOW (arg2, arg1, w);
+  R_DP_Wynik (insn, w);
+)
+R_DP_OP (ADD,
+  ARM7_REG w = arg1 + arg2;
+  ARM7.carry = ADDCARRY (arg1, arg2, w);
+  ARM7.overflow = ADDOVERFLOW (arg1, arg2, w);
+  R_DP_Wynik (insn, w);
+)
+R_DP_OP (ADC,
+  ARM7_REG w = arg1 + arg2 + ((ARM7.Rx [ARM7_CPSR] & ARM7_CPSR_C) ? 1 : 0);
+  ARM7.carry = ADDCARRY (arg1, arg2, w);
+  ARM7.overflow = ADDOVERFLOW (arg1, arg2, w);
+  R_DP_Wynik (insn, w);
+)
+R_DP_OP (SBC,
+  ARM7_REG w = arg1 - arg2 - ((ARM7.Rx [ARM7_CPSR] & ARM7_CPSR_C) ? 0 : 1);
+  ARM7.carry = SUBCARRY (arg1, arg2, w);
+  ARM7.overflow = SUBOVERFLOW (arg1, arg2, w);
+  R_DP_Wynik (insn, w);
+)
+R_DP_OP (RSC,
+  ARM7_REG w = arg2 - arg1 - ((ARM7.Rx [ARM7_CPSR] & ARM7_CPSR_C) ? 0 : 1);
+  ARM7.carry = SUBCARRY (arg2, arg1, w);
+  ARM7.overflow = SUBOVERFLOW (arg2, arg1, w);
+  R_DP_Wynik (insn, w);
+)
+R_DP_OP (TST, R_FlagiDP (arg1 & arg2);)
+R_DP_OP (TEQ, R_FlagiDP (arg1 ^ arg2);)
+R_DP_OP (CMP,
+  ARM7_REG w = arg1 - arg2;
+  ARM7.carry = SUBCARRY (arg1, arg2, w);
+  ARM7.overflow = SUBOVERFLOW (arg1, arg2, w);
+  R_FlagiDP (w);
+)
+R_DP_OP (CMN,
+  ARM7_REG w = arg1 + arg2;
+  ARM7.carry = ADDCARRY (arg1, arg2, w);
+  ARM7.overflow = ADDOVERFLOW (arg1, arg2, w);
+  R_FlagiDP (w);
+)
+R_DP_OP (ORR, R_DP_Wynik (insn, arg1 | arg2);)
+R_DP_OP (MOV, (void)arg1; R_DP_Wynik (insn, arg2);)
+R_DP_OP (BIC, R_DP_Wynik (insn, arg1 & ~arg2);)
+R_DP_OP (MVN, (void)arg1; R_DP_Wynik (insn, ~arg2);)
+
+#undef R_DP_OP
+
+  /** Data processing handlers, indexed by the I bit and the opcode. */
+static void (*const s_tabDP [2][16]) (const struct sARM7_Insn *) = {
+  {R_AND_reg, R_EOR_reg, R_SUB_reg, R_RSB_reg, R_ADD_reg, R_ADC_reg,
+ R_SBC_reg, R_RSC_reg, R_TST_reg, R_TEQ_reg, R_CMP_reg, R_CMN_reg, R_ORR_reg,
+ R_MOV_reg, R_BIC_reg, R_MVN_reg},
+  {R_AND_imm, R_EOR_imm, R_SUB_imm, R_RSB_imm, R_ADD_imm, R_ADC_imm,
+ R_SBC_imm, R_RSC_imm, R_TST_imm, R_TEQ_imm, R_CMP_imm, R_CMN_imm, R_ORR_imm,
+ R_MOV_imm, R_BIC_imm, R_MVN_imm}};
+
+  //--------------------------------------------------------------------------
+  /** Single data transfer with an immediate offset, pre-negated for "down"
+ transfers. */
+static void R_SDT_imm (const struct sARM7_Insn *insn)
+  {
+  int Rn = insn->Rn, Rd = insn->Rd;
+  UINT32 adres, w = 0;
+
+#define BIT_P (insn->kod & (1 << 24))
+#define BIT_B (insn->kod & (1 << 22))
+#define BIT_W (insn->kod & (1 << 21))
+#define BIT_L (insn->kod & (1 << 20))
+
+  if (Rn != ARM7_PC)
+    adres = ARM7.Rx [Rn];
+  else
+    adres = ARM7.Rx [ARM7_PC] & ~3;
+  if (!BIT_L)
+    {
+    if (Rd != ARM7_PC)
+      w = ARM7.Rx [Rd];
+    else
+      w = (ARM7.Rx [ARM7_PC] & ~3) + 12 + PC_ADJUSTMENT;
+    }
+
+  if (BIT_P)
+    {
+    // "pre-index"
+    adres += insn->arg;
+    if (BIT_W)
+      // "write-back"
+      ARM7.Rx [Rn] = adres;
+    }
+  else
+    // "post-index"
+    ARM7.Rx [Rn] += insn->arg;
+  if (Rn == ARM7_PC)
+    adres += 8 + PC_ADJUSTMENT;
+
+  if (BIT_L)
+    {
+    s_cykle += 3;
+    // "load"
+    if (BIT_B)
+      // "byte"
+      ARM7.Rx [Rd] = arm7_read_8 (adres);
+    else
+      // "word"
+      ARM7.Rx [Rd] = RBOD (arm7_read_32 (adres & ~3), adres & 3);
+    }
+  else
+    {
+    s_cykle += 2;
+    // "store"
+    if (BIT_B)
+      // "byte"
+      arm7_write_8 (adres, (UINT8)w);
+    else
+      // "word"
+      arm7_write_32 (adres & ~3, w);
+    }
+
+#undef BIT_L
+#undef BIT_W
+#undef BIT_B
+#undef BIT_P
+  }
+  //--------------------------------------------------------------------------
+
+  //--------------------------------------------------------------------------
+  /** Branch, with the pre-calculated PC offset. */
+static void R_B_i (const struct sARM7_Insn *insn)
+  {
+  s_cykle += 4;
+  ARM7.Rx [ARM7_PC] += insn->arg;
+  }
+  //--------------------------------------------------------------------------
+
+  //--------------------------------------------------------------------------
+  /** Branch with link, with the pre-calculated PC offset. */
+static void R_BL_i (const struct sARM7_Insn *insn)
+  {
+  s_cykle += 4;
+  ARM7.Rx [ARM7_LR] = (ARM7.Rx [ARM7_PC] & ~3) + 4 + PC_ADJUSTMENT;
+  ARM7.Rx [ARM7_PC] += insn->arg;
+  }
+  //--------------------------------------------------------------------------
+
+  //--------------------------------------------------------------------------
+  /** Branch back to the start of a short loop, which is skipped ahead if it
+ turns out to be idle. */
+static void R_B_petla_i (const struct sARM7_Insn *insn)
+  {
+  int cykle, okres, reszta;
+
+  s_cykle += 4;
+  ARM7.Rx [ARM7_PC] += insn->arg;
+
+  // cycles burned after this instruction
+  cykle = ARM7.cykle + s_cykle;
+  if (s_idle.wazny && s_idle.efekty == ARM7_efekty &&\
+ !memcmp (s_idle.Rx, ARM7.Rx, sizeof (s_idle.Rx)))
+    {
+    // Skip as many whole iterations as possible while staying below the
+    // target, so that we stop at the same instruction as without skipping.
+    okres = cykle - s_idle.cykle;
+    reszta = s_cel - cykle;
+    if (reszta > 0)
+      s_cykle += ((reszta - 1) / okres) * okres;
+    }
+  else
+    {
+    memcpy (s_idle.Rx, ARM7.Rx, sizeof (s_idle.Rx));
+    s_idle.efekty = ARM7_efekty;
+    s_idle.wazny = TRUE;
+    }
+  s_idle.cykle = ARM7.cykle + s_cykle;
+  }
+  //--------------------------------------------------------------------------
+
+  //--------------------------------------------------------------------------
+  /** Fills a cache entry for the given instruction code. */
+void R_Decode (struct sARM7_Insn *insn, UINT32 kod)
+  {
+  INT32 offset;
+  int rot;
+
+  insn->kod = kod;
+  insn->war = (kod >> 28) & 15;
+  insn->Rn = (kod >> 16) & 15;
+  insn->Rd = (kod >> 12) & 15;
+  insn->arg = 0;
+
+  switch ((kod >> 25) & 7)
+    {
+    case 0:
+    case 1:
+#ifdef ARM7_THUMB
+      insn->op = R_G00x_i;
+#else
+      // same order of tests as R_G00x ()
+      if ((kod & 0x03b00090) == 0x01000090)
+        insn->op = R_SWP_i;
+      else if ((kod & 0x03c00090) == 0x00000090)
+        insn->op = R_MUL_MLA_i;
+      else if ((kod & 0x01900000) == 0x01000000)
+        insn->op = R_PSR_i;
+      else if (kod & (1 << 25))
+        {
+        // immediate in lowest 12 bits
+        rot = ((kod >> 8) & 0xf) * 2;
+        insn->arg = rot ? ROR (kod & 0xff, rot) : (kod & 0xff);
+        insn->op = s_tabDP [1][(kod >> 21) & 15];
+        }
+      else
+        insn->op = s_tabDP [0][(kod >> 21) & 15];
+#endif
+      break;
+
+    case 2:
+      // immediate offset
+      insn->arg = kod & 0xfff;
+      if (!(kod & (1 << 23)))
+        insn->arg = -insn->arg;
+      insn->op = R_SDT_imm;
+      break;
+
+    case 3:
+      insn->op = R_SDT_i;
+      break;
+
+    case 4:
+      insn->op = R_BDT_i;
+      break;
+
+    case 5:
+      offset = (kod & 0x00ffffff) << 2;
+      if (offset & 0x02000000)
+        offset |= 0xfc000000;
+      insn->arg = offset + 8 + PC_ADJUSTMENT;
+      if (kod & (1 << 24))
+        insn->op = R_BL_i;
+      else if ((INT32)insn->arg < 0 && (INT32)insn->arg >= -IDLE_PETLA_MAX)
+        insn->op = R_B_petla_i;
+      else
+        insn->op = R_B_i;
+      break;
+
+    case 6:
+      insn->op = R_G110_i;
+      break;
+
+    case 7:
+      insn->op = R_G111_i;
+      break;
+    }
+  }
+  //--------------------------------------------------------------------------
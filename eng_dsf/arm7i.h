@@ -14,6 +14,11 @@
 
   /** Single step, returns number of burned cycles. */
 int ARM7i_Step(void);
+  /** Steps until n cycles are burned in total or an interrupt is pending,
+ skipping idle loops. */
+void ARM7i_Run(int n);
+  /** Discards all decoded instructions. */
+void ARM7i_Flush(void);
   //--------------------------------------------------------------------------
 
 #endif
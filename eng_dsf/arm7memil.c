@@ -2,37 +2,69 @@
 
 #include "dc_hw.h"
 
+// RAM is accessed directly through the page table, everything else goes
+// through the dc_hw.c handlers. Writes also invalidate any decoded
+// instruction at their address.
+
 INLINE void arm7_write_32(UINT32 addr, UINT32 data )
 {
+	uint8 *page = dc_page(addr);
+
 	addr &= ~3;
+	ARM7_Invalidate(addr);
+	if (page)
+	{
+		dc_page_write32(page, addr, data);
+		return;
+	}
 	dc_write32(addr,data);
 }
 
 
 INLINE void arm7_write_16(UINT32 addr, UINT16 data)
 {
+	uint8 *page = dc_page(addr);
+
 	addr &= ~1;
+	ARM7_Invalidate(addr);
+	if (page)
+	{
+		dc_page_write16(page, addr, data);
+		return;
+	}
 	dc_write16(addr,data);
 }
 
 INLINE void arm7_write_8(UINT32 addr, UINT8 data)
 {
+	uint8 *page = dc_page(addr);
+
+	ARM7_Invalidate(addr);
+	if (page)
+	{
+		page[addr & DC_PAGE_MASK] = data;
+		return;
+	}
 	dc_write8(addr,data);
 }
 
 INLINE UINT32 arm7_read_32(UINT32 addr)
 {
 	UINT32 result;
+	const uint8 *page = dc_page(addr);
 	int k = (addr & 3) << 3;
 
-	if (k)
+	if (page)
 	{
-		result = dc_read32 (addr & ~3);
-		result = (result >> k) | (result << (32 - k));
+		result = dc_page_read32(page, addr & ~3);
 	}
 	else
 	{
-		result = dc_read32(addr);
+		result = dc_read32(addr & ~3);
+	}
+	if (k)
+	{
+		result = (result >> k) | (result << (32 - k));
 	}
 	return result;
 }
@@ -40,8 +72,16 @@ INLINE UINT32 arm7_read_32(UINT32 addr)
 INLINE UINT16 arm7_read_16(UINT32 addr)
 {
 	UINT16 result;
+	const uint8 *page = dc_page(addr);
 
-	result = dc_read16(addr & ~1);
+	if (page)
+	{
+		result = dc_page_read16(page, addr & ~1);
+	}
+	else
+	{
+		result = dc_read16(addr & ~1);
+	}
 
 	if (addr & 1)
 	{
@@ -53,6 +93,11 @@ INLINE UINT16 arm7_read_16(UINT32 addr)
 
 INLINE UINT8 arm7_read_8(UINT32 addr)
 {
+	const uint8 *page = dc_page(addr);
+
+	if (page)
+	{
+		return page[addr & DC_PAGE_MASK];
+	}
 	return dc_read8(addr);
 }
-
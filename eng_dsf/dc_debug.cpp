@@ -21,7 +21,9 @@ extern "C" void dc_debug(void)
 
 	if(ImGui::CollapsingHeader("Memory", NULL, true, true)) {
 		static DebugMemoryState memory_state;
-		debug_memory("DC RAM", &memory_state, dc_ram, sizeof(dc_ram));
+		if(dc_ram_debug) {
+			debug_memory("DC RAM", &memory_state, dc_ram_debug, DC_RAM_SIZE);
+		}
 	}
 	ImGui::End();
 }
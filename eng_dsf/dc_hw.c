@@ -1,5 +1,8 @@
 // dc_hw.c - Hardware found on the ARM7/AICA side of the Dreamcast
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "ao.h"
 #include "dc_hw.h"
 #include "aica.h"
@@ -12,7 +15,11 @@
 #include "arm7core.h"
 #endif
 
-uint8 dc_ram[8*1024*1024];
+AO_THREAD_LOCAL uint8 *dc_ram;
+AO_THREAD_LOCAL uint8 *dc_pages[DC_PAGE_COUNT];
+#ifndef NOGUI
+uint8 *dc_ram_debug;
+#endif
 
 static void aica_irq(int irq)
 {
@@ -39,14 +46,27 @@ static void aica_irq(int irq)
 #define MIXER(level,pan) ((level & 0xff) | ((pan & 0x03) << 8))
 #define YM3012_VOL(LVol,LPan,RVol,RPan) (MIXER(LVol,LPan)|(MIXER(RVol,RPan) << 16))
 
-static struct AICAinterface aica_interface =
+static const struct AICAinterface aica_interface =
 {
 	1,
-	{ dc_ram, },
+	{ NULL, },
 	{ YM3012_VOL(100, MIXER_PAN_LEFT, 100, MIXER_PAN_RIGHT) },
 	{ aica_irq, },
 };
 
+// Reading the MIDI input or the LP flag changes the AICA state, which the
+// ARM7 needs to know for its idle loop detection.
+static void aica_read_effects(uint32 addr)
+{
+	#if DK_CORE
+	addr &= 0x7ffe;
+	if ((addr == 0x2808) || (addr == 0x2810))
+	{
+		ARM7_efekty++;
+	}
+	#endif
+}
+
 uint8 dc_read8(uint32 addr)
 {
 	if (addr < 0x800000)
@@ -56,7 +76,10 @@ uint8 dc_read8(uint32 addr)
 
 	if ((addr >= 0x800000) && (addr <= 0x807fff))
 	{
-		int foo = AICA_0_r((addr-0x800000)/2, 0);
+		int foo;
+
+		aica_read_effects(addr);
+		foo = AICA_0_r((addr-0x800000)/2, 0);
 
 		if (addr & 1)
 		{
@@ -81,6 +104,7 @@ uint16 dc_read16(uint32 addr)
 
 	if ((addr >= 0x800000) && (addr <= 0x807fff))
 	{
+		aica_read_effects(addr);
 		return AICA_0_r((addr-0x800000)/2, 0);
 	}
 
@@ -97,6 +121,7 @@ uint32 dc_read32(uint32 addr)
 
 	if ((addr >= 0x800000) && (addr <= 0x807fff))
 	{
+		aica_read_effects(addr);
 		addr &= 0x7fff;
 		return AICA_0_r(addr/2, 0) & 0xffff;
 	}
@@ -166,9 +191,63 @@ void dc_write32(uint32 addr, uint32 data)
 	printf("W32 %x @ %x\n", data, addr);
 }
 
+// Allocates zeroed Dreamcast RAM for the current thread, and maps it for the
+// ARM7.
+int dc_hw_alloc(void)
+{
+	uint32 page;
+
+	if (!dc_ram)
+	{
+		dc_ram = malloc(DC_RAM_SIZE);
+		if (!dc_ram)
+		{
+			printf("ERROR: could not allocate %d bytes of memory\n", DC_RAM_SIZE);
+			return AO_FAIL;
+		}
+	}
+	memset(dc_ram, 0, DC_RAM_SIZE);
+	for (page = 0; page < (DC_RAM_SIZE >> DC_PAGE_SHIFT); page++)
+	{
+		dc_pages[page] = &dc_ram[page << DC_PAGE_SHIFT];
+	}
+#ifndef NOGUI
+	dc_ram_debug = dc_ram;
+#endif
+	return AO_SUCCESS;
+}
+
 void dc_hw_init(void)
 {
-	aica_interface.region[0] = dc_ram;
-	aica_start(&aica_interface);
+	struct AICAinterface intf = aica_interface;
+
+	intf.region[0] = dc_ram;
+	aica_start(&intf);
+}
+
+void dc_hw_state(state_t *state)
+{
+	state_data(state, dc_ram, DC_RAM_SIZE);
+	#if DK_CORE
+	ARM7_State(state);
+	#endif
+	AICA_State(state);
+}
+
+void dc_hw_free(void)
+{
+	aica_stop();
+#ifndef NOGUI
+	if (dc_ram_debug == dc_ram)
+	{
+		dc_ram_debug = NULL;
+	}
+#endif
+	#if DK_CORE
+	ARM7_Exit();
+	#endif
+	free(dc_ram);
+	dc_ram = NULL;
+	memset(dc_pages, 0, sizeof(dc_pages));
 }
 
@@ -5,9 +5,19 @@
 extern "C" {
 #endif
 
-extern uint8 dc_ram[8*1024*1024];
+#define DC_RAM_SIZE (8*1024*1024)
 
+extern AO_THREAD_LOCAL uint8 *dc_ram;
+#ifndef NOGUI
+// The RAM of the most recently started song, for the debug GUI thread
+extern uint8 *dc_ram_debug;
+#endif
+
+int dc_hw_alloc(void);
 void dc_hw_init(void);
+void dc_hw_free(void);
+// Saves or restores the RAM, CPU and AICA state.
+void dc_hw_state(state_t *state);
 
 uint8 dc_read8(uint32 addr);
 uint16 dc_read16(uint32 addr);
@@ -16,6 +26,72 @@ void dc_write8(uint32 addr, uint8 byte);
 void dc_write16(uint32 addr, uint16 word);
 void dc_write32(uint32 addr, uint32 dword);
 
+// ARM7 memory map, in pages of 64 KB over the 16 MB that the ARM7 decodes.
+// Pages of RAM point directly into dc_ram. All others, including the AICA
+// register window at 0x800000, are NULL and handled by the dc_read*() and
+// dc_write*() functions above.
+#define DC_PAGE_SHIFT 16
+#define DC_PAGE_MASK ((1 << DC_PAGE_SHIFT) - 1)
+#define DC_PAGE_COUNT (0x1000000 >> DC_PAGE_SHIFT)
+
+extern AO_THREAD_LOCAL uint8 *dc_pages[DC_PAGE_COUNT];
+
+INLINE uint8 *dc_page(uint32 addr)
+{
+	return (addr < 0x1000000) ? dc_pages[addr >> DC_PAGE_SHIFT] : NULL;
+}
+
+// Little-endian accesses to an aligned address [addr] inside [page].
+#if LSB_FIRST
+INLINE uint16 dc_page_read16(const uint8 *page, uint32 addr)
+{
+	return *(const uint16 *)&page[addr & DC_PAGE_MASK];
+}
+
+INLINE uint32 dc_page_read32(const uint8 *page, uint32 addr)
+{
+	return *(const uint32 *)&page[addr & DC_PAGE_MASK];
+}
+
+INLINE void dc_page_write16(uint8 *page, uint32 addr, uint16 data)
+{
+	*(uint16 *)&page[addr & DC_PAGE_MASK] = data;
+}
+
+INLINE void dc_page_write32(uint8 *page, uint32 addr, uint32 data)
+{
+	*(uint32 *)&page[addr & DC_PAGE_MASK] = data;
+}
+#else
+INLINE uint16 dc_page_read16(const uint8 *page, uint32 addr)
+{
+	const uint8 *p = &page[addr & DC_PAGE_MASK];
+	return p[0] | (p[1] << 8);
+}
+
+INLINE uint32 dc_page_read32(const uint8 *page, uint32 addr)
+{
+	const uint8 *p = &page[addr & DC_PAGE_MASK];
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32)p[3] << 24);
+}
+
+INLINE void dc_page_write16(uint8 *page, uint32 addr, uint16 data)
+{
+	uint8 *p = &page[addr & DC_PAGE_MASK];
+	p[0] = data & 0xff;
+	p[1] = (data >> 8) & 0xff;
+}
+
+INLINE void dc_page_write32(uint8 *page, uint32 addr, uint32 data)
+{
+	uint8 *p = &page[addr & DC_PAGE_MASK];
+	p[0] = data & 0xff;
+	p[1] = (data >> 8) & 0xff;
+	p[2] = (data >> 16) & 0xff;
+	p[3] = (data >> 24) & 0xff;
+}
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -16,6 +16,7 @@
 #include "ao.h"
 #include "eng_protos.h"
 #include "corlett.h"
+#include "utils.h"
 #include "dc_hw.h"
 #include "aica.h"
 
@@ -27,13 +28,27 @@
 #include "arm7core.h"
 #endif
 
-static corlett_t	c = {0};
+// ARM7 cycles per sample, at a quarter of the 33 MHz clock
+#define DSF_SAMPLE_CYCLES	((33000000 / 60 / 4) / AUDIO_FRAME_SAMPLES)
 
-int dsf_lib(int libnum, uint8 *lib, uint64 size, corlett_t *c)
+static AO_THREAD_LOCAL corlett_t	c = {0};
+
+int dsf_lib(int libnum, corlett_stream_t *program, corlett_t *c)
 {
-	// patch the file into ram
-	uint32 offset = lib[0] | lib[1]<<8 | lib[2]<<16 | lib[3]<<24;
-	memcpy(&dc_ram[offset], lib+4, size-4);
+	// decompress the file straight into ram
+	uint8 header[4];
+	uint32 offset;
+
+	if (corlett_stream_read(program, header, 4) < 4)
+	{
+		return AO_SUCCESS;
+	}
+	offset = header[0] | header[1]<<8 | header[2]<<16 | header[3]<<24;
+	if (offset > DC_RAM_SIZE)
+	{
+		return AO_FAIL;
+	}
+	corlett_stream_read(program, &dc_ram[offset], DC_RAM_SIZE - offset);
 
 	return AO_SUCCESS;
 }
@@ -41,10 +56,13 @@ int dsf_lib(int libnum, uint8 *lib, uint64 size, corlett_t *c)
 int32 dsf_start(uint8 *buffer, uint32 length)
 {
 	// clear Dreamcast work RAM before we start scribbling in it
-	memset(dc_ram, 0, 8*1024*1024);
+	if (dc_hw_alloc() != AO_SUCCESS)
+	{
+		return AO_FAIL;
+	}
 
 	// Decode the current SSF
-	if (corlett_decode(buffer, length, &c, dsf_lib) != AO_SUCCESS)
+	if (corlett_decode_stream(buffer, length, &c, dsf_lib) != AO_SUCCESS)
 	{
 		return AO_FAIL;
 	}
@@ -70,16 +88,52 @@ int32 dsf_start(uint8 *buffer, uint32 length)
 	return AO_SUCCESS;
 }
 
+int32 dsf_render(stereo_sample_t *buf, uint32 count)
+{
+	uint32 i;
+	for(i = 0; i < count; i++)
+	{
+		PROFILE_ENTER(PROFILE_CPU);
+		#if DK_CORE
+		ARM7_Execute(DSF_SAMPLE_CYCLES);
+		#else
+		arm7_execute(DSF_SAMPLE_CYCLES);
+		#endif
+		PROFILE_LEAVE();
+		PROFILE_ENTER(PROFILE_CHIP);
+		AICA_Update(NULL, NULL, &buf[i]);
+		PROFILE_LEAVE();
+	}
+	corlett_render_fade(buf, count);
+
+	return AO_SUCCESS;
+}
+
 int32 dsf_sample(stereo_sample_t *sample)
 {
-	#if DK_CORE
-	ARM7_Execute((33000000 / 60 / 4) / 735);
-	#else
-	arm7_execute((33000000 / 60 / 4) / 735);
-	#endif
-	AICA_Update(NULL, NULL, sample);
-	corlett_sample_fade(sample);
+	return dsf_render(sample, 1);
+}
+
+int32 dsf_skip(uint32 count)
+{
+	uint32 i;
+	for(i = 0; i < count; i++)
+	{
+		#if DK_CORE
+		ARM7_Execute(DSF_SAMPLE_CYCLES);
+		#else
+		arm7_execute(DSF_SAMPLE_CYCLES);
+		#endif
+		AICA_Skip();
+	}
+	corlett_skip(count);
+	return AO_SUCCESS;
+}
 
+int32 dsf_state(state_t *state)
+{
+	dc_hw_state(state);
+	corlett_state(state);
 	return AO_SUCCESS;
 }
 
@@ -90,6 +144,8 @@ int32 dsf_frame(void)
 
 int32 dsf_stop(void)
 {
+	dc_hw_free();
+	corlett_free(&c);
 	return AO_SUCCESS;
 }
 
@@ -100,6 +156,9 @@ int32 dsf_command(int32 command, int32 parameter)
 		case COMMAND_RESTART:
 			return AO_SUCCESS;
 
+		case COMMAND_SEEK:
+			return dsf_skip(parameter);
+
 	}
 	return AO_FAIL;
 }
@@ -41,25 +41,30 @@
 
 
 #include "corlett.h"
+#include "utils.h"
 
-static corlett_t	c = {0};
-int			psf_refresh  = -1;
+static AO_THREAD_LOCAL corlett_t	c = {0};
+AO_THREAD_LOCAL int	psf_refresh  = -1;
 
 
 // main RAM
-extern uint32 psx_ram[((2*1024*1024)/4)+4];
-extern uint32 psx_scratch[0x400];
-extern uint32 initial_ram[((2*1024*1024)/4)+4];
-extern uint32 initial_scratch[0x400];
-static uint32 initialPC, initialGP, initialSP;
+extern AO_THREAD_LOCAL uint32 *psx_ram;
+extern AO_THREAD_LOCAL uint32 psx_scratch[0x400];
+extern AO_THREAD_LOCAL uint32 *initial_ram;
+extern AO_THREAD_LOCAL uint32 initial_scratch[0x400];
+static AO_THREAD_LOCAL uint32 initialPC, initialGP, initialSP;
 
 extern void mips_init( void );
 extern void mips_reset( void *param );
 extern int mips_execute( int cycles );
 extern void mips_set_info(UINT32 state, union cpuinfo *info);
+extern int psx_hw_alloc(void);
 extern void psx_hw_init(void);
+extern void psx_hw_free(void);
 extern void psx_hw_slice(void);
 extern void psx_hw_frame(void);
+extern void psx_hw_state(state_t *state);
+extern void mips_state(state_t *state);
 
 static void psf_lib_set_refresh(int libnum, corlett_t *c)
 {
@@ -123,7 +128,7 @@ static void psf_lib_patch(int libnum, uint8 *lib, uint64 size)
 
 int psf_lib(int libnum, uint8 *lib, uint64 size, corlett_t *c)
 {
-	static struct
+	static AO_THREAD_LOCAL struct
 	{
 		uint8 *lib;
 		uint64 size;
@@ -181,7 +186,11 @@ int32 psf_start(uint8 *buffer, uint32 length)
 	union cpuinfo mipsinfo;
 
 	// clear PSX work RAM before we start scribbling in it
-	memset(psx_ram, 0, 2*1024*1024);
+	if (psx_hw_alloc() != AO_SUCCESS)
+	{
+		return AO_FAIL;
+	}
+	psf_refresh = -1;
 
 //	printf("Length = %d\n", length);
 
@@ -226,7 +235,10 @@ int32 psf_start(uint8 *buffer, uint32 length)
 	#endif
 
 	psx_hw_init();
-	SPUinit();
+	if (SPUinit() != 0)
+	{
+		return AO_FAIL;
+	}
 	SPUopen();
 
 	// patch illegal Chocobo Dungeon 2 code - CaitSith2 put a jump in the delay slot from a BNE
@@ -256,11 +268,49 @@ int32 psf_start(uint8 *buffer, uint32 length)
 	return AO_SUCCESS;
 }
 
+int32 psf_render(stereo_sample_t *buf, uint32 count)
+{
+	uint32 i;
+	for(i = 0; i < count; i++)
+	{
+		PROFILE_ENTER(PROFILE_CPU);
+		psx_hw_slice();
+		PROFILE_LEAVE();
+		PROFILE_ENTER(PROFILE_CHIP);
+		SPUsample(&buf[i]);
+		PROFILE_LEAVE();
+	}
+
+	return AO_SUCCESS;
+}
+
 int32 psf_sample(stereo_sample_t *sample)
 {
-	psx_hw_slice();
-	SPUsample(sample);
+	return psf_render(sample, 1);
+}
 
+int32 psf_skip(uint32 count)
+{
+	uint32 i;
+	for(i = 0; i < count; i++)
+	{
+		psx_hw_slice();
+		SPUskip();
+		if((i % AUDIO_FRAME_SAMPLES) == AUDIO_FRAME_SAMPLES - 1)
+		{
+			psf_frame();
+		}
+	}
+	corlett_skip(count);
+	return AO_SUCCESS;
+}
+
+int32 psf_state(state_t *state)
+{
+	mips_state(state);
+	psx_hw_state(state);
+	SPUstate(state);
+	corlett_state(state);
 	return AO_SUCCESS;
 }
 
@@ -274,6 +324,8 @@ int32 psf_frame(void)
 int32 psf_stop(void)
 {
 	SPUclose();
+	SPUshutdown();
+	psx_hw_free();
 	corlett_free(&c);
 
 	return AO_SUCCESS;
@@ -309,6 +361,8 @@ int32 psf_command(int32 command, int32 parameter)
 
 			return AO_SUCCESS;
 
+		case COMMAND_SEEK:
+			return psf_skip(parameter);
 	}
 	return AO_FAIL;
 }
@@ -43,6 +43,7 @@
 // 64-bit ELF Object File Specification: http://techpubs.sgi.com/library/manuals/4000/007-4658-001/pdf/007-4658-001.pdf (MIPS ELF relocation types)
 
 #include <stdio.h>
+#include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sys/stat.h>
@@ -60,6 +61,7 @@
 #include "peops2/spu.h"
 
 #include "corlett.h"
+#include "utils.h"
 
 #define MAX_FS		(32)	// maximum # of filesystems (libs and subdirectories)
 
@@ -67,26 +69,30 @@
 #define ELF32_R_SYM(val)                ((val) >> 8)
 #define ELF32_R_TYPE(val)               ((val) & 0xff)
 
-static corlett_t	c = {0};
+static AO_THREAD_LOCAL corlett_t	c = {0};
 
 // main RAM
-extern uint32 psx_ram[(2*1024*1024)/4];
-extern uint32 initial_ram[(2*1024*1024)/4];
-static uint32 initialPC, initialSP;
-static uint32 loadAddr, lengthMS, fadeMS;
+extern AO_THREAD_LOCAL uint32 *psx_ram;
+extern AO_THREAD_LOCAL uint32 *initial_ram;
+static AO_THREAD_LOCAL uint32 initialPC, initialSP;
+static AO_THREAD_LOCAL uint32 loadAddr, lengthMS, fadeMS;
 
-static uint8 *filesys[MAX_FS];
-static uint8 *lib_raw_file;
-static uint32 fssize[MAX_FS];
-static int num_fs;
+static AO_THREAD_LOCAL uint8 *filesys[MAX_FS];
+static AO_THREAD_LOCAL uint8 *lib_raw_file;
+static AO_THREAD_LOCAL uint32 fssize[MAX_FS];
+static AO_THREAD_LOCAL int num_fs;
 
 extern void mips_init( void );
 extern void mips_reset( void *param );
 extern int mips_execute( int cycles );
 extern void mips_set_info(UINT32 state, union cpuinfo *info);
+extern int psx_hw_alloc(void);
 extern void psx_hw_init(void);
+extern void psx_hw_free(void);
 extern void ps2_hw_slice(void);
 extern void ps2_hw_frame(void);
+extern void psx_hw_state(state_t *state);
+extern void mips_state(state_t *state);
 
 static uint32 secname(uint8 *start, uint32 strndx, uint32 shoff, uint32 shentsize, uint32 name)
 {
@@ -199,7 +205,7 @@ uint32 psf2_load_elf(uint8 *start, uint32 len)
 				for (rec = 0; rec < (size/8); rec++)
 				{
 					uint32 offs, info, target, temp, val, vallo;
-					static uint32 hi16offs = 0, hi16target = 0;
+					static AO_THREAD_LOCAL uint32 hi16offs = 0, hi16target = 0;
 
 					offs = start[offset+(rec*8)] | start[offset+1+(rec*8)]<<8 | start[offset+2+(rec*8)]<<16 | start[offset+3+(rec*8)]<<24;
 					info = start[offset+4+(rec*8)] | start[offset+5+(rec*8)]<<8 | start[offset+6+(rec*8)]<<16 | start[offset+7+(rec*8)]<<24;
@@ -279,87 +285,387 @@ uint32 psf2_load_elf(uint8 *start, uint32 len)
 	return entry;
 }
 
-static uint32 load_file_ex(uint8 *top, uint8 *start, uint32 len, char *file, uint8 *buf, uint32 buflen)
+// Filesystem index, built once per song over all loaded filesystems. Paths
+// are stored lowercase with '/' separators, and the hash table resolves each
+// path to the first matching file in the order the filesystems are searched.
+#define FS_PATH_MAX	(256)
+#define FS_DEPTH_MAX	(16)
+#define FS_CACHE_BLOCKS	(8)	// decompressed blocks kept around for read()
+
+typedef struct
 {
-	int32 numfiles, i, j;
-	uint8 *cptr;
-	uint32 offs, uncomp, bsize, cofs, uofs;
-	uint32 X;
-	uLongf dlength;
-	int uerr;
-	char matchname[512], *remainder;
+	char path[FS_PATH_MAX];
+	int fs;
+	uint32 offs, uncomp, bsize;
+} fs_file_t;
+
+typedef struct
+{
+	int32 file;
+	uint32 block;
+	uint32 len;
+	uint32 alloc;
+	uint8 *data;
+} fs_block_t;
+
+static AO_THREAD_LOCAL fs_file_t *fs_files;
+static AO_THREAD_LOCAL int32 fs_num_files, fs_max_files;
+static AO_THREAD_LOCAL int32 *fs_hash;
+static AO_THREAD_LOCAL uint32 fs_hash_mask;
+static AO_THREAD_LOCAL fs_block_t fs_cache[FS_CACHE_BLOCKS];
+static AO_THREAD_LOCAL int fs_cache_next;
+
+// Set while psf2_start() loads files, the only time when whole blocks are
+// decompressed on all CPUs. The IOP's own reads during rendering stay on
+// the rendering thread.
+static AO_THREAD_LOCAL int fs_parallel;
+
+static uint32 get_le32(const uint8 *p)
+{
+	return p[0] | p[1]<<8 | p[2]<<16 | (uint32)p[3]<<24;
+}
+
+// lowercase and '/' separators, as the original per-component strcasecmp()
+// lookup matched them
+static void fs_normalize(char *dst, const char *src)
+{
+	int i;
 
-	// strip out to only the directory name
-	i = 0;
-	while ((file[i] != '/') && (file[i] != '\\') && (file[i] != '\0'))
+	for (i = 0; (i < FS_PATH_MAX - 1) && src[i]; i++)
 	{
-		matchname[i] = file[i];
-		i++;
+		dst[i] = (src[i] == '\\') ? '/' : tolower((uint8)src[i]);
 	}
-	matchname[i] = '\0';
-	remainder = &file[i+1];
+	dst[i] = '\0';
+}
 
-	cptr = start + 4;
+static uint32 fs_hash_path(const char *path)
+{
+	uint32 hash = 2166136261u;
 
-	numfiles = start[0] | start[1]<<8 | start[2]<<16 | start[3]<<24;
+	while (*path)
+	{
+		hash = (hash ^ (uint8)*path++) * 16777619u;
+	}
+	return hash;
+}
+
+static int fs_index_dir(int fs, uint32 dir, const char *prefix, int depth)
+{
+	uint8 *top = filesys[fs];
+	uint32 len = fssize[fs];
+	int32 numfiles, i;
+
+	if ((depth > FS_DEPTH_MAX) || (len < 4) || (dir > len - 4))
+	{
+		return AO_SUCCESS;
+	}
+	numfiles = get_le32(&top[dir]);
 
 	for (i = 0; i < numfiles; i++)
 	{
-		offs = cptr[36] | cptr[37]<<8 | cptr[38]<<16 | cptr[39]<<24;
-		uncomp = cptr[40] | cptr[41]<<8 | cptr[42]<<16 | cptr[43]<<24;
-		bsize = cptr[44] | cptr[45]<<8 | cptr[46]<<16 | cptr[47]<<24;
+		uint8 *cptr = &top[dir + 4 + (i * 48)];
+		char name[37];
+		fs_file_t *file;
 
-		#ifdef DEBUG
-		printf("[%s vs %s]: ofs %08x uncomp %08x bsize %08x\n", cptr, matchname, offs, uncomp, bsize);
-		#endif
+		if ((uint8 *)cptr + 48 > top + len)
+		{
+			break;
+		}
 
-		if (!strcasecmp((char *)cptr, matchname))
+		if (fs_num_files == fs_max_files)
 		{
-			if ((uncomp == 0) && (bsize == 0))
+			fs_file_t *files;
+
+			fs_max_files = fs_max_files ? (fs_max_files * 2) : 64;
+			files = realloc(fs_files, fs_max_files * sizeof(fs_file_t));
+			if (!files)
 			{
-				#ifdef DEBUG
-				printf("Drilling into subdirectory [%s] with [%s] at offset %x\n", matchname, remainder, offs);
-				#endif
-				return load_file_ex(top, &top[offs], len-offs, remainder, buf, buflen);
+				return AO_FAIL;
 			}
+			fs_files = files;
+		}
+		file = &fs_files[fs_num_files];
 
-			X = (uncomp + bsize - 1) / bsize;
+		memcpy(name, cptr, 36);
+		name[36] = '\0';
+		// Leave room for the slash of a subdirectory.
+		if (snprintf(file->path, FS_PATH_MAX - 1, "%s%s", prefix, name) >= (FS_PATH_MAX - 1))
+		{
+			continue;
+		}
+		fs_normalize(file->path, file->path);
+		file->fs = fs;
+		file->offs = get_le32(&cptr[36]);
+		file->uncomp = get_le32(&cptr[40]);
+		file->bsize = get_le32(&cptr[44]);
 
-			cofs = offs + (X*4);
-			uofs = 0;
-			for (j = 0; j < X; j++)
+		if ((file->uncomp == 0) && (file->bsize == 0))
+		{
+			char subdir[FS_PATH_MAX];
+
+			if (
+				(snprintf(subdir, FS_PATH_MAX, "%s/", file->path) >= FS_PATH_MAX) ||
+				(fs_index_dir(fs, file->offs, subdir, depth + 1) != AO_SUCCESS)
+			)
 			{
-				uint32 usize;
+				return AO_FAIL;
+			}
+		}
+		else if (file->bsize > 0)
+		{
+			fs_num_files++;
+		}
+	}
+	return AO_SUCCESS;
+}
 
-				usize = top[offs+(j*4)] | top[offs+1+(j*4)]<<8 | top[offs+2+(j*4)]<<16 | top[offs+3+(j*4)]<<24;
+static int fs_index_build(void)
+{
+	int32 i;
+	int fs;
 
-				dlength = buflen - uofs;
+	for (fs = 0; fs < num_fs; fs++)
+	{
+		if (filesys[fs] && fs_index_dir(fs, 0, "", 0) != AO_SUCCESS)
+		{
+			return AO_FAIL;
+		}
+	}
 
-				uerr = uncompress(&buf[uofs], &dlength, &top[cofs], usize);
-				if (uerr != Z_OK)
+	fs_hash_mask = 63;
+	while (fs_hash_mask < (uint32)fs_num_files * 2)
+	{
+		fs_hash_mask = (fs_hash_mask << 1) | 1;
+	}
+	fs_hash = malloc((fs_hash_mask + 1) * sizeof(int32));
+	if (!fs_hash)
+	{
+		return AO_FAIL;
+	}
+	memset(fs_hash, 0xff, (fs_hash_mask + 1) * sizeof(int32));
+
+	for (i = 0; i < fs_num_files; i++)
+	{
+		uint32 slot = fs_hash_path(fs_files[i].path) & fs_hash_mask;
+
+		while ((fs_hash[slot] != -1) && strcmp(fs_files[fs_hash[slot]].path, fs_files[i].path))
+		{
+			slot = (slot + 1) & fs_hash_mask;
+		}
+		// earlier filesystems and directory entries take precedence
+		if (fs_hash[slot] == -1)
+		{
+			fs_hash[slot] = i;
+		}
+	}
+	return AO_SUCCESS;
+}
+
+static void fs_index_free(void)
+{
+	int i;
+
+	for (i = 0; i < FS_CACHE_BLOCKS; i++)
+	{
+		free(fs_cache[i].data);
+	}
+	memset(fs_cache, 0, sizeof(fs_cache));
+	fs_cache_next = 0;
+	free(fs_hash);
+	free(fs_files);
+	fs_hash = NULL;
+	fs_files = NULL;
+	fs_num_files = fs_max_files = 0;
+}
+
+// Decompresses block [block] of [file] on the filesystem at [top] into [buf].
+// Returns its length, or 0xffffffff on failure.
+static uint32 fs_read_block(const uint8 *top, uint32 len, const fs_file_t *file, uint32 block, uint8 *buf, uint32 buflen)
+{
+	uint32 X = (file->uncomp + file->bsize - 1) / file->bsize;
+	uint32 cofs = file->offs + (X*4);
+	uint32 usize, j;
+	uLongf dlength = buflen;
+	int uerr;
+
+	if ((file->offs > len) || (X > (len - file->offs) / 4))
+	{
+		return 0xffffffff;
+	}
+	for (j = 0; j < block; j++)
+	{
+		cofs += get_le32(&top[file->offs + (j*4)]);
+	}
+	usize = get_le32(&top[file->offs + (block*4)]);
+	if ((cofs > len) || (usize > len - cofs))
+	{
+		return 0xffffffff;
+	}
+
+	uerr = uncompress(buf, &dlength, &top[cofs], usize);
+	if (uerr != Z_OK)
+	{
+		printf("Decompress fail: %lx %d!\n", dlength, uerr);
+		return 0xffffffff;
+	}
+	return dlength;
+}
+
+// Consecutive whole blocks of a file, decompressed in parallel.
+typedef struct
+{
+	const uint8 *top;
+	uint32 len;
+	const fs_file_t *file;
+	uint32 first;
+	uint8 *buf;
+	volatile int failed;
+} fs_job_t;
+
+static void fs_read_blocks(void *param, int i)
+{
+	fs_job_t *job = (fs_job_t *)param;
+	const fs_file_t *f = job->file;
+	uint32 block = job->first + i;
+	uint32 blen = min(f->bsize, f->uncomp - (block * f->bsize));
+
+	if (fs_read_block(job->top, job->len, f, block, &job->buf[i * f->bsize], blen) != blen)
+	{
+		job->failed = 1;
+	}
+}
+
+// find a file on our filesystems, returns its index or -1
+int32 psf2_find_file(char *file)
+{
+	char path[FS_PATH_MAX];
+	uint32 slot;
+
+	if (!fs_hash)
+	{
+		return -1;
+	}
+	fs_normalize(path, file);
+	slot = fs_hash_path(path) & fs_hash_mask;
+	while (fs_hash[slot] != -1)
+	{
+		if (!strcmp(fs_files[fs_hash[slot]].path, path))
+		{
+			return fs_hash[slot];
+		}
+		slot = (slot + 1) & fs_hash_mask;
+	}
+	return -1;
+}
+
+uint32 psf2_file_size(int32 file)
+{
+	return fs_files[file].uncomp;
+}
+
+// Reads [len] bytes at [pos] of [file] into [buf], decompressing only the
+// blocks in that range. Returns the number of bytes read.
+uint32 psf2_read_file(int32 file, uint32 pos, uint8 *buf, uint32 len)
+{
+	const fs_file_t *f = &fs_files[file];
+	uint32 done = 0;
+
+	if (pos >= f->uncomp)
+	{
+		return 0;
+	}
+	len = min(len, f->uncomp - pos);
+
+	while (done < len)
+	{
+		uint32 block = pos / f->bsize;
+		uint32 bofs = pos % f->bsize;
+		uint32 blen = min(f->bsize, f->uncomp - (block * f->bsize));
+		uint32 copy = min(blen - bofs, len - done);
+		fs_block_t *cached = NULL;
+		int i;
+
+		// runs of whole blocks go straight to the caller
+		if ((bofs == 0) && (copy == blen))
+		{
+			uint32 end = pos + (len - done);
+			uint32 last = (end == f->uncomp) ? ((f->uncomp + f->bsize - 1) / f->bsize) : (end / f->bsize);
+			fs_job_t job;
+
+			job.top = filesys[f->fs];
+			job.len = fssize[f->fs];
+			job.file = f;
+			job.first = block;
+			job.buf = &buf[done];
+			job.failed = 0;
+			if (fs_parallel)
+			{
+				ao_parallel(last - block, fs_read_blocks, &job);
+			}
+			else
+			{
+				for (i = 0; (i < (int)(last - block)) && !job.failed; i++)
 				{
-					printf("Decompress fail: %lx %d!\n", dlength, uerr);
-					return 0xffffffff;
+					fs_read_blocks(&job, i);
 				}
-
-				cofs += usize;
-				uofs += dlength;
 			}
-
-			return uncomp;
+			if (job.failed)
+			{
+				break;
+			}
+			copy = min(last * f->bsize, f->uncomp) - pos;
 		}
 		else
 		{
-			cptr += 48;
+			for (i = 0; i < FS_CACHE_BLOCKS; i++)
+			{
+				if (fs_cache[i].data && (fs_cache[i].file == file) && (fs_cache[i].block == block))
+				{
+					cached = &fs_cache[i];
+					break;
+				}
+			}
+			if (!cached)
+			{
+				cached = &fs_cache[fs_cache_next];
+				fs_cache_next = (fs_cache_next + 1) % FS_CACHE_BLOCKS;
+				if (cached->alloc < f->bsize)
+				{
+					free(cached->data);
+					cached->data = malloc(f->bsize);
+					cached->alloc = cached->data ? f->bsize : 0;
+				}
+				cached->file = file;
+				cached->block = block;
+				cached->len = cached->data ? fs_read_block(filesys[f->fs], fssize[f->fs], f, block, cached->data, f->bsize) : 0xffffffff;
+				if (cached->len != blen)
+				{
+					cached->file = -1;
+					break;
+				}
+			}
+			memcpy(&buf[done], &cached->data[bofs], copy);
 		}
+		done += copy;
+		pos += copy;
 	}
-
-	return 0xffffffff;
+	return done;
 }
 
-static uint32 load_file(int fs, char *file, uint8 *buf, uint32 buflen)
+// load a whole file from our filesystems
+uint32 psf2_load_file(char *file, uint8 *buf, uint32 buflen)
 {
-	return load_file_ex(filesys[fs], filesys[fs], fssize[fs], file, buf, buflen);
+	int32 index = psf2_find_file(file);
+
+	if ((index == -1) || (fs_files[index].uncomp > buflen))
+	{
+		return 0xffffffff;
+	}
+	if (psf2_read_file(index, 0, buf, fs_files[index].uncomp) != fs_files[index].uncomp)
+	{
+		return 0xffffffff;
+	}
+	return fs_files[index].uncomp;
 }
 
 static int dump_files(int fs, uint8 *buf, uint32 buflen)
@@ -437,24 +743,6 @@ static int dump_files(int fs, uint8 *buf, uint32 buflen)
 	return 0xffffffff;
 }
 
-// find a file on our filesystems
-uint32 psf2_load_file(char *file, uint8 *buf, uint32 buflen)
-{
-	int i;
-	uint32 flen;
-
-	for (i = 0; i < num_fs; i++)
-	{
-		flen = load_file(i, file, buf, buflen);
-		if (flen != 0xffffffff)
-		{
-			return flen;
-		}
-	}
-
-	return 0xffffffff;
-}
-
 int psf2_lib(int libnum, uint8 *lib, uint64 size, corlett_t *c)
 {
 	#ifdef DEBUG
@@ -488,13 +776,20 @@ int32 psf2_start(uint8 *buffer, uint32 length)
 				// in Highly Experimental (as per Shadow Hearts' hard-coded assumptions)
 
 	// clear IOP work RAM before we start scribbling in it
-	memset(psx_ram, 0, 2*1024*1024);
+	if (psx_hw_alloc() != AO_SUCCESS)
+	{
+		return AO_FAIL;
+	}
 
 	// Decode the current PSF2
 	if (corlett_decode(buffer, length, &c, psf2_lib) != AO_SUCCESS)
 	{
 		return AO_FAIL;
 	}
+	if (fs_index_build() != AO_SUCCESS)
+	{
+		return AO_FAIL;
+	}
 
 	// dump all files
 	#ifdef DEBUG
@@ -511,7 +806,9 @@ int32 psf2_start(uint8 *buffer, uint32 length)
 
 	// load psf2.irx, which kicks everything off
 	buf = (uint8 *)malloc(512*1024);
+	fs_parallel = 1;
 	irx_len = psf2_load_file("psf2.irx", buf, 512*1024);
+	fs_parallel = 0;
 
 	if (irx_len != 0xffffffff)
 	{
@@ -556,17 +853,58 @@ int32 psf2_start(uint8 *buffer, uint32 length)
 	memcpy(initial_ram, psx_ram, 2*1024*1024);
 
 	psx_hw_init();
-	SPU2init();
+	if (SPU2init() != 0)
+	{
+		return AO_FAIL;
+	}
 	SPU2open(NULL);
 
 	return AO_SUCCESS;
 }
 
+int32 psf2_render(stereo_sample_t *buf, uint32 count)
+{
+	uint32 i;
+	for(i = 0; i < count; i++)
+	{
+		PROFILE_ENTER(PROFILE_CHIP);
+		SPU2sample(&buf[i]);
+		PROFILE_LEAVE();
+		PROFILE_ENTER(PROFILE_CPU);
+		ps2_hw_slice();
+		PROFILE_LEAVE();
+	}
+
+	return AO_SUCCESS;
+}
+
 int32 psf2_sample(stereo_sample_t *sample)
 {
-	SPU2sample(sample);
-	ps2_hw_slice();
+	return psf2_render(sample, 1);
+}
+
+int32 psf2_skip(uint32 count)
+{
+	uint32 i;
+	for(i = 0; i < count; i++)
+	{
+		SPU2skip();
+		ps2_hw_slice();
+		if((i % AUDIO_FRAME_SAMPLES) == AUDIO_FRAME_SAMPLES - 1)
+		{
+			psf2_frame();
+		}
+	}
+	corlett_skip(count);
+	return AO_SUCCESS;
+}
 
+int32 psf2_state(state_t *state)
+{
+	mips_state(state);
+	psx_hw_state(state);
+	SPU2state(state);
+	corlett_state(state);
 	return AO_SUCCESS;
 }
 
@@ -582,9 +920,12 @@ int32 psf2_stop(void)
 	int i;
 
 	SPU2close();
+	SPU2shutdown();
+	psx_hw_free();
 	if (lib_raw_file)
 	{
 		free(lib_raw_file);
+		lib_raw_file = NULL;
 	}
 	for (i = 0; i < MAX_FS; i++)
 	{
@@ -594,6 +935,8 @@ int32 psf2_stop(void)
 			filesys[i] = NULL;
 		}
 	}
+	num_fs = 0;
+	fs_index_free();
 	corlett_free(&c);
 
 	return AO_SUCCESS;
@@ -638,6 +981,8 @@ int32 psf2_command(int32 command, int32 parameter)
 
 			return AO_SUCCESS;
 
+		case COMMAND_SEEK:
+			return psf2_skip(parameter);
 	}
 	return AO_FAIL;
 }
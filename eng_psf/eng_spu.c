@@ -37,6 +37,7 @@
 
 #include "ao.h"
 #include "corlett.h"
+#include "utils.h"
 #include "eng_protos.h"
 #include "cpuintrf.h"
 #include "psx.h"
@@ -48,12 +49,13 @@
 extern int SPUinit(void);
 extern int SPUopen(void);
 extern int SPUclose(void);
+extern int SPUshutdown(void);
 extern void SPUinjectRAMImage(unsigned short *source);
 
-static uint8 *start_of_file, *song_ptr;
-static uint32 cur_tick, cur_event, num_events, next_tick, end_tick;
-static int old_fmt;
-static char name[128], song[128], company[128];
+static AO_THREAD_LOCAL uint8 *start_of_file, *song_ptr;
+static AO_THREAD_LOCAL uint32 cur_tick, cur_event, num_events, next_tick, end_tick;
+static AO_THREAD_LOCAL int old_fmt;
+static AO_THREAD_LOCAL char name[128], song[128], company[128];
 
 int32 spu_start(uint8 *buffer, uint32 length)
 {
@@ -67,7 +69,10 @@ int32 spu_start(uint8 *buffer, uint32 length)
 
 	start_of_file = buffer;
 
-	SPUinit();
+	if (SPUinit() != 0)
+	{
+		return AO_FAIL;
+	}
 	SPUopen();
 	corlett_length_set(~0, 0);
 
@@ -214,11 +219,47 @@ static void spu_tick(void)
 	cur_tick++;
 }
 
+int32 spu_render(stereo_sample_t *buf, uint32 count)
+{
+	uint32 i;
+	for(i = 0; i < count; i++)
+	{
+		spu_tick();
+		PROFILE_ENTER(PROFILE_CHIP);
+		SPUsample(&buf[i]);
+		PROFILE_LEAVE();
+	}
+
+	return AO_SUCCESS;
+}
+
 int32 spu_sample(stereo_sample_t *sample)
 {
-	spu_tick();
-	SPUsample(sample);
+	return spu_render(sample, 1);
+}
 
+int32 spu_skip(uint32 count)
+{
+	uint32 i;
+	for(i = 0; i < count; i++)
+	{
+		spu_tick();
+		SPUskip();
+	}
+	corlett_skip(count);
+	return AO_SUCCESS;
+}
+
+int32 spu_state(state_t *state)
+{
+	STATE_VAR(state, song_ptr);
+	STATE_VAR(state, cur_tick);
+	STATE_VAR(state, cur_event);
+	STATE_VAR(state, num_events);
+	STATE_VAR(state, next_tick);
+	STATE_VAR(state, end_tick);
+	SPUstate(state);
+	corlett_state(state);
 	return AO_SUCCESS;
 }
 
@@ -229,6 +270,8 @@ int32 spu_frame(void)
 
 int32 spu_stop(void)
 {
+	SPUclose();
+	SPUshutdown();
 	return AO_SUCCESS;
 }
 
@@ -267,6 +310,9 @@ int32 spu_command(int32 command, int32 parameter)
 			}
 			break;
 
+		case COMMAND_SEEK:
+			return spu_skip(parameter);
+
 			#if VERBOSE
 		default:
 			printf("Unknown command executed!\n");
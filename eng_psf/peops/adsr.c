@@ -36,7 +36,7 @@
 // ADSR func
 ////////////////////////////////////////////////////////////////////////
 
-static u32 RateTable[160];
+static AO_THREAD_LOCAL u32 RateTable[160];
 
 // INIT ADSR
 static void InitADSR(void)
@@ -193,6 +193,11 @@ typedef struct {
 	int MIX_DEST_B1; // (offset)
 	int IN_COEF_L; // (coef.)
 	int IN_COEF_R; // (coef.)
+
+	// 44.1 <-> 22.05 kHz resampling filter history
+	s32 downbuf[2][8];
+	s32 upbuf[2][8];
+	int dbpos, ubpos;
 } REVERBInfo;
 
 #endif // PEOPS_EXTERNALS
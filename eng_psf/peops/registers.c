@@ -424,6 +424,8 @@ static void SoundOn(int start,int end,u16 val)
 		if((val&1) && s_chan[ch].pStart) {
 			s_chan[ch].bIgnoreLoop=0;
 			s_chan[ch].bNew=1;
+			// volume, pitch, start address and ADSR
+			songend_keyon(&regArea[ch<<3], 6 * sizeof(regArea[0]));
 		}
 	}
 }
@@ -111,9 +111,6 @@ INLINE void s_buffer1(int iOff,int iVal)
 
 INLINE void MixREVERBLeftRight(s32 *oleft, s32 *oright, s32 inleft, s32 inright)
 {
-	static s32 downbuf[2][8];
-	static s32 upbuf[2][8];
-	static int dbpos=0,ubpos=0;
 	static s32 downcoeffs[8]= { /* Symmetry is sexy. */
 		1283,5344,10895,15243,
 		15243,10895,5344,1283
@@ -127,11 +124,11 @@ INLINE void MixREVERBLeftRight(s32 *oleft, s32 *oright, s32 inleft, s32 inright)
 
 	//if(inleft<-32767 || inleft>32767) printf("%d\n",inleft);
 	//if(inright<-32767 || inright>32767) printf("%d\n",inright);
-	downbuf[0][dbpos]=inleft;
-	downbuf[1][dbpos]=inright;
-	dbpos=(dbpos+1)&7;
+	rvb.downbuf[0][rvb.dbpos]=inleft;
+	rvb.downbuf[1][rvb.dbpos]=inright;
+	rvb.dbpos=(rvb.dbpos+1)&7;
 
-	if(dbpos&1) { // we work on every second left value: downsample to 22 khz
+	if(rvb.dbpos&1) { // we work on every second left value: downsample to 22 khz
 		if(spuCtrl&0x80) { // -> reverb on? oki
 			int ACC0,ACC1,FB_A0,FB_A1,FB_B0,FB_B1;
 			s32 INPUT_SAMPLE_L=0;
@@ -139,8 +136,8 @@ INLINE void MixREVERBLeftRight(s32 *oleft, s32 *oright, s32 inleft, s32 inright)
 
 			for(x=0; x<8; x++) {
 				// Lose insignificant digits to prevent overflow (check this)
-				INPUT_SAMPLE_L+=(downbuf[0][(dbpos+x)&7]*downcoeffs[x])>>8;
-				INPUT_SAMPLE_R+=(downbuf[1][(dbpos+x)&7]*downcoeffs[x])>>8;
+				INPUT_SAMPLE_L+=(rvb.downbuf[0][(rvb.dbpos+x)&7]*downcoeffs[x])>>8;
+				INPUT_SAMPLE_R+=(rvb.downbuf[1][(rvb.dbpos+x)&7]*downcoeffs[x])>>8;
 			}
 
 			INPUT_SAMPLE_L>>=(16-8);
@@ -186,9 +183,9 @@ INLINE void MixREVERBLeftRight(s32 *oleft, s32 *oright, s32 inleft, s32 inright)
 				rvb.iRVBLeft  = ((s64)rvb.iRVBLeft * rvb.VolLeft)  >> 14;
 				rvb.iRVBRight = ((s64)rvb.iRVBRight * rvb.VolRight) >> 14;
 
-				upbuf[0][ubpos]=rvb.iRVBLeft;
-				upbuf[1][ubpos]=rvb.iRVBRight;
-				ubpos=(ubpos+1)&7;
+				rvb.upbuf[0][rvb.ubpos]=rvb.iRVBLeft;
+				rvb.upbuf[1][rvb.ubpos]=rvb.iRVBRight;
+				rvb.ubpos=(rvb.ubpos+1)&7;
 			} // Bracket hack(et).
 		} else { // -> reverb off
 			rvb.iRVBLeft=rvb.iRVBRight=0;
@@ -199,15 +196,15 @@ INLINE void MixREVERBLeftRight(s32 *oleft, s32 *oright, s32 inleft, s32 inright)
 			rvb.CurrAddr=rvb.StartAddr;
 		}
 	} else {
-		upbuf[0][ubpos]=0;
-		upbuf[1][ubpos]=0;
-		ubpos=(ubpos+1)&7;
+		rvb.upbuf[0][rvb.ubpos]=0;
+		rvb.upbuf[1][rvb.ubpos]=0;
+		rvb.ubpos=(rvb.ubpos+1)&7;
 	}
 	{
 		s32 retl=0,retr=0;
 		for(x=0; x<8; x++) {
-			retl+=(upbuf[0][(ubpos+x)&7]*downcoeffs[x])>>8;
-			retr+=(upbuf[1][(ubpos+x)&7]*downcoeffs[x])>>8;
+			retl+=(rvb.upbuf[0][(rvb.ubpos+x)&7]*downcoeffs[x])>>8;
+			retr+=(rvb.upbuf[1][(rvb.ubpos+x)&7]*downcoeffs[x])>>8;
 		}
 		retl>>=(16-8-1); // -1 To adjust for the null padding.
 		retr>>=(16-8-1);
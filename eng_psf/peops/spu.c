@@ -97,26 +97,28 @@ void SPUirq(void) ;
 
 // psx buffer / addresses
 
-static u16  regArea[0x200];
-static u16  spuMem[256*1024];
-static u8 * spuMemC;
-static u8 * pSpuIrq=0;
+#define SPU_MEM_SIZE (512*1024)
+
+static AO_THREAD_LOCAL u16  regArea[0x200];
+static AO_THREAD_LOCAL u16 * spuMem; // allocated in SPUinit()
+static AO_THREAD_LOCAL u8 * spuMemC;
+static AO_THREAD_LOCAL u8 * pSpuIrq=0;
 
 // user settings
-static int             iVolume;
+static AO_THREAD_LOCAL int             iVolume;
 
 // MAIN infos struct for each channel
 
-static SPUCHAN         s_chan[MAXCHAN+1]; // channel + 1 infos (1 is security for fmod handling)
-static REVERBInfo      rvb;
+static AO_THREAD_LOCAL SPUCHAN         s_chan[MAXCHAN+1]; // channel + 1 infos (1 is security for fmod handling)
+static AO_THREAD_LOCAL REVERBInfo      rvb;
 
-static u32   dwNoiseVal=1; // global noise generator
+static AO_THREAD_LOCAL u32   dwNoiseVal=1; // global noise generator
 
-static u16  spuCtrl=0; // some vars to store psx reg infos
-static u16  spuStat=0;
-static u16  spuIrq=0;
-static u32  spuAddr=0xffffffff; // address into spu mem
-static int  bSPUIsOpen=0;
+static AO_THREAD_LOCAL u16  spuCtrl=0; // some vars to store psx reg infos
+static AO_THREAD_LOCAL u16  spuStat=0;
+static AO_THREAD_LOCAL u16  spuIrq=0;
+static AO_THREAD_LOCAL u32  spuAddr=0xffffffff; // address into spu mem
+static AO_THREAD_LOCAL int  bSPUIsOpen=0;
 
 static const int f[5][2] = {
 	{    0,  0  },
@@ -125,7 +127,7 @@ static const int f[5][2] = {
 	{   98, -55 },
 	{  122, -60 }
 };
-s16 * pS;
+AO_THREAD_LOCAL s16 * pS;
 
 ////////////////////////////////////////////////////////////////////////
 // CODE AREA
@@ -182,7 +184,13 @@ INLINE void StartSound(int ch)
 ////////////////////////////////////////////////////////////////////////
 
 #define CLIP(_x) {if(_x>32767) _x=32767; if(_x<-32767) _x=-32767;}
-int SPUsample(stereo_sample_t *sample)
+#define SPU_REVERB_ON(ch) (((rvb.Enabled>>(ch))&1) && (spuCtrl&0x80))
+
+// Passing NULL for [sample] only advances the state that later samples
+// depend on. Interpolation and volume mixing are skipped for channels that
+// neither feed the reverb unit nor modulate another channel, and the final
+// mix and fade-out are skipped entirely.
+INLINE int SPUprocess(stereo_sample_t *sample)
 {
 	int volmul=iVolume;
 
@@ -190,6 +198,8 @@ int SPUsample(stereo_sample_t *sample)
 	s32 sl=0, sr=0;
 	int ch,fa;
 
+	songend_clock++;
+
 	//--------------------------------------------------//
 	//- main channel loop                              -//
 	//--------------------------------------------------//
@@ -355,6 +365,9 @@ int SPUsample(stereo_sample_t *sample)
 			s_chan[ch].iOldNoise=fa;
 
 		}       //----------------------------------------
+		else if(!sample && s_chan[ch].bFMod!=2 && !SPU_REVERB_ON(ch)) {
+			fa = 0; // only needed for output
+		}
 		else {  // NO NOISE (NORMAL SAMPLE DATA) HERE
 			int vl, vr, gpos;
 			vl = (s_chan[ch].spos >> 6) & ~3;
@@ -393,7 +406,7 @@ int SPUsample(stereo_sample_t *sample)
 			// mmmm... set up freq decoding positions?
 			//           s_chan[ch+1].iSBPos=28;
 			//           s_chan[ch+1].spos=0x10000L;
-		} else {
+		} else if(sample || SPU_REVERB_ON(ch)) {
 			//////////////////////////////////////////////
 			// ok, left/right sound volume (psx volume goes from 0 ... 0x3fff)
 			int tmpl,tmpr;
@@ -408,7 +421,7 @@ int SPUsample(stereo_sample_t *sample)
 			sl+=tmpl;
 			sr+=tmpr;
 
-			if(((rvb.Enabled>>ch)&1) && (spuCtrl&0x80)) {
+			if(SPU_REVERB_ON(ch)) {
 				revLeft+=tmpl;
 				revRight+=tmpr;
 			}
@@ -421,7 +434,13 @@ ENDX:
 
 	///////////////////////////////////////////////////////
 	// mix all channels (including reverb) into one buffer
+	PROFILE_ENTER(PROFILE_REVERB);
 	MixREVERBLeftRight(&sl,&sr,revLeft,revRight);
+	PROFILE_LEAVE();
+
+	if(!sample) {
+		return(1);
+	}
 	sl=(sl*volmul)>>8;
 	sr=(sr*volmul)>>8;
 
@@ -459,6 +478,16 @@ ENDX:
 	return(1);
 }
 
+int SPUsample(stereo_sample_t *sample)
+{
+	return SPUprocess(sample);
+}
+
+int SPUskip(void)
+{
+	return SPUprocess(NULL);
+}
+
 #ifdef TIMEO
 static u64 begintime;
 static u64 gettime64(void)
@@ -483,11 +512,17 @@ static u64 gettime64(void)
 
 int SPUinit(void)
 {
+	if(!spuMem) {
+		spuMem=(u16*)malloc(SPU_MEM_SIZE);
+		if(!spuMem) {
+			return -1;
+		}
+	}
 	spuMemC=(u8*)spuMem; // just small setup
 	memset((void *)s_chan,0,MAXCHAN*sizeof(SPUCHAN));
 	memset((void *)&rvb,0,sizeof(REVERBInfo));
 	memset(regArea,0,sizeof(regArea));
-	memset(spuMem,0,sizeof(spuMem));
+	memset(spuMem,0,SPU_MEM_SIZE);
 	InitADSR();
 #ifdef TIMEO
 	begintime=gettime64();
@@ -578,12 +613,35 @@ int SPUclose(void)
 	return 0;
 }
 
+////////////////////////////////////////////////////////////////////////
+// SPUSTATE: saves or restores the complete SPU state
+////////////////////////////////////////////////////////////////////////
+
+void SPUstate(state_t *state)
+{
+	state_data(state, spuMem, SPU_MEM_SIZE);
+	STATE_VAR(state, regArea);
+	STATE_VAR(state, pSpuIrq);
+	STATE_VAR(state, iVolume);
+	STATE_VAR(state, s_chan);
+	STATE_VAR(state, rvb);
+	STATE_VAR(state, dwNoiseVal);
+	STATE_VAR(state, spuCtrl);
+	STATE_VAR(state, spuStat);
+	STATE_VAR(state, spuIrq);
+	STATE_VAR(state, spuAddr);
+	STATE_VAR(state, bSPUIsOpen);
+}
+
 ////////////////////////////////////////////////////////////////////////
 // SPUSHUTDOWN: called by main emu on final exit
 ////////////////////////////////////////////////////////////////////////
 
 int SPUshutdown(void)
 {
+	free(spuMem);
+	spuMem=NULL;
+	spuMemC=NULL;
 	return 0;
 }
 
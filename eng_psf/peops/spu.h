@@ -27,10 +27,12 @@
 void sexyd_update(unsigned char* pSound,long lBytes);
 
 int SPUsample(stereo_sample_t *sample);
+int SPUskip(void);
 int SPUinit(void);
 int SPUopen(void);
 int SPUclose(void);
 int SPUshutdown(void);
+void SPUstate(state_t *state);
 void SPUinjectRAMImage(u16 *pIncoming);
 void SPUreadDMAMem(u32 usPSXMem,int iSize);
 void SPUwriteDMAMem(u32 usPSXMem,int iSize);
@@ -41,7 +41,7 @@
 // ADSR func
 ////////////////////////////////////////////////////////////////////////
 
-unsigned long RateTable[160];
+AO_THREAD_LOCAL unsigned long RateTable[160];
 
 void InitADSR(void) // INIT ADSR
 {
@@ -35,7 +35,7 @@
 #include "../peops2/registers.h"
 //#include "debug.h"
 
-extern uint32 psx_ram[(2*1024*1024)/4];
+extern AO_THREAD_LOCAL uint32 *psx_ram;
 
 ////////////////////////////////////////////////////////////////////////
 // READ DMA (many values)
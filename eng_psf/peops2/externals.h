@@ -255,53 +255,53 @@ typedef struct {
 
 // psx buffers / addresses
 
-extern unsigned short  regArea[];
-extern unsigned short  spuMem[];
-extern unsigned char * spuMemC;
-extern unsigned char * pSpuIrq[];
+extern AO_THREAD_LOCAL unsigned short * regArea;
+extern AO_THREAD_LOCAL unsigned short * spuMem;
+extern AO_THREAD_LOCAL unsigned char * spuMemC;
+extern AO_THREAD_LOCAL unsigned char * pSpuIrq[];
 
 // user settings
 
-extern int        iUseXA;
-extern int        iVolume;
-extern int        iXAPitch;
-extern int        iUseTimer;
-extern int        iSPUIRQWait;
-extern int        iDebugMode;
-extern int        iRecordMode;
-extern int        iUseReverb;
-extern int        iUseInterpolation;
-extern int        iDisStereo;
+extern AO_THREAD_LOCAL int        iUseXA;
+extern AO_THREAD_LOCAL int        iVolume;
+extern AO_THREAD_LOCAL int        iXAPitch;
+extern AO_THREAD_LOCAL int        iUseTimer;
+extern AO_THREAD_LOCAL int        iSPUIRQWait;
+extern AO_THREAD_LOCAL int        iDebugMode;
+extern AO_THREAD_LOCAL int        iRecordMode;
+extern AO_THREAD_LOCAL int        iUseReverb;
+extern AO_THREAD_LOCAL int        iUseInterpolation;
+extern AO_THREAD_LOCAL int        iDisStereo;
 // MISC
 
-extern SPUCHAN s_chan[];
-extern REVERBInfo rvb[];
+extern AO_THREAD_LOCAL SPUCHAN s_chan[];
+extern AO_THREAD_LOCAL REVERBInfo rvb[];
 
-extern unsigned long dwNoiseVal;
-extern unsigned short spuCtrl2[];
-extern unsigned short spuStat2[];
-extern unsigned long spuIrq2[];
-extern unsigned long spuAddr2[];
-extern unsigned long spuRvbAddr2[];
-extern unsigned long spuRvbAEnd2[];
+extern AO_THREAD_LOCAL unsigned long dwNoiseVal;
+extern AO_THREAD_LOCAL unsigned short spuCtrl2[];
+extern AO_THREAD_LOCAL unsigned short spuStat2[];
+extern AO_THREAD_LOCAL unsigned long spuIrq2[];
+extern AO_THREAD_LOCAL unsigned long spuAddr2[];
+extern AO_THREAD_LOCAL unsigned long spuRvbAddr2[];
+extern AO_THREAD_LOCAL unsigned long spuRvbAEnd2[];
 
-extern int bEndThread;
-extern int bThreadEnded;
-extern int bSpuInit;
+extern AO_THREAD_LOCAL int bEndThread;
+extern AO_THREAD_LOCAL int bThreadEnded;
+extern AO_THREAD_LOCAL int bSpuInit;
 
-extern int SSumR[];
-extern int SSumL[];
-extern int iCycle;
-extern short *pS;
-extern unsigned long dwNewChannel2[];
-extern unsigned long dwEndChannel2[];
+extern AO_THREAD_LOCAL int SSumR[];
+extern AO_THREAD_LOCAL int SSumL[];
+extern AO_THREAD_LOCAL int iCycle;
+extern AO_THREAD_LOCAL short *pS;
+extern AO_THREAD_LOCAL unsigned long dwNewChannel2[];
+extern AO_THREAD_LOCAL unsigned long dwEndChannel2[];
 
 #ifdef _WINDOWS
 // extern HWND hWMain; // window handle
 // extern HWND hWDebug;
 #endif
 
-extern void (CALLBACK *cddavCallback)(unsigned short,unsigned short);
+extern AO_THREAD_LOCAL void (CALLBACK *cddavCallback)(unsigned short,unsigned short);
 
 #endif
 
@@ -369,9 +369,9 @@ extern int           iRightXAVol;
 
 #ifndef _IN_REVERB
 
-extern int *          sRVBPlay[];
-extern int *          sRVBEnd[];
-extern int *          sRVBStart[];
+extern AO_THREAD_LOCAL int *          sRVBPlay[];
+extern AO_THREAD_LOCAL int *          sRVBEnd[];
+extern AO_THREAD_LOCAL int *          sRVBStart[];
 
 #endif
 
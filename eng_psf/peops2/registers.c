@@ -1255,6 +1255,21 @@ EXPORT_GCC unsigned short CALLBACK SPU2readPS1Port(unsigned long reg)
 // SOUND ON register write
 ////////////////////////////////////////////////////////////////////////
 
+// Reports a key-on to the song end detection.
+static void SoundOnSongEnd(int ch)
+{
+	const unsigned short *chan_regs=&regArea[((ch/24)<<9)+((ch%24)<<3)];
+	int regs[6];
+	int i;
+
+	// volume, pitch and ADSR, plus the start address
+	for(i=0; i<5; i++) {
+		regs[i]=chan_regs[i];
+	}
+	regs[5]=s_chan[ch].iStartAdr;
+	songend_keyon(regs, sizeof(regs));
+}
+
 // SOUND ON PSX COMAND
 void SoundOn(int start,int end,unsigned short val)
 {
@@ -1266,6 +1281,7 @@ void SoundOn(int start,int end,unsigned short val)
 			s_chan[ch].bIgnoreLoop=0;
 			s_chan[ch].bNew=1;
 			dwNewChannel2[ch/24]|=(1<<(ch%24)); // bitfield for faster testing
+			SoundOnSongEnd(ch);
 		}
 	}
 }
@@ -49,9 +49,9 @@
 
 // REVERB info and timing vars...
 
-int *          sRVBPlay[2];
-int *          sRVBEnd[2];
-int *          sRVBStart[2];
+AO_THREAD_LOCAL int *          sRVBPlay[2];
+AO_THREAD_LOCAL int *          sRVBEnd[2];
+AO_THREAD_LOCAL int *          sRVBStart[2];
 
 ////////////////////////////////////////////////////////////////////////
 // START REVERB
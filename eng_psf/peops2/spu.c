@@ -110,47 +110,50 @@
 
 // psx buffer / addresses
 
-unsigned short  regArea[32*1024];
-unsigned short  spuMem[1*1024*1024];
-unsigned char * spuMemC;
-unsigned char * pSpuIrq[2];
+#define REG_AREA_SIZE (64*1024)
+#define SPU_MEM_SIZE (2*1024*1024)
+
+AO_THREAD_LOCAL unsigned short * regArea; // allocated in SPU2init()
+AO_THREAD_LOCAL unsigned short * spuMem;  // allocated in SPU2init()
+AO_THREAD_LOCAL unsigned char * spuMemC;
+AO_THREAD_LOCAL unsigned char * pSpuIrq[2];
 
 // user settings
 
-int             iUseXA=0;
-int             iVolume=3;
-int             iXAPitch=1;
-int             iUseTimer=2;
-int             iSPUIRQWait=1;
-int             iDebugMode=0;
-int             iRecordMode=0;
-int             iUseReverb=1;
-int             iUseInterpolation=2;
+AO_THREAD_LOCAL int             iUseXA=0;
+AO_THREAD_LOCAL int             iVolume=3;
+AO_THREAD_LOCAL int             iXAPitch=1;
+AO_THREAD_LOCAL int             iUseTimer=2;
+AO_THREAD_LOCAL int             iSPUIRQWait=1;
+AO_THREAD_LOCAL int             iDebugMode=0;
+AO_THREAD_LOCAL int             iRecordMode=0;
+AO_THREAD_LOCAL int             iUseReverb=1;
+AO_THREAD_LOCAL int             iUseInterpolation=2;
 
 // MAIN infos struct for each channel
 
-SPUCHAN         s_chan[MAXCHAN+1]; // channel + 1 infos (1 is security for fmod handling)
-REVERBInfo      rvb[2];
+AO_THREAD_LOCAL SPUCHAN         s_chan[MAXCHAN+1]; // channel + 1 infos (1 is security for fmod handling)
+AO_THREAD_LOCAL REVERBInfo      rvb[2];
 
-unsigned long   dwNoiseVal=1; // global noise generator
+AO_THREAD_LOCAL unsigned long   dwNoiseVal=1; // global noise generator
 
-unsigned short  spuCtrl2[2]; // some vars to store psx reg infos
-unsigned short  spuStat2[2];
-unsigned long   spuIrq2[2];
-unsigned long   spuAddr2[2]; // address into spu mem
-unsigned long   spuRvbAddr2[2];
-unsigned long   spuRvbAEnd2[2];
-int             bEndThread=0; // thread handlers
-int             bThreadEnded=0;
-int             bSpuInit=0;
-int             bSPUIsOpen=0;
+AO_THREAD_LOCAL unsigned short  spuCtrl2[2]; // some vars to store psx reg infos
+AO_THREAD_LOCAL unsigned short  spuStat2[2];
+AO_THREAD_LOCAL unsigned long   spuIrq2[2];
+AO_THREAD_LOCAL unsigned long   spuAddr2[2]; // address into spu mem
+AO_THREAD_LOCAL unsigned long   spuRvbAddr2[2];
+AO_THREAD_LOCAL unsigned long   spuRvbAEnd2[2];
+AO_THREAD_LOCAL int             bEndThread=0; // thread handlers
+AO_THREAD_LOCAL int             bThreadEnded=0;
+AO_THREAD_LOCAL int             bSpuInit=0;
+AO_THREAD_LOCAL int             bSPUIsOpen=0;
 
-unsigned long dwNewChannel2[2]; // flags for faster testing, if new channel starts
-unsigned long dwEndChannel2[2];
+AO_THREAD_LOCAL unsigned long dwNewChannel2[2]; // flags for faster testing, if new channel starts
+AO_THREAD_LOCAL unsigned long dwEndChannel2[2];
 
 // UNUSED IN PS2 YET
-void (CALLBACK *irqCallback)(void)=0; // func of main emu, called on spu irq
-void (CALLBACK *cddavCallback)(unsigned short,unsigned short)=0;
+AO_THREAD_LOCAL void (CALLBACK *irqCallback)(void)=0; // func of main emu, called on spu irq
+AO_THREAD_LOCAL void (CALLBACK *cddavCallback)(unsigned short,unsigned short)=0;
 
 // certain globals (were local before, but with the new timeproc I need em global)
 
@@ -160,13 +163,13 @@ const int f[5][2] = {   {    0,  0  },
 	{   98, -55 },
 	{  122, -60 }
 };
-int SSumR[NSSIZE];
-int SSumL[NSSIZE];
-int iCycle=0;
+AO_THREAD_LOCAL int SSumR[NSSIZE];
+AO_THREAD_LOCAL int SSumL[NSSIZE];
+AO_THREAD_LOCAL int iCycle=0;
 
-static int lastch=-1; // last channel processed on spu irq in timer mode
-static int lastns=0; // last ns pos
-static int iSecureStart=0; // secure start counter
+static AO_THREAD_LOCAL int lastch=-1; // last channel processed on spu irq in timer mode
+static AO_THREAD_LOCAL int lastns=0; // last ns pos
+static AO_THREAD_LOCAL int iSecureStart=0; // secure start counter
 
 extern void ps2_update(unsigned char *samples, long lBytes);
 
@@ -341,7 +344,11 @@ INLINE void StartSound(int ch)
 
 ////////////////////////////////////////////////////////////////////////
 
-EXPORT_GCC int CALLBACK SPU2sample(stereo_sample_t *sample)
+// Passing NULL for [sample] only advances the state that later samples
+// depend on. Interpolation and volume mixing are skipped for channels that
+// neither feed the reverb unit nor modulate another channel, and the final
+// mix and fade-out are skipped entirely.
+INLINE int SPU2process(stereo_sample_t *sample)
 {
 	int s_1,s_2,fa,voldiv=iVolume;
 	unsigned char * start;
@@ -349,6 +356,8 @@ EXPORT_GCC int CALLBACK SPU2sample(stereo_sample_t *sample)
 	int ch,predict_nr,shift_factor,flags,d,d2,s;
 	int gpos,bIRQReturn=0;
 
+	songend_clock++;
+
 	// while(!bEndThread) { // until we are shutting down
 		//--------------------------------------------------//
 		// ok, at the beginning we are looking if there is
@@ -619,7 +628,11 @@ GOON:
 				// NO NOISE (NORMAL SAMPLE DATA) HERE
 				//------------------------------------------//
 				else {
-					if(iUseInterpolation==3) { // cubic interpolation
+					if(!sample && s_chan[ch].bFMod!=2 && !s_chan[ch].bRVBActive && iUseInterpolation!=1) {
+						fa=0; // only needed for output
+					}
+					//------------------------------------------//
+					else if(iUseInterpolation==3) { // cubic interpolation
 						long xd;
 						xd = ((s_chan[ch].spos) >> 1)+1;
 						gpos = s_chan[ch].SB[28];
@@ -703,7 +716,7 @@ GOON:
 					// mmmm... set up freq decoding positions?
 					// s_chan[ch+1].iSBPos=28;
 					// s_chan[ch+1].spos=0x10000L;
-				} else {
+				} else if(sample || s_chan[ch].bRVBActive) {
 					//////////////////////////////////////////////
 					// ok, left/right sound volume (psx volume goes from 0 ... 0x3fff)
 
@@ -743,10 +756,19 @@ ENDX:
 		///////////////////////////////////////////////////////
 		// mix all channels (including reverb) into one buffer
 
+		PROFILE_ENTER(PROFILE_REVERB);
 		SSumL[0]+=MixREVERBLeft(0,0);
 		SSumL[0]+=MixREVERBLeft(0,1);
 		SSumR[0]+=MixREVERBRight(0);
 		SSumR[0]+=MixREVERBRight(1);
+		PROFILE_LEAVE();
+
+		if(!sample) {
+			SSumL[0]=SSumR[0]=0;
+			InitREVERB();
+			bThreadEnded=1;
+			return 1;
+		}
 
 		d=SSumL[0]/voldiv;
 		SSumL[0]=0;
@@ -780,6 +802,16 @@ ENDX:
 	return 1;
 }
 
+EXPORT_GCC int CALLBACK SPU2sample(stereo_sample_t *sample)
+{
+	return SPU2process(sample);
+}
+
+EXPORT_GCC int CALLBACK SPU2skip(void)
+{
+	return SPU2process(NULL);
+}
+
 ////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////
@@ -795,6 +827,18 @@ ENDX:
 
 EXPORT_GCC long CALLBACK SPU2init(void)
 {
+	if(!spuMem) {
+		regArea=(unsigned short *)calloc(1,REG_AREA_SIZE);
+		spuMem=(unsigned short *)calloc(1,SPU_MEM_SIZE);
+		if(!regArea || !spuMem) {
+			free(regArea);
+			free(spuMem);
+			regArea=NULL;
+			spuMem=NULL;
+			return -1;
+		}
+	}
+
 	// just small setup
 	spuMemC=(unsigned char *)spuMem;
 	memset((void *)s_chan,0,MAXCHAN*sizeof(SPUCHAN));
@@ -958,13 +1002,50 @@ EXPORT_GCC void CALLBACK SPU2close(void)
 	RemoveStreams(); // no more streaming
 }
 
+////////////////////////////////////////////////////////////////////////
+// SPUSTATE: saves or restores the complete SPU state
+////////////////////////////////////////////////////////////////////////
+
+EXPORT_GCC void CALLBACK SPU2state(state_t *state)
+{
+	state_data(state, spuMem, SPU_MEM_SIZE);
+	state_data(state, regArea, REG_AREA_SIZE);
+	STATE_VAR(state, pSpuIrq);
+	STATE_VAR(state, iVolume);
+	STATE_VAR(state, s_chan);
+	STATE_VAR(state, rvb);
+	STATE_VAR(state, dwNoiseVal);
+	STATE_VAR(state, spuCtrl2);
+	STATE_VAR(state, spuStat2);
+	STATE_VAR(state, spuIrq2);
+	STATE_VAR(state, spuAddr2);
+	STATE_VAR(state, spuRvbAddr2);
+	STATE_VAR(state, spuRvbAEnd2);
+	STATE_VAR(state, bEndThread);
+	STATE_VAR(state, bThreadEnded);
+	STATE_VAR(state, bSpuInit);
+	STATE_VAR(state, bSPUIsOpen);
+	STATE_VAR(state, dwNewChannel2);
+	STATE_VAR(state, dwEndChannel2);
+	STATE_VAR(state, SSumR);
+	STATE_VAR(state, SSumL);
+	STATE_VAR(state, iCycle);
+	STATE_VAR(state, lastch);
+	STATE_VAR(state, lastns);
+	STATE_VAR(state, iSecureStart);
+}
+
 ////////////////////////////////////////////////////////////////////////
 // SPUSHUTDOWN: called by main emu on final exit
 ////////////////////////////////////////////////////////////////////////
 
 EXPORT_GCC void CALLBACK SPU2shutdown(void)
 {
-	return;
+	free(regArea);
+	free(spuMem);
+	regArea=NULL;
+	spuMem=NULL;
+	spuMemC=NULL;
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -35,5 +35,8 @@ EXPORT_GCC void CALLBACK SPU2playADPCMchannel(xa_decode_t *xap);
 EXPORT_GCC long CALLBACK SPU2init(void);
 EXPORT_GCC long CALLBACK SPU2open(void *pDsp);
 EXPORT_GCC int CALLBACK SPU2sample(stereo_sample_t *sample);
+EXPORT_GCC int CALLBACK SPU2skip(void);
 EXPORT_GCC void CALLBACK SPU2close(void);
+EXPORT_GCC void CALLBACK SPU2shutdown(void);
+EXPORT_GCC void CALLBACK SPU2state(state_t *state);
 
@@ -14,6 +14,8 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "ao.h"
 #include "cpuintrf.h"
 #include "psx.h"
@@ -62,12 +64,6 @@
 
 extern void psx_bios_hle(uint32 pc);
 extern void psx_iop_call(uint32 pc, uint32 callnum);
-extern uint8 program_read_byte_32le(offs_t address);
-extern uint16 program_read_word_32le(offs_t address);
-extern uint32 program_read_dword_32le(offs_t address);
-extern void program_write_byte_32le(offs_t address, uint8 data);
-extern void program_write_word_32le(offs_t address, uint16 data);
-extern void program_write_dword_32le(offs_t address, uint32 data);
 
 static UINT8 mips_reg_layout[] =
 {
@@ -180,9 +176,9 @@ typedef struct
 	int (*irq_callback)(int irqline);
 } mips_cpu_context;
 
-static mips_cpu_context mipscpu;
+static AO_THREAD_LOCAL mips_cpu_context mipscpu;
 
-static int mips_ICount = 0;
+static AO_THREAD_LOCAL int mips_ICount = 0;
 
 static UINT32 mips_mtc0_writemask[]=
 {
@@ -366,6 +362,523 @@ static void mips_exception( int exception )
 	}
 }
 
+/* Decoded instruction cache. Instructions fetched from RAM are decoded once
+   into a handler and pre-extracted operands, with one entry for every word
+   of the 2 MB of RAM. The opcode in memory is compared with the cached one on
+   every fetch, so code written by the CPU, DMA or the HLE BIOS is picked up
+   without any explicit invalidation. Handlers are inlined into the dispatch
+   switch in mips_execute(), and return FALSE to fall back to the interpreter
+   below it, which also runs all instructions without a handler. */
+
+#define MIPS_CACHE_INSNS ( 0x200000 >> 2 )
+
+#define MIPS_HANDLERS \
+	H( sll ) H( srl ) H( sra ) H( sllv ) H( srlv ) H( srav ) H( mfhi ) H( mflo ) \
+	H( addu ) H( subu ) H( and ) H( or ) H( xor ) H( nor ) H( slt ) H( sltu ) \
+	H( addiu ) H( slti ) H( sltiu ) H( andi ) H( ori ) H( xori ) H( lui ) \
+	H( add ) H( sub ) H( addi ) H( mthi ) H( mtlo ) H( mult ) H( multu ) \
+	H( div ) H( divu ) H( jr ) H( jalr ) H( j ) H( jal ) H( beq ) H( bne ) \
+	H( blez ) H( bgtz ) H( bltz ) H( bgez ) H( bltzal ) H( bgezal ) \
+	H( lb ) H( lbu ) H( lh ) H( lhu ) H( lw ) H( sb ) H( sh ) H( sw )
+
+enum
+{
+	MIPS_INTERP = 0,
+#define H( name ) MIPS_##name,
+	MIPS_HANDLERS
+#undef H
+};
+
+typedef struct
+{
+	UINT8 handler; /* MIPS_* */
+	UINT8 rs;
+	UINT8 rt;
+	UINT8 rd;
+	UINT32 op;
+	UINT32 imm; /* extended immediate, shift amount or branch offset */
+	UINT32 valid;
+} mips_insn;
+
+static AO_THREAD_LOCAL mips_insn *mips_cache;
+
+/* loads and stores that neither isolate the cache nor reverse endianness */
+#define MIPS_MEM_PLAIN() ( ( mipscpu.cp0r[ CP0_SR ] & SR_ISC ) == 0 && \
+	( mipscpu.cp0r[ CP0_SR ] & ( SR_RE | SR_KUC ) ) != ( SR_RE | SR_KUC ) )
+
+#define MIPS_ADR() ( mipscpu.r[ insn->rs ] + insn->imm )
+
+INLINE int mips_sll( const mips_insn *insn ) { mips_load( insn->rd, mipscpu.r[ insn->rt ] << insn->imm ); return TRUE; }
+INLINE int mips_srl( const mips_insn *insn ) { mips_load( insn->rd, mipscpu.r[ insn->rt ] >> insn->imm ); return TRUE; }
+INLINE int mips_sra( const mips_insn *insn ) { mips_load( insn->rd, (INT32)mipscpu.r[ insn->rt ] >> insn->imm ); return TRUE; }
+INLINE int mips_sllv( const mips_insn *insn ) { mips_load( insn->rd, mipscpu.r[ insn->rt ] << ( mipscpu.r[ insn->rs ] & 31 ) ); return TRUE; }
+INLINE int mips_srlv( const mips_insn *insn ) { mips_load( insn->rd, mipscpu.r[ insn->rt ] >> ( mipscpu.r[ insn->rs ] & 31 ) ); return TRUE; }
+INLINE int mips_srav( const mips_insn *insn ) { mips_load( insn->rd, (INT32)mipscpu.r[ insn->rt ] >> ( mipscpu.r[ insn->rs ] & 31 ) ); return TRUE; }
+INLINE int mips_mfhi( const mips_insn *insn ) { mips_load( insn->rd, mipscpu.hi ); return TRUE; }
+INLINE int mips_mflo( const mips_insn *insn ) { mips_load( insn->rd, mipscpu.lo ); return TRUE; }
+INLINE int mips_addu( const mips_insn *insn ) { mips_load( insn->rd, mipscpu.r[ insn->rs ] + mipscpu.r[ insn->rt ] ); return TRUE; }
+INLINE int mips_subu( const mips_insn *insn ) { mips_load( insn->rd, mipscpu.r[ insn->rs ] - mipscpu.r[ insn->rt ] ); return TRUE; }
+INLINE int mips_and( const mips_insn *insn ) { mips_load( insn->rd, mipscpu.r[ insn->rs ] & mipscpu.r[ insn->rt ] ); return TRUE; }
+INLINE int mips_or( const mips_insn *insn ) { mips_load( insn->rd, mipscpu.r[ insn->rs ] | mipscpu.r[ insn->rt ] ); return TRUE; }
+INLINE int mips_xor( const mips_insn *insn ) { mips_load( insn->rd, mipscpu.r[ insn->rs ] ^ mipscpu.r[ insn->rt ] ); return TRUE; }
+INLINE int mips_nor( const mips_insn *insn ) { mips_load( insn->rd, ~( mipscpu.r[ insn->rs ] | mipscpu.r[ insn->rt ] ) ); return TRUE; }
+INLINE int mips_slt( const mips_insn *insn ) { mips_load( insn->rd, (INT32)mipscpu.r[ insn->rs ] < (INT32)mipscpu.r[ insn->rt ] ); return TRUE; }
+INLINE int mips_sltu( const mips_insn *insn ) { mips_load( insn->rd, mipscpu.r[ insn->rs ] < mipscpu.r[ insn->rt ] ); return TRUE; }
+
+INLINE int mips_addiu( const mips_insn *insn ) { mips_load( insn->rt, mipscpu.r[ insn->rs ] + insn->imm ); return TRUE; }
+INLINE int mips_slti( const mips_insn *insn ) { mips_load( insn->rt, (INT32)mipscpu.r[ insn->rs ] < (INT32)insn->imm ); return TRUE; }
+INLINE int mips_sltiu( const mips_insn *insn ) { mips_load( insn->rt, mipscpu.r[ insn->rs ] < insn->imm ); return TRUE; }
+INLINE int mips_andi( const mips_insn *insn ) { mips_load( insn->rt, mipscpu.r[ insn->rs ] & insn->imm ); return TRUE; }
+INLINE int mips_ori( const mips_insn *insn ) { mips_load( insn->rt, mipscpu.r[ insn->rs ] | insn->imm ); return TRUE; }
+INLINE int mips_xori( const mips_insn *insn ) { mips_load( insn->rt, mipscpu.r[ insn->rs ] ^ insn->imm ); return TRUE; }
+INLINE int mips_lui( const mips_insn *insn ) { mips_load( insn->rt, insn->imm ); return TRUE; }
+
+INLINE int mips_add( const mips_insn *insn )
+{
+	UINT32 n_res = mipscpu.r[ insn->rs ] + mipscpu.r[ insn->rt ];
+	if( (INT32)( ~( mipscpu.r[ insn->rs ] ^ mipscpu.r[ insn->rt ] ) & ( mipscpu.r[ insn->rs ] ^ n_res ) ) < 0 )
+	{
+		mips_exception( EXC_OVF );
+	}
+	else
+	{
+		mips_load( insn->rd, n_res );
+	}
+	return TRUE;
+}
+
+INLINE int mips_sub( const mips_insn *insn )
+{
+	UINT32 n_res = mipscpu.r[ insn->rs ] - mipscpu.r[ insn->rt ];
+	if( (INT32)( ( mipscpu.r[ insn->rs ] ^ mipscpu.r[ insn->rt ] ) & ( mipscpu.r[ insn->rs ] ^ n_res ) ) < 0 )
+	{
+		mips_exception( EXC_OVF );
+	}
+	else
+	{
+		mips_load( insn->rd, n_res );
+	}
+	return TRUE;
+}
+
+INLINE int mips_addi( const mips_insn *insn )
+{
+	UINT32 n_res = mipscpu.r[ insn->rs ] + insn->imm;
+	if( (INT32)( ~( mipscpu.r[ insn->rs ] ^ insn->imm ) & ( mipscpu.r[ insn->rs ] ^ n_res ) ) < 0 )
+	{
+		mips_exception( EXC_OVF );
+	}
+	else
+	{
+		mips_load( insn->rt, n_res );
+	}
+	return TRUE;
+}
+
+INLINE int mips_mthi( const mips_insn *insn )
+{
+	mips_advance_pc();
+	mipscpu.hi = mipscpu.r[ insn->rs ];
+	return TRUE;
+}
+
+INLINE int mips_mtlo( const mips_insn *insn )
+{
+	mips_advance_pc();
+	mipscpu.lo = mipscpu.r[ insn->rs ];
+	return TRUE;
+}
+
+INLINE int mips_mult( const mips_insn *insn )
+{
+	INT64 n_res64 = MUL_64_32_32( (INT32)mipscpu.r[ insn->rs ], (INT32)mipscpu.r[ insn->rt ] );
+	mips_advance_pc();
+	mipscpu.lo = LO32_32_64( n_res64 );
+	mipscpu.hi = HI32_32_64( n_res64 );
+	return TRUE;
+}
+
+INLINE int mips_multu( const mips_insn *insn )
+{
+	UINT64 n_res64 = MUL_U64_U32_U32( mipscpu.r[ insn->rs ], mipscpu.r[ insn->rt ] );
+	mips_advance_pc();
+	mipscpu.lo = LO32_U32_U64( n_res64 );
+	mipscpu.hi = HI32_U32_U64( n_res64 );
+	return TRUE;
+}
+
+INLINE int mips_div( const mips_insn *insn )
+{
+	if( mipscpu.r[ insn->rt ] != 0 )
+	{
+		UINT32 n_div = (INT32)mipscpu.r[ insn->rs ] / (INT32)mipscpu.r[ insn->rt ];
+		UINT32 n_mod = (INT32)mipscpu.r[ insn->rs ] % (INT32)mipscpu.r[ insn->rt ];
+		mips_advance_pc();
+		mipscpu.lo = n_div;
+		mipscpu.hi = n_mod;
+	}
+	else
+	{
+		mips_advance_pc();
+	}
+	return TRUE;
+}
+
+INLINE int mips_divu( const mips_insn *insn )
+{
+	if( mipscpu.r[ insn->rt ] != 0 )
+	{
+		UINT32 n_div = mipscpu.r[ insn->rs ] / mipscpu.r[ insn->rt ];
+		UINT32 n_mod = mipscpu.r[ insn->rs ] % mipscpu.r[ insn->rt ];
+		mips_advance_pc();
+		mipscpu.lo = n_div;
+		mipscpu.hi = n_mod;
+	}
+	else
+	{
+		mips_advance_pc();
+	}
+	return TRUE;
+}
+
+INLINE int mips_jr( const mips_insn *insn )
+{
+	mips_delayed_branch( mipscpu.r[ insn->rs ] );
+	return TRUE;
+}
+
+INLINE int mips_jalr( const mips_insn *insn )
+{
+	UINT32 n_res = mipscpu.pc + 8;
+	mips_delayed_branch( mipscpu.r[ insn->rs ] );
+	if( insn->rd != 0 )
+	{
+		mipscpu.r[ insn->rd ] = n_res;
+	}
+	return TRUE;
+}
+
+INLINE int mips_j( const mips_insn *insn )
+{
+	mips_delayed_branch( ( ( mipscpu.pc + 4 ) & 0xf0000000 ) + insn->imm );
+	return TRUE;
+}
+
+INLINE int mips_jal( const mips_insn *insn )
+{
+	UINT32 n_res = mipscpu.pc + 8;
+	mips_delayed_branch( ( ( mipscpu.pc + 4 ) & 0xf0000000 ) + insn->imm );
+	mipscpu.r[ 31 ] = n_res;
+	return TRUE;
+}
+
+INLINE void mips_branch_if( const mips_insn *insn, int taken )
+{
+	if( taken )
+	{
+		mips_delayed_branch( mipscpu.pc + 4 + insn->imm );
+	}
+	else
+	{
+		mips_advance_pc();
+	}
+}
+
+INLINE int mips_beq( const mips_insn *insn ) { mips_branch_if( insn, mipscpu.r[ insn->rs ] == mipscpu.r[ insn->rt ] ); return TRUE; }
+INLINE int mips_bne( const mips_insn *insn ) { mips_branch_if( insn, mipscpu.r[ insn->rs ] != mipscpu.r[ insn->rt ] ); return TRUE; }
+INLINE int mips_blez( const mips_insn *insn ) { mips_branch_if( insn, (INT32)mipscpu.r[ insn->rs ] <= 0 ); return TRUE; }
+INLINE int mips_bgtz( const mips_insn *insn ) { mips_branch_if( insn, (INT32)mipscpu.r[ insn->rs ] > 0 ); return TRUE; }
+INLINE int mips_bltz( const mips_insn *insn ) { mips_branch_if( insn, (INT32)mipscpu.r[ insn->rs ] < 0 ); return TRUE; }
+INLINE int mips_bgez( const mips_insn *insn ) { mips_branch_if( insn, (INT32)mipscpu.r[ insn->rs ] >= 0 ); return TRUE; }
+
+INLINE int mips_bltzal( const mips_insn *insn )
+{
+	UINT32 n_res = mipscpu.pc + 8;
+	mips_branch_if( insn, (INT32)mipscpu.r[ insn->rs ] < 0 );
+	mipscpu.r[ 31 ] = n_res;
+	return TRUE;
+}
+
+INLINE int mips_bgezal( const mips_insn *insn )
+{
+	UINT32 n_res = mipscpu.pc + 8;
+	mips_branch_if( insn, (INT32)mipscpu.r[ insn->rs ] >= 0 );
+	mipscpu.r[ 31 ] = n_res;
+	return TRUE;
+}
+
+/* Loads and stores of the plain case. [align] is the mask of address bits that
+   raise an address error in addition to KUSEG accesses in kernel mode. */
+INLINE int mips_adr_error( UINT32 n_adr, UINT32 align, int exception )
+{
+	if( ( n_adr & ( ( ( mipscpu.cp0r[ CP0_SR ] & SR_KUC ) << 30 ) | align ) ) != 0 )
+	{
+		mips_exception( exception );
+		mips_set_cp0r( CP0_BADVADDR, n_adr );
+		return TRUE;
+	}
+	return FALSE;
+}
+
+INLINE int mips_lb( const mips_insn *insn )
+{
+	UINT32 n_adr = MIPS_ADR();
+	if( !MIPS_MEM_PLAIN() )
+	{
+		return FALSE;
+	}
+	if( !mips_adr_error( n_adr, 0, EXC_ADEL ) )
+	{
+		mips_delayed_load( insn->rt, MIPS_BYTE_EXTEND( program_read_byte_32le( n_adr ) ) );
+	}
+	return TRUE;
+}
+
+INLINE int mips_lbu( const mips_insn *insn )
+{
+	UINT32 n_adr = MIPS_ADR();
+	if( !MIPS_MEM_PLAIN() )
+	{
+		return FALSE;
+	}
+	if( !mips_adr_error( n_adr, 0, EXC_ADEL ) )
+	{
+		mips_delayed_load( insn->rt, program_read_byte_32le( n_adr ) );
+	}
+	return TRUE;
+}
+
+INLINE int mips_lh( const mips_insn *insn )
+{
+	UINT32 n_adr = MIPS_ADR();
+	if( !MIPS_MEM_PLAIN() )
+	{
+		return FALSE;
+	}
+	if( !mips_adr_error( n_adr, 1, EXC_ADEL ) )
+	{
+		mips_delayed_load( insn->rt, MIPS_WORD_EXTEND( program_read_word_32le( n_adr ) ) );
+	}
+	return TRUE;
+}
+
+INLINE int mips_lhu( const mips_insn *insn )
+{
+	UINT32 n_adr = MIPS_ADR();
+	if( !MIPS_MEM_PLAIN() )
+	{
+		return FALSE;
+	}
+	if( !mips_adr_error( n_adr, 1, EXC_ADEL ) )
+	{
+		mips_delayed_load( insn->rt, program_read_word_32le( n_adr ) );
+	}
+	return TRUE;
+}
+
+INLINE int mips_lw( const mips_insn *insn )
+{
+	if( ( mipscpu.cp0r[ CP0_SR ] & SR_ISC ) != 0 )
+	{
+		return FALSE;
+	}
+	mips_delayed_load( insn->rt, program_read_dword_32le( MIPS_ADR() ) );
+	return TRUE;
+}
+
+INLINE int mips_sb( const mips_insn *insn )
+{
+	UINT32 n_adr = MIPS_ADR();
+	if( !MIPS_MEM_PLAIN() )
+	{
+		return FALSE;
+	}
+	if( !mips_adr_error( n_adr, 0, EXC_ADES ) )
+	{
+		program_write_byte_32le( n_adr, mipscpu.r[ insn->rt ] );
+		mips_advance_pc();
+	}
+	return TRUE;
+}
+
+INLINE int mips_sh( const mips_insn *insn )
+{
+	UINT32 n_adr = MIPS_ADR();
+	if( !MIPS_MEM_PLAIN() )
+	{
+		return FALSE;
+	}
+	if( !mips_adr_error( n_adr, 1, EXC_ADES ) )
+	{
+		program_write_word_32le( n_adr, mipscpu.r[ insn->rt ] );
+		mips_advance_pc();
+	}
+	return TRUE;
+}
+
+INLINE int mips_sw( const mips_insn *insn )
+{
+	if( ( mipscpu.cp0r[ CP0_SR ] & SR_ISC ) != 0 )
+	{
+		return FALSE;
+	}
+	program_write_dword_32le( MIPS_ADR(), mipscpu.r[ insn->rt ] );
+	mips_advance_pc();
+	return TRUE;
+}
+
+/* Handlers for the SPECIAL functions, MIPS_INTERP for the interpreter. Functions that
+   require RD to be 0 are only decoded to a handler if it is. */
+#define N MIPS_INTERP
+static const UINT8 mips_special[ 64 ] =
+{
+	MIPS_sll, N, MIPS_srl, MIPS_sra, MIPS_sllv, N, MIPS_srlv, MIPS_srav,
+	MIPS_jr, MIPS_jalr, N, N, N, N, N, N,
+	MIPS_mfhi, MIPS_mthi, MIPS_mflo, MIPS_mtlo, N, N, N, N,
+	MIPS_mult, MIPS_multu, MIPS_div, MIPS_divu, N, N, N, N,
+	MIPS_add, MIPS_addu, MIPS_sub, MIPS_subu, MIPS_and, MIPS_or, MIPS_xor, MIPS_nor,
+	N, N, MIPS_slt, MIPS_sltu, N, N, N, N,
+	N, N, N, N, N, N, N, N,
+	N, N, N, N, N, N, N, N
+};
+#undef N
+
+static void mips_decode( mips_insn *insn, UINT32 op )
+{
+	insn->op = op;
+	insn->rs = INS_RS( op );
+	insn->rt = INS_RT( op );
+	insn->rd = INS_RD( op );
+	insn->imm = MIPS_WORD_EXTEND( INS_IMMEDIATE( op ) );
+	insn->handler = MIPS_INTERP;
+	insn->valid = TRUE;
+
+	switch( INS_OP( op ) )
+	{
+	case OP_SPECIAL:
+		switch( INS_FUNCT( op ) )
+		{
+		case FUNCT_HLECALL:
+			break;
+		case FUNCT_SLL:
+		case FUNCT_SRL:
+		case FUNCT_SRA:
+			insn->imm = INS_SHAMT( op );
+			insn->handler = mips_special[ INS_FUNCT( op ) ];
+			break;
+		case FUNCT_JR:
+		case FUNCT_MTHI:
+		case FUNCT_MTLO:
+		case FUNCT_MULT:
+		case FUNCT_MULTU:
+		case FUNCT_DIV:
+		case FUNCT_DIVU:
+			if( insn->rd == 0 )
+			{
+				insn->handler = mips_special[ INS_FUNCT( op ) ];
+			}
+			break;
+		default:
+			insn->handler = mips_special[ INS_FUNCT( op ) ];
+			break;
+		}
+		break;
+	case OP_REGIMM:
+		insn->imm <<= 2;
+		switch( insn->rt )
+		{
+		case RT_BLTZ: insn->handler = MIPS_bltz; break;
+		case RT_BGEZ: insn->handler = MIPS_bgez; break;
+		case RT_BLTZAL: insn->handler = MIPS_bltzal; break;
+		case RT_BGEZAL: insn->handler = MIPS_bgezal; break;
+		}
+		break;
+	case OP_J:
+	case OP_JAL:
+		insn->imm = INS_TARGET( op ) << 2;
+		insn->handler = ( INS_OP( op ) == OP_J ) ? MIPS_j : MIPS_jal;
+		break;
+	case OP_BEQ: insn->imm <<= 2; insn->handler = MIPS_beq; break;
+	case OP_BNE: insn->imm <<= 2; insn->handler = MIPS_bne; break;
+	case OP_BLEZ:
+	case OP_BGTZ:
+		insn->imm <<= 2;
+		if( insn->rt == 0 )
+		{
+			insn->handler = ( INS_OP( op ) == OP_BLEZ ) ? MIPS_blez : MIPS_bgtz;
+		}
+		break;
+	case OP_ADDI: insn->handler = MIPS_addi; break;
+	case OP_ADDIU:
+		/* RT = 0 is the HLE IOP call */
+		if( insn->rt != 0 )
+		{
+			insn->handler = MIPS_addiu;
+		}
+		break;
+	case OP_SLTI: insn->handler = MIPS_slti; break;
+	case OP_SLTIU: insn->handler = MIPS_sltiu; break;
+	case OP_ANDI: insn->imm = INS_IMMEDIATE( op ); insn->handler = MIPS_andi; break;
+	case OP_ORI: insn->imm = INS_IMMEDIATE( op ); insn->handler = MIPS_ori; break;
+	case OP_XORI: insn->imm = INS_IMMEDIATE( op ); insn->handler = MIPS_xori; break;
+	case OP_LUI: insn->imm = INS_IMMEDIATE( op ) << 16; insn->handler = MIPS_lui; break;
+	case OP_LB: insn->handler = MIPS_lb; break;
+	case OP_LH: insn->handler = MIPS_lh; break;
+	case OP_LW: insn->handler = MIPS_lw; break;
+	case OP_LBU: insn->handler = MIPS_lbu; break;
+	case OP_LHU: insn->handler = MIPS_lhu; break;
+	case OP_SB: insn->handler = MIPS_sb; break;
+	case OP_SH: insn->handler = MIPS_sh; break;
+	case OP_SW: insn->handler = MIPS_sw; break;
+	}
+}
+
+/* Returns the decoded instruction at [pc], left to the interpreter if it is
+   not in RAM. */
+INLINE const mips_insn *mips_fetch( UINT32 pc )
+{
+	static AO_THREAD_LOCAL mips_insn uncached;
+	UINT32 op = cpu_readop32( pc );
+	mips_insn *insn;
+
+	/* all mapped pages mirror RAM */
+	if( psx_page( pc ) == NULL )
+	{
+		uncached.op = op;
+		return &uncached;
+	}
+	insn = &mips_cache[ ( pc & 0x1fffff ) >> 2 ];
+	if( insn->op != op || !insn->valid )
+	{
+		mips_decode( insn, op );
+	}
+	return insn;
+}
+
+int mips_alloc( void )
+{
+	if( mips_cache == NULL )
+	{
+		mips_cache = calloc( MIPS_CACHE_INSNS, sizeof( mips_insn ) );
+		if( mips_cache == NULL )
+		{
+			printf( "ERROR: could not allocate the instruction cache\n" );
+			return AO_FAIL;
+		}
+	}
+	else
+	{
+		memset( mips_cache, 0, MIPS_CACHE_INSNS * sizeof( mips_insn ) );
+	}
+	return AO_SUCCESS;
+}
+
+void mips_free( void )
+{
+	free( mips_cache );
+	mips_cache = NULL;
+}
+
 void mips_init( void )
 {
 #if 0
@@ -404,11 +917,12 @@ void mips_shorten_frame(void)
 
 void psx_hw_runcounters(void);
 
-int psxcpu_verbose = 0;
+AO_THREAD_LOCAL int psxcpu_verbose = 0;
 
 int mips_execute( int cycles )
 {
 	UINT32 n_res;
+	const mips_insn *insn;
 
 	mips_ICount = cycles;
 	do
@@ -417,7 +931,15 @@ int mips_execute( int cycles )
 
 //		psx_hw_runcounters();
 
-		mipscpu.op = cpu_readop32( mipscpu.pc );
+		insn = mips_fetch( mipscpu.pc );
+		mipscpu.op = insn->op;
+		PROFILE_INSN();
+		switch( insn->handler )
+		{
+#define H( name ) case MIPS_##name: if( mips_##name( insn ) ) goto skipinterp; break;
+		MIPS_HANDLERS
+#undef H
+		}
 
 #if 0
 		while (mipscpu.prevpc == mipscpu.pc)
@@ -1679,6 +2201,12 @@ static void mips_set_context( void *src )
 	}
 }
 
+void mips_state( state_t *state )
+{
+	STATE_VAR( state, mipscpu );
+	STATE_VAR( state, mips_ICount );
+}
+
 static void set_irq_line( int irqline, int state )
 {
 	UINT32 ip;
@@ -1995,19 +2523,20 @@ static void docop2( int gteop )
 	const UINT32 **p_n_cv;
 	static const UINT16 n_zm = 0;
 	static const UINT32 n_zc = 0;
-	static const UINT16 *p_n_vx[] = { &VX0, &VX1, &VX2 };
-	static const UINT16 *p_n_vy[] = { &VY0, &VY1, &VY2 };
-	static const UINT16 *p_n_vz[] = { &VZ0, &VZ1, &VZ2 };
-	static const UINT16 *p_n_rm[] = { &R11, &R12, &R13, &R21, &R22, &R23, &R31, &R32, &R33 };
-	static const UINT16 *p_n_lm[] = { &L11, &L12, &L13, &L21, &L22, &L23, &L31, &L32, &L33 };
-	static const UINT16 *p_n_cm[] = { &LR1, &LR2, &LR3, &LG1, &LG2, &LG3, &LB1, &LB2, &LB3 };
-	static const UINT16 *p_n_zm[] = { &n_zm, &n_zm, &n_zm, &n_zm, &n_zm, &n_zm, &n_zm, &n_zm, &n_zm };
-	static const UINT16 **p_p_n_mx[] = { p_n_rm, p_n_lm, p_n_cm, p_n_zm };
-	static const UINT32 *p_n_tr[] = { &TRX, &TRY, &TRZ };
-	static const UINT32 *p_n_bk[] = { &RBK, &GBK, &BBK };
-	static const UINT32 *p_n_fc[] = { &RFC, &GFC, &BFC };
-	static const UINT32 *p_n_zc[] = { &n_zc, &n_zc, &n_zc };
-	static const UINT32 **p_p_n_cv[] = { p_n_tr, p_n_bk, p_n_fc, p_n_zc };
+	// The CPU context is thread-local, so these can't be static.
+	const UINT16 *p_n_vx[] = { &VX0, &VX1, &VX2 };
+	const UINT16 *p_n_vy[] = { &VY0, &VY1, &VY2 };
+	const UINT16 *p_n_vz[] = { &VZ0, &VZ1, &VZ2 };
+	const UINT16 *p_n_rm[] = { &R11, &R12, &R13, &R21, &R22, &R23, &R31, &R32, &R33 };
+	const UINT16 *p_n_lm[] = { &L11, &L12, &L13, &L21, &L22, &L23, &L31, &L32, &L33 };
+	const UINT16 *p_n_cm[] = { &LR1, &LR2, &LR3, &LG1, &LG2, &LG3, &LB1, &LB2, &LB3 };
+	const UINT16 *p_n_zm[] = { &n_zm, &n_zm, &n_zm, &n_zm, &n_zm, &n_zm, &n_zm, &n_zm, &n_zm };
+	const UINT16 **p_p_n_mx[] = { p_n_rm, p_n_lm, p_n_cm, p_n_zm };
+	const UINT32 *p_n_tr[] = { &TRX, &TRY, &TRZ };
+	const UINT32 *p_n_bk[] = { &RBK, &GBK, &BBK };
+	const UINT32 *p_n_fc[] = { &RFC, &GFC, &BFC };
+	const UINT32 *p_n_zc[] = { &n_zc, &n_zc, &n_zc };
+	const UINT32 **p_p_n_cv[] = { p_n_tr, p_n_bk, p_n_fc, p_n_zc };
 
 	switch( GTE_FUNCT( gteop ) )
 	{
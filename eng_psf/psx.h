@@ -277,6 +277,131 @@ enum
 /* OP_COP0 */
 #define CF_RFE ( 16 )
 
+uint32 psx_hw_read(offs_t offset, uint32 mem_mask);
+void psx_hw_write(offs_t offset, uint32 data, uint32 mem_mask);
+
+// R3000 memory map, in pages of 64 KB over the whole address space. Pages of
+// the RAM mirrors at 0x00000000-0x007fffff and 0x80000000-0x807fffff point
+// directly into psx_ram. All others are NULL and handled by psx_hw_read() and
+// psx_hw_write().
+#define PSX_PAGE_SHIFT 16
+#define PSX_PAGE_MASK ((1 << PSX_PAGE_SHIFT) - 1)
+#define PSX_PAGE_COUNT (1 << (32 - PSX_PAGE_SHIFT))
+
+extern AO_THREAD_LOCAL uint8 *psx_pages[PSX_PAGE_COUNT];
+
+INLINE uint8 *psx_page(uint32 address)
+{
+	return psx_pages[address >> PSX_PAGE_SHIFT];
+}
+
+// Little-endian accesses to [address], rounded down to the access size.
+INLINE uint8 program_read_byte_32le(offs_t address)
+{
+	const uint8 *page = psx_page(address);
+	uint8 addr_shift;
+
+	if (page)
+	{
+		return page[address & PSX_PAGE_MASK];
+	}
+	addr_shift = (address & 0x3) * 8;
+	return psx_hw_read(address, ~(0xff << addr_shift)) >> addr_shift;
+}
+
+INLINE uint16 program_read_word_32le(offs_t address)
+{
+	const uint8 *page = psx_page(address);
+
+	if (page)
+	{
+		const uint8 *p = &page[address & PSX_PAGE_MASK & ~1];
+#if LSB_FIRST
+		return *(const uint16 *)p;
+#else
+		return p[0] | (p[1] << 8);
+#endif
+	}
+	if (address & 2)
+		return psx_hw_read(address, 0x0000ffff)>>16;
+
+	return psx_hw_read(address, 0xffff0000);
+}
+
+INLINE uint32 program_read_dword_32le(offs_t address)
+{
+	const uint8 *page = psx_page(address);
+
+	if (page)
+	{
+		const uint8 *p = &page[address & PSX_PAGE_MASK & ~3];
+#if LSB_FIRST
+		return *(const uint32 *)p;
+#else
+		return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32)p[3] << 24);
+#endif
+	}
+	return psx_hw_read(address, 0);
+}
+
+INLINE void program_write_byte_32le(offs_t address, uint8 data)
+{
+	uint8 *page = psx_page(address);
+	uint8 addr_shift;
+
+	if (page)
+	{
+		page[address & PSX_PAGE_MASK] = data;
+		return;
+	}
+	addr_shift = (address & 0x3) * 8;
+	psx_hw_write(address, data << addr_shift, ~(0xff << addr_shift));
+}
+
+INLINE void program_write_word_32le(offs_t address, uint16 data)
+{
+	uint8 *page = psx_page(address);
+
+	if (page)
+	{
+		uint8 *p = &page[address & PSX_PAGE_MASK & ~1];
+#if LSB_FIRST
+		*(uint16 *)p = data;
+#else
+		p[0] = data & 0xff;
+		p[1] = (data >> 8) & 0xff;
+#endif
+		return;
+	}
+	if (address & 2)
+	{
+		psx_hw_write(address, data<<16, 0x0000ffff);
+		return;
+	}
+
+	psx_hw_write(address, data, 0xffff0000);
+}
+
+INLINE void program_write_dword_32le(offs_t address, uint32 data)
+{
+	uint8 *page = psx_page(address);
+
+	if (page)
+	{
+		uint8 *p = &page[address & PSX_PAGE_MASK & ~3];
+#if LSB_FIRST
+		*(uint32 *)p = data;
+#else
+		p[0] = data & 0xff;
+		p[1] = (data >> 8) & 0xff;
+		p[2] = (data >> 16) & 0xff;
+		p[3] = (data >> 24) & 0xff;
+#endif
+		return;
+	}
+	psx_hw_write(address, data, 0);
+}
+
 #ifdef MAME_DEBUG
 extern unsigned DasmMIPS(char *buff, unsigned _pc);
 #endif
@@ -58,22 +58,27 @@
 
 extern void mips_get_info(UINT32 state, union cpuinfo *info);
 extern void mips_set_info(UINT32 state, union cpuinfo *info);
-extern int psxcpu_verbose;
+extern AO_THREAD_LOCAL int psxcpu_verbose;
 extern uint16 SPUreadRegister(uint32 reg);
 extern void SPUwriteRegister(uint32 reg, uint16 val);
 extern void SPUwriteDMAMem(uint32 usPSXMem,int iSize);
 extern void SPUreadDMAMem(uint32 usPSXMem,int iSize);
 extern void mips_shorten_frame(void);
 extern int mips_execute( int cycles );
+extern int mips_alloc( void );
+extern void mips_free( void );
 extern uint32 psf2_load_file(char *file, uint8 *buf, uint32 buflen);
+extern int32 psf2_find_file(char *file);
+extern uint32 psf2_file_size(int32 file);
+extern uint32 psf2_read_file(int32 file, uint32 pos, uint8 *buf, uint32 len);
 extern uint32 psf2_load_elf(uint8 *start, uint32 len);
 void psx_hw_runcounters(void);
 int mips_get_icount(void);
 void mips_set_icount(int count);
 
-extern int psf_refresh;
+extern AO_THREAD_LOCAL int psf_refresh;
 
-static int skipyet = 0;
+static AO_THREAD_LOCAL int skipyet = 0;
 
 // SPU2
 extern void SPU2write(unsigned long reg, unsigned short val);
@@ -87,17 +92,17 @@ extern void SPU2interruptDMA7(void);
 
 #define MAX_FILE_SLOTS	(32)
 
-static volatile int softcall_target = 0;
-static int filestat[MAX_FILE_SLOTS];
-static uint8 *filedata[MAX_FILE_SLOTS];
-static uint32 filesize[MAX_FILE_SLOTS], filepos[MAX_FILE_SLOTS];
+static AO_THREAD_LOCAL volatile int softcall_target = 0;
+static AO_THREAD_LOCAL int filestat[MAX_FILE_SLOTS];
+static AO_THREAD_LOCAL int32 fileindex[MAX_FILE_SLOTS];	// into the PSF2 filesystem
+static AO_THREAD_LOCAL uint32 filesize[MAX_FILE_SLOTS], filepos[MAX_FILE_SLOTS];
 uint32 psf2_get_loadaddr(void);
 void psf2_set_loadaddr(uint32 new);
 static void call_irq_routine(uint32 routine, uint32 parameter);
-static int intr_susp = 0;
+static AO_THREAD_LOCAL int intr_susp = 0;
 
-static uint64 sys_time;
-static int timerexp = 0;
+static AO_THREAD_LOCAL uint64 sys_time;
+static AO_THREAD_LOCAL int timerexp = 0;
 
 typedef struct
 {
@@ -105,8 +110,8 @@ typedef struct
 	uint32 dispatch;
 } ExternLibEntries;
 
-static int32 iNumLibs;
-static ExternLibEntries	reglibs[32];
+static AO_THREAD_LOCAL int32 iNumLibs;
+static AO_THREAD_LOCAL ExternLibEntries	reglibs[32];
 
 typedef struct
 {
@@ -116,8 +121,8 @@ typedef struct
 	int    inUse;
 } EventFlag;
 
-static int32 iNumFlags;
-static EventFlag evflags[32];
+static AO_THREAD_LOCAL int32 iNumFlags;
+static AO_THREAD_LOCAL EventFlag evflags[32];
 
 typedef struct
 {
@@ -132,8 +137,8 @@ typedef struct
 
 #define SEMA_MAX	(64)
 
-static int32 iNumSema;
-static Semaphore semaphores[SEMA_MAX];
+static AO_THREAD_LOCAL int32 iNumSema;
+static AO_THREAD_LOCAL Semaphore semaphores[SEMA_MAX];
 
 // thread states
 enum
@@ -164,8 +169,8 @@ typedef struct
 	uint32 save_regs[37];	// CPU registers belonging to this thread
 } Thread;
 
-static int32 iNumThreads, iCurThread;
-static Thread threads[32];
+static AO_THREAD_LOCAL int32 iNumThreads, iCurThread;
+static AO_THREAD_LOCAL Thread threads[32];
 
 #if DEBUG_THREADING
 static char *_ThreadStateNames[TS_MAXSTATE] = { "RUNNING", "READY", "WAITEVFLAG", "WAITSEMA", "WAITDELAY", "SLEEPING", "CREATED" };
@@ -187,8 +192,8 @@ typedef struct
 	uint32 mode;
 } IOPTimer;
 
-static IOPTimer iop_timers[8];
-static int32 iNumTimers;
+static AO_THREAD_LOCAL IOPTimer iop_timers[8];
+static AO_THREAD_LOCAL int32 iNumTimers;
 
 typedef struct
 {
@@ -198,7 +203,7 @@ typedef struct
 	uint32 sysclock;
 } Counter;
 
-static Counter root_cnts[3];	// 3 of the bastards
+static AO_THREAD_LOCAL Counter root_cnts[3];	// 3 of the bastards
 
 #define CLOCK_DIV	(8)	// 33 MHz / this = what we run the R3000 at to keep the CPU usage not insane
 
@@ -218,8 +223,8 @@ typedef struct
 	uint32 fhandler;
 } EvtCtrlBlk[32];
 
-static EvtCtrlBlk *Event;
-static EvtCtrlBlk *CounterEvent;
+static AO_THREAD_LOCAL EvtCtrlBlk *Event;
+static AO_THREAD_LOCAL EvtCtrlBlk *CounterEvent;
 
 // Sony event states
 #define EvStUNUSED	0x0000
@@ -231,18 +236,24 @@ static EvtCtrlBlk *CounterEvent;
 #define EvMdINTR	0x1000
 #define EvMdNOINTR	0x2000
 
-// PSX main RAM
-uint32 psx_ram[(2*1024*1024)/4];
-uint32 psx_scratch[0x400];
+// PSX main RAM, allocated per thread in psx_hw_alloc(). A few spare words at
+// the end catch unaligned accesses to the last word.
+#define PSX_RAM_ALLOC_SIZE ((2*1024*1024) + 16)
+AO_THREAD_LOCAL uint32 *psx_ram;
+AO_THREAD_LOCAL uint32 psx_scratch[0x400];
+AO_THREAD_LOCAL uint8 *psx_pages[PSX_PAGE_COUNT];
 // backup image to restart songs
-uint32 initial_ram[(2*1024*1024)/4];
-uint32 initial_scratch[0x400];
+AO_THREAD_LOCAL uint32 *initial_ram;
+AO_THREAD_LOCAL uint32 initial_scratch[0x400];
 
-static uint32 spu_delay, dma_icr, irq_data, irq_mask, dma_timer, WAI;
-static uint32 dma4_madr, dma4_bcr, dma4_chcr, dma4_delay;
-static uint32 dma7_madr, dma7_bcr, dma7_chcr, dma7_delay;
-static uint32 dma4_cb, dma7_cb, dma4_fval, dma4_flag, dma7_fval, dma7_flag;
-static uint32 irq9_cb, irq9_fval, irq9_flag;
+// State of the HLE BIOS rand() and srand() calls
+static AO_THREAD_LOCAL ao_rand_t hle_rng;
+
+static AO_THREAD_LOCAL uint32 spu_delay, dma_icr, irq_data, irq_mask, dma_timer, WAI;
+static AO_THREAD_LOCAL uint32 dma4_madr, dma4_bcr, dma4_chcr, dma4_delay;
+static AO_THREAD_LOCAL uint32 dma7_madr, dma7_bcr, dma7_chcr, dma7_delay;
+static AO_THREAD_LOCAL uint32 dma4_cb, dma7_cb, dma4_fval, dma4_flag, dma7_fval, dma7_flag;
+static AO_THREAD_LOCAL uint32 irq9_cb, irq9_fval, irq9_flag;
 
 // take a snapshot of the CPU state for a thread
 static void FreezeThread(int32 iThread, int flag)
@@ -472,7 +483,7 @@ void psx_irq_set(uint32 irq)
 	psx_irq_update();
 }
 
-static uint32 gpu_stat = 0;
+static AO_THREAD_LOCAL uint32 gpu_stat = 0;
 
 uint32 psx_hw_read(offs_t offset, uint32 mem_mask)
 {
@@ -900,7 +911,7 @@ void ps2_hw_slice(void)
 	}
 }
 
-static int fcnt = 0;
+static AO_THREAD_LOCAL int fcnt = 0;
 
 void psx_hw_frame(void)
 {
@@ -939,16 +950,16 @@ enum
 	BLK_BK = 12
 };
 
-static uint32 heap_addr, entry_int = 0;
+static AO_THREAD_LOCAL uint32 heap_addr, entry_int = 0;
 
 extern uint32 mips_get_cause(void);
 extern uint32 mips_get_status(void);
 extern void mips_set_status(uint32 status);
 extern uint32 mips_get_ePC(void);
 
-static uint32 irq_regs[37];
+static AO_THREAD_LOCAL uint32 irq_regs[37];
 
-static int irq_mutex = 0;
+static AO_THREAD_LOCAL int irq_mutex = 0;
 
 static void call_irq_routine(uint32 routine, uint32 parameter)
 {
@@ -1265,12 +1276,129 @@ static uint32 calc_spec(uint32 a1)
 	return spec;
 }
 
+void psx_hw_free(void)
+{
+	mips_free();
+	memset(psx_pages, 0, sizeof(psx_pages));
+	free(psx_ram);
+	free(initial_ram);
+	psx_ram = NULL;
+	initial_ram = NULL;
+}
+
+void psx_hw_state(state_t *state)
+{
+	state_data(state, psx_ram, PSX_RAM_ALLOC_SIZE);
+	STATE_VAR(state, psx_scratch);
+
+	STATE_VAR(state, skipyet);
+	STATE_VAR(state, softcall_target);
+	STATE_VAR(state, intr_susp);
+	STATE_VAR(state, sys_time);
+	STATE_VAR(state, timerexp);
+	STATE_VAR(state, fcnt);
+	STATE_VAR(state, gpu_stat);
+	STATE_VAR(state, hle_rng);
+
+	STATE_VAR(state, spu_delay);
+	STATE_VAR(state, dma_icr);
+	STATE_VAR(state, irq_data);
+	STATE_VAR(state, irq_mask);
+	STATE_VAR(state, dma_timer);
+	STATE_VAR(state, WAI);
+	STATE_VAR(state, dma4_madr);
+	STATE_VAR(state, dma4_bcr);
+	STATE_VAR(state, dma4_chcr);
+	STATE_VAR(state, dma4_delay);
+	STATE_VAR(state, dma7_madr);
+	STATE_VAR(state, dma7_bcr);
+	STATE_VAR(state, dma7_chcr);
+	STATE_VAR(state, dma7_delay);
+	STATE_VAR(state, dma4_cb);
+	STATE_VAR(state, dma7_cb);
+	STATE_VAR(state, dma4_fval);
+	STATE_VAR(state, dma4_flag);
+	STATE_VAR(state, dma7_fval);
+	STATE_VAR(state, dma7_flag);
+	STATE_VAR(state, irq9_cb);
+	STATE_VAR(state, irq9_fval);
+	STATE_VAR(state, irq9_flag);
+	STATE_VAR(state, root_cnts);
+
+	// BIOS HLE
+	STATE_VAR(state, heap_addr);
+	STATE_VAR(state, entry_int);
+	STATE_VAR(state, irq_regs);
+	STATE_VAR(state, irq_mutex);
+
+	// IOP HLE
+	STATE_VAR(state, iNumLibs);
+	STATE_VAR(state, reglibs);
+	STATE_VAR(state, iNumFlags);
+	STATE_VAR(state, evflags);
+	STATE_VAR(state, iNumSema);
+	STATE_VAR(state, semaphores);
+	STATE_VAR(state, iNumThreads);
+	STATE_VAR(state, iCurThread);
+	STATE_VAR(state, threads);
+	STATE_VAR(state, iop_timers);
+	STATE_VAR(state, iNumTimers);
+
+	// Open files are just indices into the PSF2 filesystem, which stays the
+	// same for the whole song.
+	STATE_VAR(state, filestat);
+	STATE_VAR(state, fileindex);
+	STATE_VAR(state, filesize);
+	STATE_VAR(state, filepos);
+}
+
+// Allocates zeroed main RAM and the restart image for the current thread.
+int psx_hw_alloc(void)
+{
+	uint32 page;
+
+	if (!psx_ram)
+	{
+		psx_ram = malloc(PSX_RAM_ALLOC_SIZE);
+		initial_ram = malloc(PSX_RAM_ALLOC_SIZE);
+		if (!psx_ram || !initial_ram)
+		{
+			printf("ERROR: could not allocate %d bytes of memory\n", PSX_RAM_ALLOC_SIZE * 2);
+			psx_hw_free();
+			return AO_FAIL;
+		}
+	}
+	if (mips_alloc() != AO_SUCCESS)
+	{
+		psx_hw_free();
+		return AO_FAIL;
+	}
+	memset(psx_ram, 0, PSX_RAM_ALLOC_SIZE);
+	memset(initial_ram, 0, PSX_RAM_ALLOC_SIZE);
+	memset(psx_scratch, 0, sizeof(psx_scratch));
+	memset(initial_scratch, 0, sizeof(initial_scratch));
+
+	// 2 MB of RAM, mirrored four times in KUSEG and KSEG0
+	for (page = 0; page < (0x800000 >> PSX_PAGE_SHIFT); page++)
+	{
+		uint8 *ram = (uint8 *)psx_ram + ((page << PSX_PAGE_SHIFT) & 0x1fffff);
+		psx_pages[page] = ram;
+		psx_pages[(0x80000000 >> PSX_PAGE_SHIFT) + page] = ram;
+	}
+	return AO_SUCCESS;
+}
+
 void psx_hw_init(void)
 {
 	timerexp = 0;
+	skipyet = 0;
+	intr_susp = 0;
+	fcnt = 0;
+	irq_mutex = 0;
+	ao_srand(&hle_rng, 1);
 
 	memset(filestat, 0, sizeof(filestat));
-	memset(filedata, 0, sizeof(filedata));
+	memset(fileindex, 0xff, sizeof(fileindex));
 
 	dma4_cb = dma7_cb = 0;
 
@@ -1305,17 +1433,21 @@ void psx_hw_init(void)
 	CounterEvent = (Event + (32*2));
 
 	dma_icr = 0;
+	dma_timer = 0;
 	spu_delay = 0;
 	irq_data = 0;
 	irq_mask = 0;
 	softcall_target = 0;
 	gpu_stat = 0;
-	dma4_madr = dma4_bcr = dma4_chcr = 0;
+	dma4_madr = dma4_bcr = dma4_chcr = dma4_delay = 0;
+	dma7_madr = dma7_bcr = dma7_chcr = dma7_delay = 0;
+	irq9_cb = 0;
 	heap_addr = 0;
 	entry_int = 0;
 
 	WAI = 0;
 
+	memset(root_cnts, 0, sizeof(root_cnts));
 	root_cnts[0].mode = RC_EN;
 	root_cnts[1].mode = RC_EN;
 	root_cnts[2].mode = RC_EN;
@@ -1521,7 +1653,7 @@ void psx_bios_hle(uint32 pc)
 					#endif
 
 					// v0 = result
-					mipsinfo.i = 1 + (int)(32767.0*rand()/(RAND_MAX+1.0));
+					mipsinfo.i = 1 + (int)(32767.0*ao_rand(&hle_rng)/(AO_RAND_MAX+1.0));
 					mips_set_info(CPUINFO_INT_REGISTER + MIPS_R2, &mipsinfo);
 					break;
 
@@ -1529,7 +1661,7 @@ void psx_bios_hle(uint32 pc)
 					#if DEBUG_HLE_BIOS
 					printf("HLEBIOS: srand(%x)\n", a0);
 					#endif
-					srand(a0);
+					ao_srand(&hle_rng, a0);
 					break;
 
 				case 0x33:	// malloc
@@ -1965,49 +2097,6 @@ void SPUirq(void)
 //	psx_irq_set(0x200);
 }
 
-// PSXCPU callbacks
-
-uint8 program_read_byte_32le(offs_t address)
-{
-	uint8 addr_shift = (address & 0x3) * 8;
-	return psx_hw_read(address, ~(0xff << addr_shift)) >> addr_shift;
-}
-
-uint16 program_read_word_32le(offs_t address)
-{
-	if (address & 2)
-		return psx_hw_read(address, 0x0000ffff)>>16;
-
-	return psx_hw_read(address, 0xffff0000);
-}
-
-uint32 program_read_dword_32le(offs_t address)
-{
-	return psx_hw_read(address, 0);
-}
-
-void program_write_byte_32le(offs_t address, uint8 data)
-{
-	uint8 addr_shift = (address & 0x3) * 8;
-	psx_hw_write(address, data << addr_shift, ~(0xff << addr_shift));
-}
-
-void program_write_word_32le(offs_t address, uint16 data)
-{
-	if (address & 2)
-	{
-		psx_hw_write(address, data<<16, 0x0000ffff);
-		return;
-	}
-
-	psx_hw_write(address, data, 0xffff0000);
-}
-
-void program_write_dword_32le(offs_t address, uint32 data)
-{
-	psx_hw_write(address, data, 0);
-}
-
 // sprintf replacement
 static void iop_sprintf(char *out, char *fmt, uint32 pstart)
 {
@@ -3349,8 +3438,8 @@ void psx_iop_call(uint32 pc, uint32 callnum)
 					printf("IOP: open(\"%s\") (PC=%08x)\n", mname, mipsinfo.i);
 					#endif
 
-					filedata[slot2use] = malloc(6*1024*1024);
-					filesize[slot2use] = psf2_load_file(mname, filedata[slot2use], 6*1024*1024);
+					fileindex[slot2use] = psf2_find_file(mname);
+					filesize[slot2use] = (fileindex[slot2use] != -1) ? psf2_file_size(fileindex[slot2use]) : 0xffffffff;
 					filepos[slot2use] = 0;
 					filestat[slot2use] = 1;
 
@@ -3371,8 +3460,7 @@ void psx_iop_call(uint32 pc, uint32 callnum)
 				mips_get_info(CPUINFO_INT_REGISTER + MIPS_R31, &mipsinfo);
 				printf("IOP: close(%d) (PC=%08x)\n", a0, mipsinfo.i);
 				#endif
-				free(filedata[a0]);
-				filedata[a0] = (uint8 *)NULL;
+				fileindex[a0] = -1;
 				filepos[a0] = 0;
 				filesize[a0] = 0;
 				filestat[a0] = 0;
@@ -3383,7 +3471,7 @@ void psx_iop_call(uint32 pc, uint32 callnum)
 				printf("IOP: read(%x %x %d) [pos %d size %d]\n", a0, a1, a2, filepos[a0], filesize[a0]);
 				#endif
 
-				if (filepos[a0] >= filesize[a0])
+				if ((filepos[a0] >= filesize[a0]) || (fileindex[a0] == -1))
 				{
 					mipsinfo.i = 0;
 				}
@@ -3398,7 +3486,7 @@ void psx_iop_call(uint32 pc, uint32 callnum)
 
 					rp = (uint8 *)psx_ram;
 					rp += (a1 & 0x1fffff);
-					memcpy(rp, &filedata[a0][filepos[a0]], a2);
+					a2 = psf2_read_file(fileindex[a0], filepos[a0], rp, a2);
 
 					filepos[a0] += a2;
 					mipsinfo.i = a2;
@@ -63,24 +63,28 @@ that no encryption is used.
 #include "ao.h"
 #include "qsound.h"
 #include "z80.h"
+#include "mem.h"
 
 #include "corlett.h"
+#include "utils.h"
 
-// timer rate is 285 Hz
-static int32 samples_per_tick = 44100/285;
-static int32 samples_to_next_tick = 44100/285;
+// timer rate is 285 Hz, and we render at the native rate of the QSound chip
+static AO_THREAD_LOCAL int32 samples_per_tick = QSOUND_RATE/285;
+static AO_THREAD_LOCAL int32 samples_to_next_tick = QSOUND_RATE/285;
 
-static corlett_t c = {0};
-static uint32 skey1, skey2;
-static uint16 akey;
-static uint8  xkey;
-static int32 uses_kabuki = 0;
+static AO_THREAD_LOCAL corlett_t c = {0};
+static AO_THREAD_LOCAL uint32 skey1, skey2;
+static AO_THREAD_LOCAL uint16 akey;
+static AO_THREAD_LOCAL uint8  xkey;
+static AO_THREAD_LOCAL int32 uses_kabuki = 0;
 
-static char *Z80ROM, *QSamples;
-static char RAM[0x1000], RAM2[0x1000];
-static int32 cur_bank;
+static AO_THREAD_LOCAL char *Z80ROM, *QSamples;
+static AO_THREAD_LOCAL char RAM[0x1000], RAM2[0x1000];
+static AO_THREAD_LOCAL int32 cur_bank;
 
-static struct QSound_interface qsintf =
+AO_THREAD_LOCAL memory_map_t memory_map;
+
+static AO_THREAD_LOCAL struct QSound_interface qsintf =
 {
 	QSOUND_CLOCK,
 	NULL
@@ -132,6 +136,37 @@ static void qsf_walktags(uint8 *buffer, uint8 *end)
 	}
 }
 
+// Points the 0x8000-0xbfff window at [cur_bank].
+static void qsf_map_bank(void)
+{
+	int page;
+
+	for (page = 0x8; page < 0xc; page++)
+	{
+		uint8 *ptr = (uint8 *)&Z80ROM[cur_bank + ((page - 0x8) << MEMORY_PAGE_SHIFT)];
+		memory_map.read[page] = ptr;
+		memory_map.op[page] = ptr;
+	}
+}
+
+static void qsf_map_init(void)
+{
+	int page;
+
+	memset(&memory_map, 0, sizeof(memory_map));
+	for (page = 0x0; page < 0x8; page++)
+	{
+		memory_map.read[page] = (uint8 *)&Z80ROM[page << MEMORY_PAGE_SHIFT];
+
+		// Kabuki-encrypted programs fetch their opcodes from a copy that was
+		// decrypted with a different key than the data.
+		memory_map.op[page] = memory_map.read[page] + (uses_kabuki ? (256*1024) : 0);
+	}
+	qsf_map_bank();
+	memory_map.read[0xc] = memory_map.write[0xc] = memory_map.op[0xc] = (uint8 *)RAM;
+	memory_map.read[0xf] = memory_map.write[0xf] = memory_map.op[0xf] = (uint8 *)RAM2;
+}
+
 static int32 qsf_irq_cb(int param)
 {
 	return 0x000000ff;	// RST_38
@@ -149,18 +184,23 @@ int32 qsf_start(uint8 *buffer, uint32 length)
 {
 	z80_init();
 
-	Z80ROM = malloc(512*1024);
-	QSamples = malloc(8*1024*1024);
+	// Parts of both buffers that the song doesn't fill can still be read,
+	// and must not differ from one start to the next.
+	Z80ROM = calloc(512*1024, 1);
+	QSamples = calloc(8*1024*1024, 1);
 
+	samples_to_next_tick = samples_per_tick;
 	skey1 = skey2 = 0;
 	akey = 0;
 	xkey = 0;
 	cur_bank = 0;
+	uses_kabuki = 0;
 
 	memset(RAM, 0, 0x1000);
 	memset(RAM2, 0, 0x1000);
 
 	// Decode the current QSF
+	corlett_sample_rate_set(QSOUND_RATE);
 	if (corlett_decode(buffer, length, &c, qsf_lib) != AO_SUCCESS)
 	{
 		return AO_FAIL;
@@ -176,6 +216,7 @@ int32 qsf_start(uint8 *buffer, uint32 length)
 		cps1_decode((unsigned char *)Z80ROM, skey1, skey2, akey, xkey);
 	}
 
+	qsf_map_init();
 	z80_reset(NULL);
 	z80_set_irq_callback(qsf_irq_cb);
 	qsintf.sample_rom = QSamples;
@@ -190,19 +231,64 @@ static void timer_tick(void)
 	z80_set_irq_line(0, CLEAR_LINE);
 }
 
-int32 qsf_sample(stereo_sample_t *sample)
+int32 qsf_render(stereo_sample_t *buf, uint32 count)
 {
-	z80_execute((8000000/44100));
-	qsound_update(0, sample);
+	uint32 i = 0;
+	while (i < count)
+	{
+		// The Z80 only talks to QSound through register writes, so it can
+		// run ahead until the next timer tick, with QSound then applying the
+		// writes at the samples they were made in. The Z80 still gets one
+		// z80_execute() call per sample, since the core drops the cycles it
+		// overshoots by at the end of every call.
+		uint32 block = count - i;
+		uint32 j;
+
+		if (block > (uint32)samples_to_next_tick)
+		{
+			block = samples_to_next_tick;
+		}
+
+		PROFILE_ENTER(PROFILE_CPU);
+		for (j = 0; j < block; j++)
+		{
+			qsound_set_sample(j);
+			z80_execute((8000000/QSOUND_RATE));
+		}
+		PROFILE_LEAVE();
+		PROFILE_ENTER(PROFILE_CHIP);
+		qsound_update(&buf[i], block);
+		PROFILE_LEAVE();
+
+		i += block;
+		samples_to_next_tick -= block;
+		if (samples_to_next_tick <= 0)
+		{
+			timer_tick();
+			samples_to_next_tick = samples_per_tick;
+		}
+	}
 
-	samples_to_next_tick --;
+	return AO_SUCCESS;
+}
+
+int32 qsf_sample(stereo_sample_t *sample)
+{
+	return qsf_render(sample, 1);
+}
 
-	if (samples_to_next_tick <= 0)
+int32 qsf_state(state_t *state)
+{
+	STATE_VAR(state, samples_to_next_tick);
+	STATE_VAR(state, RAM);
+	STATE_VAR(state, RAM2);
+	STATE_VAR(state, cur_bank);
+	if (state->mode == STATE_LOAD)
 	{
-		timer_tick();
-		samples_to_next_tick = samples_per_tick;
+		qsf_map_bank();
 	}
-
+	z80_state(state);
+	qsound_state(state);
 	return AO_SUCCESS;
 }
 
@@ -211,10 +297,20 @@ int32 qsf_frame(void)
 	return AO_SUCCESS;
 }
 
+// The QSound mixer is cheap enough compared to the Z80 that a dedicated
+// skipping path would not buy anything.
+int32 qsf_skip(uint32 count)
+{
+	return render_discard(qsf_render, qsf_frame, count);
+}
+
 int32 qsf_stop(void)
 {
 	free(Z80ROM);
 	free(QSamples);
+	z80_exit();
+	corlett_free(&c);
+	corlett_sample_rate_set(AUDIO_RATE);
 
 	return AO_SUCCESS;
 }
@@ -226,6 +322,9 @@ int32 qsf_command(int32 command, int32 parameter)
 		case COMMAND_RESTART:
 			return AO_SUCCESS;
 
+		case COMMAND_SEEK:
+			return qsf_skip(parameter);
+
 	}
 	return AO_FAIL;
 }
@@ -256,43 +355,15 @@ int32 qsf_fill_info(ao_display_info *info)
 	return AO_SUCCESS;
 }
 
+// ROM and RAM are accessed through [memory_map], so these only see the
+// QSound ports at 0xd000-0xd007 and unmapped addresses.
 uint8 qsf_memory_read(uint16 addr)
 {
-	if (addr < 0x8000)
-	{
-		return Z80ROM[addr];
-	}
-	else if (addr < 0xc000)
-	{
-		return Z80ROM[(addr - 0x8000) + cur_bank];
-	}
-	else if (addr <= 0xcfff)
-	{
-		return RAM[addr - 0xc000];
-	}
-	else if (addr == 0xd007)
+	if (addr == 0xd007)
 	{
 		return qsound_status_r();
 	}
-	else if (addr >= 0xf000)
-	{
-		return RAM2[addr-0xf000];
-	}
-}
-
-uint8 qsf_memory_readop(uint16 addr)
-{
-	if (!uses_kabuki)
-	{
-		return qsf_memory_read(addr);
-	}
-
-	if (addr < 0x8000)
-	{
-		return Z80ROM[addr + (256*1024)];
-	}
-
-	return qsf_memory_read(addr);
+	return 0;
 }
 
 uint8 qsf_memory_readport(uint16 addr)
@@ -302,26 +373,17 @@ uint8 qsf_memory_readport(uint16 addr)
 
 void qsf_memory_write(uint16 addr, uint8 byte)
 {
-	if (addr >= 0xc000 && addr <= 0xcfff)
-	{
-
-		RAM[addr-0xc000] = byte;
-		return;
-	}
-	else if (addr == 0xd000)
+	if (addr == 0xd000)
 	{
 		qsound_data_h_w(byte);
-		return;
 	}
 	else if (addr == 0xd001)
 	{
 		qsound_data_l_w(byte);
-		return;
 	}
 	else if (addr == 0xd002)
 	{
 		qsound_cmd_w(byte);
-		return;
 	}
 	else if (addr == 0xd003)
 	{
@@ -331,12 +393,7 @@ void qsf_memory_write(uint16 addr, uint8 byte)
 			cur_bank = 0;
 		}
 //		printf("Z80 bank to %x (%x)\n", cur_bank, byte);
-		return;
-	}
-	else if (addr >= 0xf000)
-	{
-		RAM2[addr-0xf000] = byte;
-		return;
+		qsf_map_bank();
 	}
 }
 
@@ -32,6 +32,7 @@
 ***************************************************************************/
 
 #include <math.h>
+#include "ao.h"
 #include "cpuintrf.h"
 #include "qsound.h"
 
@@ -67,10 +68,15 @@ typedef signed short QSOUND_SRC_SAMPLE;
 #define LENGTH_DIV 2
 #endif
 
-#define QSOUND_CLOCKDIV 166			 /* Clock divider */
 #define QSOUND_CHANNELS 16
 typedef INT16 QSOUND_SAMPLE;
 
+/* Register writes that can be logged before the next qsound_update() */
+#define QSOUND_LOG_MAX 8192
+
+/* Samples mixed per pass */
+#define QSOUND_MIX_MAX 256
+
 struct QSOUND_CHANNEL
 {
 	int bank;	   /* bank (x16)	*/
@@ -104,15 +110,23 @@ struct QSOUND_CHANNEL
 
 
 /* Private variables */
-static struct QSound_interface *intf;	/* Interface  */
-static int qsound_stream;				/* Audio stream */
-static struct QSOUND_CHANNEL qsound_channel[QSOUND_CHANNELS];
-static int qsound_data;				  /* register latch data */
-QSOUND_SRC_SAMPLE *qsound_sample_rom;	/* Q sound sample ROM */
+static AO_THREAD_LOCAL struct QSound_interface *intf;	/* Interface  */
+static AO_THREAD_LOCAL int qsound_stream;				/* Audio stream */
+static AO_THREAD_LOCAL struct QSOUND_CHANNEL qsound_channel[QSOUND_CHANNELS];
+static AO_THREAD_LOCAL int qsound_data;				  /* register latch data */
+static AO_THREAD_LOCAL struct
+{
+	UINT32 sample;
+	UINT16 value;
+	UINT8 data;
+} qsound_log[QSOUND_LOG_MAX];						/* pending register writes */
+static AO_THREAD_LOCAL int qsound_log_count;
+static AO_THREAD_LOCAL UINT32 qsound_log_sample;	/* timestamp for new writes */
+AO_THREAD_LOCAL QSOUND_SRC_SAMPLE *qsound_sample_rom;	/* Q sound sample ROM */
 
 #if QSOUND_DRIVER1
-static int qsound_pan_table[33];		 /* Pan volume table */
-static float qsound_frq_ratio;		   /* Frequency ratio */
+static AO_THREAD_LOCAL int qsound_pan_table[33];		 /* Pan volume table */
+static AO_THREAD_LOCAL float qsound_frq_ratio;		   /* Frequency ratio */
 #endif
 
 /* Function prototypes */
@@ -134,10 +148,12 @@ int  qsound_sh_start( struct QSound_interface *qsintf )
 	qsound_sample_rom = (QSOUND_SRC_SAMPLE *)intf->sample_rom;
 
 	memset(qsound_channel, 0, sizeof(qsound_channel));
+	qsound_log_count = 0;
+	qsound_log_sample = 0;
 
 #if QSOUND_DRIVER1
 	qsound_frq_ratio = ((float)intf->clock / (float)QSOUND_CLOCKDIV) /
-						(float) 44100;
+						(float) QSOUND_RATE;
 	qsound_frq_ratio *= 16.0;
 
 	/* Create pan table */
@@ -184,6 +200,12 @@ void qsound_sh_stop (void)
 {
 }
 
+void qsound_state(state_t *state)
+{
+	STATE_VAR(state, qsound_channel);
+	STATE_VAR(state, qsound_data);
+}
+
 void qsound_data_h_w(int data)
 {
 	qsound_data=(qsound_data&0xff)|(data<<8);
@@ -197,7 +219,26 @@ void qsound_data_l_w(int data)
 void qsound_cmd_w(int data)
 {
 //	printf("QS: cmd %x, data %x\n", data, qsound_data);
-	qsound_set_command(data, qsound_data);
+	if (qsound_log_count >= QSOUND_LOG_MAX)
+	{
+		/* Can't happen with blocks of one timer period, but keep the order
+		   of the writes if it does */
+		int i;
+		for (i = 0; i < qsound_log_count; i++)
+		{
+			qsound_set_command(qsound_log[i].data, qsound_log[i].value);
+		}
+		qsound_log_count = 0;
+	}
+	qsound_log[qsound_log_count].sample = qsound_log_sample;
+	qsound_log[qsound_log_count].value = qsound_data;
+	qsound_log[qsound_log_count].data = data;
+	qsound_log_count++;
+}
+
+void qsound_set_sample(uint32 sample)
+{
+	qsound_log_sample = sample;
 }
 
 int qsound_status_r(void)
@@ -364,25 +405,37 @@ void qsound_set_command(int data, int value)
 
 /* Driver 1 - based on the Amuse source */
 
-void qsound_update( int num, stereo_sample_t *sample )
+/* Mixes one channel at a time. A channel that reaches the end of a non-looped
+   sample also skips all higher channels for that output sample, which [cut]
+   keeps track of. */
+static void qsound_mix( stereo_sample_t *buffer, int length )
 {
-	int i;
-	int rvol, lvol, count;
-	struct QSOUND_CHANNEL *pC=&qsound_channel[0];
-	QSOUND_SRC_SAMPLE * pST;
+	UINT8 cut[QSOUND_MIX_MAX];
+	int i, s;
 
-	sample->l = 0;
-	sample->r = 0;
+	memset(buffer, 0, length * sizeof(stereo_sample_t));
+	memset(cut, QSOUND_CHANNELS, length);
 
 	for (i=0; i<QSOUND_CHANNELS; i++)
 	{
-		if (pC->key)
-		{
-			pST=qsound_sample_rom+pC->bank;
+		struct QSOUND_CHANNEL *pC=&qsound_channel[i];
+		QSOUND_SRC_SAMPLE *pST;
+		int rvol, lvol, count;
 
-			rvol=(pC->rvol*pC->vol)>>(8*LENGTH_DIV);
-			lvol=(pC->lvol*pC->vol)>>(8*LENGTH_DIV);
+		if (!pC->key)
+		{
+			continue;
+		}
+		pST=qsound_sample_rom+pC->bank;
+		rvol=(pC->rvol*pC->vol)>>(8*LENGTH_DIV);
+		lvol=(pC->lvol*pC->vol)>>(8*LENGTH_DIV);
 
+		for (s=0; s<length; s++)
+		{
+			if (cut[s] < i)
+			{
+				continue;
+			}
 			count=(pC->offset)>>16;
 			pC->offset &= 0xffff;
 			if (count)
@@ -394,6 +447,7 @@ void qsound_update( int num, stereo_sample_t *sample )
 					{
 						/* Reached the end of a non-looped sample */
 						pC->key=0;
+						cut[s]=i;
 						break;
 					}
 					/* Reached the end, restart the loop */
@@ -402,14 +456,43 @@ void qsound_update( int num, stereo_sample_t *sample )
 				pC->lastdt = pST[pC->address];
 			}
 
-			sample->l += ((pC->lastdt * lvol) >> 6);
-			sample->r += ((pC->lastdt * rvol) >> 6);
+			buffer[s].l += ((pC->lastdt * lvol) >> 6);
+			buffer[s].r += ((pC->lastdt * rvol) >> 6);
 			pC->offset += pC->pitch;
 		}
-		pC++;
 	}
 }
 
+static void qsound_mix_range( stereo_sample_t *buffer, UINT32 start, UINT32 end )
+{
+	while (start < end)
+	{
+		int length = ((end - start) > QSOUND_MIX_MAX) ? QSOUND_MIX_MAX : (end - start);
+		qsound_mix(&buffer[start], length);
+		start += length;
+	}
+}
+
+void qsound_update( stereo_sample_t *buffer, int length )
+{
+	UINT32 pos = 0;
+	int i;
+
+	for (i = 0; i < qsound_log_count; i++)
+	{
+		/* Writes take effect from their own sample onwards */
+		if (qsound_log[i].sample > pos)
+		{
+			qsound_mix_range(buffer, pos, qsound_log[i].sample);
+			pos = qsound_log[i].sample;
+		}
+		qsound_set_command(qsound_log[i].data, qsound_log[i].value);
+	}
+	qsound_mix_range(buffer, pos, length);
+	qsound_log_count = 0;
+	qsound_log_sample = 0;
+}
+
 #else
 
 /* ----------------------------------------------------------------
@@ -8,6 +8,8 @@
 #define __QSOUND_H__
 
 #define QSOUND_CLOCK    4000000   /* default 4MHz clock */
+#define QSOUND_CLOCKDIV 166       /* clock divider */
+#define QSOUND_RATE     (QSOUND_CLOCK / QSOUND_CLOCKDIV)   /* native sample rate */
 
 struct QSound_interface
 {
@@ -17,11 +19,16 @@ struct QSound_interface
 
 int  qsound_sh_start( struct QSound_interface *qsintf );
 void qsound_sh_stop( void );
+void qsound_state( state_t *state );
 
 void qsound_data_h_w(int data);
 void qsound_data_l_w(int data);
 void qsound_cmd_w(int data);
 int qsound_status_r(void);
-void qsound_update( int num, stereo_sample_t *sample );
+/* Register writes are logged with the sample offset last passed to
+   qsound_set_sample(), and applied at that sample by the next call to
+   qsound_update(), which renders [length] samples into [buffer]. */
+void qsound_set_sample(uint32 sample);
+void qsound_update( stereo_sample_t *buffer, int length );
 
 #endif /* __QSOUND_H__ */
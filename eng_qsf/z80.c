@@ -209,20 +209,20 @@ typedef struct {
 #define _IFF2	Z80.IFF2
 #define _HALT	Z80.HALT
 
-int z80_ICount;
-static Z80_Regs Z80;
-static UINT32 EA;
-static int after_EI = 0;
+AO_THREAD_LOCAL int z80_ICount;
+static AO_THREAD_LOCAL Z80_Regs Z80;
+static AO_THREAD_LOCAL UINT32 EA;
+static AO_THREAD_LOCAL int after_EI = 0;
 
-static UINT8 SZ[256];		/* zero and sign flags */
-static UINT8 SZ_BIT[256];	/* zero, sign and parity/overflow (=zero) flags for BIT opcode */
-static UINT8 SZP[256];		/* zero, sign and parity flags */
-static UINT8 SZHV_inc[256]; /* zero, sign, half carry and overflow flags INC r8 */
-static UINT8 SZHV_dec[256]; /* zero, sign, half carry and overflow flags DEC r8 */
+static AO_THREAD_LOCAL UINT8 SZ[256];		/* zero and sign flags */
+static AO_THREAD_LOCAL UINT8 SZ_BIT[256];	/* zero, sign and parity/overflow (=zero) flags for BIT opcode */
+static AO_THREAD_LOCAL UINT8 SZP[256];		/* zero, sign and parity flags */
+static AO_THREAD_LOCAL UINT8 SZHV_inc[256]; /* zero, sign, half carry and overflow flags INC r8 */
+static AO_THREAD_LOCAL UINT8 SZHV_dec[256]; /* zero, sign, half carry and overflow flags DEC r8 */
 
 #if BIG_FLAGS_ARRAY
-static UINT8 *SZHVC_add = 0;
-static UINT8 *SZHVC_sub = 0;
+static AO_THREAD_LOCAL UINT8 *SZHVC_add = 0;
+static AO_THREAD_LOCAL UINT8 *SZHVC_sub = 0;
 #endif
 
 static const UINT8 cc_op[0x100] = {
@@ -4169,6 +4169,7 @@ int z80_execute(int cycles)
 		_PPC = _PCD;
 		CALL_MAME_DEBUG;
 		_Z80_R++;
+		PROFILE_INSN();
 		EXEC_INLINE(op,ROP());
 	} while( z80_ICount > 0 );
 
@@ -4212,6 +4213,16 @@ void z80_set_context (void *src)
 	change_pc16(_PCD);
 }
 
+/****************************************************************************
+ * Save or restore all registers as part of an engine snapshot
+ ****************************************************************************/
+void z80_state (state_t *state)
+{
+	STATE_VAR(state, Z80);
+	STATE_VAR(state, z80_ICount);
+	STATE_VAR(state, after_EI);
+}
+
 /****************************************************************************
  * Get a pointer to a cycle count table
  ****************************************************************************/
@@ -4406,8 +4417,8 @@ void z80_set_irq_callback(int (*callback)(int))
  ****************************************************************************/
 const char *z80_info(void *context, int regnum)
 {
-	static char buffer[32][47+1];
-	static int which = 0;
+	static AO_THREAD_LOCAL char buffer[32][47+1];
+	static AO_THREAD_LOCAL int which = 0;
 	Z80_Regs *r = context;
 
 	which = (which+1) % 32;
@@ -20,7 +20,7 @@ enum {
 	Z80_TABLE_ex	/* cycles counts for taken jr/jp/call and interrupt latency (rst opcodes) */
 };
 
-extern int z80_ICount;              /* T-state count                        */
+extern AO_THREAD_LOCAL int z80_ICount; /* T-state count                        */
 
 extern void z80_init(void);
 extern void z80_reset (void *param);
@@ -29,6 +29,7 @@ extern int z80_execute(int cycles);
 extern void z80_burn(int cycles);
 extern unsigned z80_get_context (void *dst);
 extern void z80_set_context (void *src);
+extern void z80_state (state_t *state);
 extern const void *z80_get_cycle_table (int which);
 extern void z80_set_cycle_table (int which, void *new_tbl);
 extern unsigned z80_get_reg (int regnum);
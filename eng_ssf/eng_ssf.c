@@ -72,23 +72,33 @@ Sega driver commands:
 #include "ao.h"
 #include "eng_protos.h"
 #include "corlett.h"
+#include "utils.h"
 #include "sat_hw.h"
 #include "scsp.h"
 #include "m68k.h"
 
-static corlett_t	c = {0};
+// 68000 cycles per sample, at 11.3 MHz
+#define SSF_SAMPLE_CYCLES	((11300000 / 60) / AUDIO_FRAME_SAMPLES)
 
-int ssf_lib(int libnum, uint8 *lib, uint64 size, corlett_t *c)
+static AO_THREAD_LOCAL corlett_t	c = {0};
+
+int ssf_lib(int libnum, corlett_stream_t *program, corlett_t *c)
 {
-	// patch the file into ram
-	uint32 offset = lib[0] | lib[1]<<8 | lib[2]<<16 | lib[3]<<24;
+	// decompress the file straight into ram
+	uint8 header[4];
+	uint32 offset;
+
+	if (corlett_stream_read(program, header, 4) < 4)
+	{
+		return AO_SUCCESS;
+	}
+	offset = header[0] | header[1]<<8 | header[2]<<16 | header[3]<<24;
 
 	// guard against invalid data
-	if ((offset + (size-4)) > 0x7ffff)
+	if (offset < 0x80000)
 	{
-		size = 0x80000-offset+4;
+		corlett_stream_read(program, &sat_ram[offset], 0x80000 - offset);
 	}
-	memcpy(&sat_ram[offset], lib+4, size-4);
 
 	return AO_SUCCESS;
 }
@@ -98,10 +108,13 @@ int32 ssf_start(uint8 *buffer, uint32 length)
 	int i;
 
 	// clear Saturn work RAM before we start scribbling in it
-	memset(sat_ram, 0, 512*1024);
+	if (sat_hw_alloc() != AO_SUCCESS)
+	{
+		return AO_FAIL;
+	}
 
 	// Decode the current SSF
-	if (corlett_decode(buffer, length, &c, ssf_lib) != AO_SUCCESS)
+	if (corlett_decode_stream(buffer, length, &c, ssf_lib) != AO_SUCCESS)
 	{
 		return AO_FAIL;
 	}
@@ -111,13 +124,13 @@ int32 ssf_start(uint8 *buffer, uint32 length)
 		FILE *f;
 
 		f = ao_fopen("satram.bin", "wb");
-		fwrite(sat_ram, 512*1024, 1, f);
+		fwrite(sat_ram, SAT_RAM_SIZE, 1, f);
 		fclose(f);
 	}
 	#endif
 
 	// now flip everything (this makes sense because he's using starscream)
-	for (i = 0; i < 512*1024; i+=2)
+	for (i = 0; i < SAT_RAM_SIZE; i+=2)
 	{
 		uint8 temp;
 
@@ -131,12 +144,44 @@ int32 ssf_start(uint8 *buffer, uint32 length)
 	return AO_SUCCESS;
 }
 
+int32 ssf_render(stereo_sample_t *buf, uint32 count)
+{
+	uint32 i;
+	for(i = 0; i < count; i++)
+	{
+		PROFILE_ENTER(PROFILE_CPU);
+		m68k_execute(SSF_SAMPLE_CYCLES);
+		PROFILE_LEAVE();
+		PROFILE_ENTER(PROFILE_CHIP);
+		SCSP_Update(NULL, NULL, &buf[i]);
+		PROFILE_LEAVE();
+	}
+	corlett_render_fade(buf, count);
+
+	return AO_SUCCESS;
+}
+
 int32 ssf_sample(stereo_sample_t *sample)
 {
-	m68k_execute((11300000/60)/735);
-	SCSP_Update(NULL, NULL, sample);
-	corlett_sample_fade(sample);
+	return ssf_render(sample, 1);
+}
 
+int32 ssf_skip(uint32 count)
+{
+	uint32 i;
+	for(i = 0; i < count; i++)
+	{
+		m68k_execute(SSF_SAMPLE_CYCLES);
+		SCSP_Skip();
+	}
+	corlett_skip(count);
+	return AO_SUCCESS;
+}
+
+int32 ssf_state(state_t *state)
+{
+	sat_hw_state(state);
+	corlett_state(state);
 	return AO_SUCCESS;
 }
 
@@ -147,6 +192,8 @@ int32 ssf_frame(void)
 
 int32 ssf_stop(void)
 {
+	sat_hw_free();
+	corlett_free(&c);
 	return AO_SUCCESS;
 }
 
@@ -157,6 +204,9 @@ int32 ssf_command(int32 command, int32 parameter)
 		case COMMAND_RESTART:
 			return AO_SUCCESS;
 
+		case COMMAND_SEEK:
+			return ssf_skip(parameter);
+
 	}
 	return AO_FAIL;
 }
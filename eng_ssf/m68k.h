@@ -305,6 +305,9 @@ unsigned int m68k_get_context(void* dst);
 /* set the current cpu context */
 void m68k_set_context(void* dst);
 
+/* Save or restore the current cpu context as part of an AOSDK snapshot */
+void m68k_state(state_t *state);
+
 /* Register the CPU state information */
 void m68k_state_register(const char *type);
 
@@ -67,7 +67,7 @@
  * and m68k_read_pcrelative_xx() for PC-relative addressing.
  * If off, all read requests from the CPU will be redirected to m68k_read_xx()
  */
-#define M68K_SEPARATE_READS         OPT_OFF
+#define M68K_SEPARATE_READS         OPT_ON
 
 /* If ON, the CPU will call m68k_write_32_pd() when it executes move.l with a
  * predecrement destination EA mode instead of m68k_write_32().
@@ -174,6 +174,43 @@
 #endif /* M68K_COMPILE_FOR_MAME */
 
 
+/* ======================================================================== */
+/* ============================ SATURN SOUND RAM ========================== */
+/* ======================================================================== */
+
+/* The program always runs from sound RAM, so immediate and PC-relative reads
+ * go straight to it, and only fall back on the regular handlers outside of
+ * it.
+ */
+#if M68K_SEPARATE_READS
+#include "sat_hw.h"
+
+INLINE unsigned int m68k_read_immediate_16(unsigned int address)
+{
+	if (address < SAT_RAM_SIZE)
+		return mem_readword_swap((unsigned short *)(sat_ram+address));
+	return m68k_read_memory_16(address);
+}
+
+INLINE unsigned int m68k_read_immediate_32(unsigned int address)
+{
+	if (address < (SAT_RAM_SIZE - 3))
+		return mem_readlong_swap((unsigned int *)(sat_ram+address));
+	return m68k_read_memory_32(address);
+}
+
+INLINE unsigned int m68k_read_pcrelative_8(unsigned int address)
+{
+	if (address < SAT_RAM_SIZE)
+		return sat_ram[address^1];
+	return m68k_read_memory_8(address);
+}
+
+#define m68k_read_pcrelative_16(A) m68k_read_immediate_16(A)
+#define m68k_read_pcrelative_32(A) m68k_read_immediate_32(A)
+#endif /* M68K_SEPARATE_READS */
+
+
 /* ======================================================================== */
 /* ============================== END OF FILE ============================= */
 /* ======================================================================== */
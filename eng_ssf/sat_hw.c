@@ -29,13 +29,15 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "ao.h"
 #include "scsp.h"
 #include "sat_hw.h"
 #include "m68k.h"
 
-uint8 sat_ram[512*1024];
+AO_THREAD_LOCAL uint8 *sat_ram;
 
 static void scsp_irq(int irq)
 {
@@ -50,22 +52,54 @@ static void scsp_irq(int irq)
 #define MIXER(level,pan) ((level & 0xff) | ((pan & 0x03) << 8))
 #define YM3012_VOL(LVol,LPan,RVol,RPan) (MIXER(LVol,LPan)|(MIXER(RVol,RPan) << 16))
 
-static struct SCSPinterface scsp_interface =
+static const struct SCSPinterface scsp_interface =
 {
 	1,
-	{ sat_ram, },
+	{ NULL, },
 	{ YM3012_VOL(100, MIXER_PAN_LEFT, 100, MIXER_PAN_RIGHT) },
 	{ scsp_irq, },
 };
 
+// Allocates zeroed Saturn sound RAM for the current thread.
+int sat_hw_alloc(void)
+{
+	if (!sat_ram)
+	{
+		sat_ram = malloc(SAT_RAM_SIZE);
+		if (!sat_ram)
+		{
+			printf("ERROR: could not allocate %d bytes of memory\n", SAT_RAM_SIZE);
+			return AO_FAIL;
+		}
+	}
+	memset(sat_ram, 0, SAT_RAM_SIZE);
+	return AO_SUCCESS;
+}
+
 void sat_hw_init(void)
 {
+	struct SCSPinterface intf = scsp_interface;
+
 	m68k_init();
 	m68k_set_cpu_type(M68K_CPU_TYPE_68000);
 	m68k_pulse_reset();
 
-	scsp_interface.region[0] = sat_ram;
-	scsp_start(&scsp_interface);
+	intf.region[0] = sat_ram;
+	scsp_start(&intf);
+}
+
+void sat_hw_free(void)
+{
+	scsp_stop();
+	free(sat_ram);
+	sat_ram = NULL;
+}
+
+void sat_hw_state(state_t *state)
+{
+	state_data(state, sat_ram, SAT_RAM_SIZE);
+	m68k_state(state);
+	SCSP_State(state);
 }
 
 /* M68k memory handlers */
@@ -105,9 +139,9 @@ unsigned int m68k_read_memory_16(unsigned int address)
 
 unsigned int m68k_read_memory_32(unsigned int address)
 {
-	if (address < 0x80000)
+	if (address < (SAT_RAM_SIZE - 3))
 	{
-		return sat_ram[address+2] | sat_ram[address+3]<<8 | sat_ram[address]<<16 | sat_ram[address+1]<<24;
+		return mem_readlong_swap((unsigned int *)(sat_ram+address));
 	}
 
 	printf("R32 @ %x\n", address);
@@ -1,11 +1,17 @@
 #ifndef _SAT_HW_H_
 #define _SAT_HW_H_
 
-extern uint8 sat_ram[512*1024];
+#define SAT_RAM_SIZE (512*1024)
 
+extern AO_THREAD_LOCAL uint8 *sat_ram;
+
+int sat_hw_alloc(void);
 void sat_hw_init(void);
+void sat_hw_free(void);
+// Saves or restores the RAM, CPU and SCSP state.
+void sat_hw_state(state_t *state);
 
-#if !LSB_FIRST
+#if !LSB_FIRST	// big endian
 INLINE unsigned short mem_readword_swap(unsigned short *addr)
 {
 	return ((*addr&0x00ff)<<8)|((*addr&0xff00)>>8);
@@ -15,7 +21,12 @@ INLINE void mem_writeword_swap(unsigned short *addr, unsigned short value)
 {
 	*addr = ((value&0x00ff)<<8)|((value&0xff00)>>8);
 }
-#else	// big endian
+
+INLINE unsigned int mem_readlong_swap(unsigned int *addr)
+{
+	return ((*addr&0x00ff00ff)<<8)|((*addr&0xff00ff00)>>8);
+}
+#else	// little endian
 INLINE unsigned short mem_readword_swap(unsigned short *addr)
 {
 	unsigned long retval;
@@ -29,6 +40,13 @@ INLINE void mem_writeword_swap(unsigned short *addr, unsigned short value)
 {
 	*addr = value;
 }
+
+// Both words are stored in host order, so only the halves need swapping.
+INLINE unsigned int mem_readlong_swap(unsigned int *addr)
+{
+	unsigned int retval = *addr;
+	return (retval << 16) | (retval >> 16);
+}
 #endif
 
 
@@ -22,6 +22,7 @@
 */
 
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 #include "ao.h"
 #include "cpuintrf.h"
@@ -54,7 +55,8 @@ static const double DRTimes[64]={100000/*infinity*/,100000/*infinity*/,118200.0,
 
 #define USEDSP
 
-struct _SCSP SCSP;
+// Allocated on the heap, since it's more than 512 KB in size.
+static AO_THREAD_LOCAL struct _SCSP *SCSP_chip;
 
 static void dma_scsp(struct _SCSP *SCSP); 		/*SCSP DMA transfer function*/
 #define	scsp_dgate		scsp_regs[0x16/2] & 0x4000
@@ -64,7 +66,7 @@ static void dma_scsp(struct _SCSP *SCSP); 		/*SCSP DMA transfer function*/
 
 static const float SDLT[8]={-1000000.0,-36.0,-30.0,-24.0,-18.0,-12.0,-6.0,0.0};
 
-static signed short *RBUFDST;	//this points to where the sample will be stored in the RingBuf
+static AO_THREAD_LOCAL signed short *RBUFDST;	//this points to where the sample will be stored in the RingBuf
 
 static unsigned char DecodeSCI(struct _SCSP *SCSP,unsigned char irq)
 {
@@ -261,6 +263,20 @@ static void SCSP_StartSlot(struct _SCSP *SCSP, struct _SLOT *slot)
 #endif
 }
 
+// Reports a key-on to the song end detection. Leaves out the KEYONEX bit,
+// which is only set on the slot whose register write triggered the key-on,
+// and the mixer registers, which drivers tend to only set after the key-on.
+static void SCSP_SongEndKeyOn(struct _SLOT *slot)
+{
+	UINT16 regs[0x10];
+
+	memcpy(regs, slot->udata.data, sizeof(regs));
+	regs[0] &= ~0x1000;
+	regs[0xA] = 0;
+	regs[0xB] = 0;
+	songend_keyon(regs, sizeof(regs));
+}
+
 static void SCSP_StopSlot(struct _SLOT *slot,int keyoff)
 {
 	if(keyoff /*&& slot->EG.state!=RELEASE*/)
@@ -276,6 +292,30 @@ static void SCSP_StopSlot(struct _SLOT *slot,int keyoff)
 
 #define log_base_2(n) (log((float) n)/log((float) 2))
 
+// Tables that don't depend on any chip state, shared by all threads
+static ao_once_t tables_once;
+
+static void SCSP_InitTables(void)
+{
+	int i;
+
+	for(i=0; i<0x400; ++i)
+	{
+		float fcent=(double) 1200.0*log_base_2((double)(((double) 1024.0+(double)i)/(double)1024.0));
+		fcent=(double) 44100.0*pow(2.0,fcent/1200.0);
+		FNS_Table[i]=(float) (1<<SHIFT) *fcent;
+	}
+
+	for(i=0; i<0x400; ++i)
+	{
+		float envDB=((float)(3*(i-0x3ff)))/32.0;
+		float scale=(float)(1<<SHIFT);
+		EG_TABLE[i]=(INT32)(pow(10.0,envDB/20.0)*scale);
+	}
+
+	LFO_Init();
+}
+
 static void SCSP_Init(struct _SCSP *SCSP, const struct SCSPinterface *intf)
 {
 	int i=0;
@@ -307,20 +347,6 @@ static void SCSP_Init(struct _SCSP *SCSP, const struct SCSPinterface *intf)
 		}
 	}
 
-	for(i=0; i<0x400; ++i)
-	{
-		float fcent=(double) 1200.0*log_base_2((double)(((double) 1024.0+(double)i)/(double)1024.0));
-		fcent=(double) 44100.0*pow(2.0,fcent/1200.0);
-		FNS_Table[i]=(float) (1<<SHIFT) *fcent;
-	}
-
-	for(i=0; i<0x400; ++i)
-	{
-		float envDB=((float)(3*(i-0x3ff)))/32.0;
-		float scale=(float)(1<<SHIFT);
-		EG_TABLE[i]=(INT32)(pow(10.0,envDB/20.0)*scale);
-	}
-
 	for(i=0; i<0x10000; ++i)
 	{
 		int iTL =(i>>0x0)&0xff;
@@ -401,7 +427,7 @@ static void SCSP_Init(struct _SCSP *SCSP, const struct SCSPinterface *intf)
 		SCSP->Slots[i].base=NULL;
 	}
 
-	LFO_Init();
+	ao_once(&tables_once, SCSP_InitTables);
 
 	// no "pend"
 	SCSP[0].udata.data[0x20/2] = 0;
@@ -427,6 +453,7 @@ static void SCSP_UpdateSlotReg(struct _SCSP *SCSP,int s,int r)
 					{
 						if(KEYONB(s2) && s2->EG.state==RELEASE/*&& !s2->active*/)
 						{
+							SCSP_SongEndKeyOn(s2);
 							SCSP_StartSlot(SCSP, s2);
 						}
 						if(!KEYONB(s2) /*&& s2->active*/)
@@ -838,13 +865,17 @@ INLINE INT32 SCSP_UpdateSlot(struct _SCSP *SCSP, struct _SLOT *slot)
 	return sample;
 }
 
-static void SCSP_DoMasterSample(struct _SCSP *SCSP, stereo_sample_t *sample)
+// Passing NULL for [out] only skips the direct and DSP output mix. Slots
+// still have to be fully updated, since their output is fed back into the FM
+// ring buffer and into the effect DSP.
+INLINE void SCSP_DoMasterSample(struct _SCSP *SCSP, stereo_sample_t *out)
 {
 	int sl, i;
 
 	INT32 smpl, smpr;
 
 	smpl = smpr = 0;
+	songend_clock++;
 
 	for(sl=0; sl<32; ++sl)
 	{
@@ -863,10 +894,13 @@ static void SCSP_DoMasterSample(struct _SCSP *SCSP, stereo_sample_t *sample)
 
 			Enc=((TL(slot))<<0x0)|((IMXL(slot))<<0xd);
 			SCSPDSP_SetSample(&SCSP->DSP,(sample*SCSP->LPANTABLE[Enc])>>(SHIFT-2),ISEL(slot),IMXL(slot));
-			Enc=((TL(slot))<<0x0)|((DIPAN(slot))<<0x8)|((DISDL(slot))<<0xd);
+			if(out)
 			{
-				smpl+=(sample*SCSP->LPANTABLE[Enc])>>SHIFT;
-				smpr+=(sample*SCSP->RPANTABLE[Enc])>>SHIFT;
+				Enc=((TL(slot))<<0x0)|((DIPAN(slot))<<0x8)|((DISDL(slot))<<0xd);
+				{
+					smpl+=(sample*SCSP->LPANTABLE[Enc])>>SHIFT;
+					smpr+=(sample*SCSP->RPANTABLE[Enc])>>SHIFT;
+				}
 			}
 		}
 
@@ -881,21 +915,26 @@ static void SCSP_DoMasterSample(struct _SCSP *SCSP, stereo_sample_t *sample)
 		#endif
 	}
 
+	PROFILE_ENTER(PROFILE_DSP);
 	SCSPDSP_Step(&SCSP->DSP);
+	PROFILE_LEAVE();
 
-	for(i=0; i<16; ++i)
+	if(out)
 	{
-		struct _SLOT *slot=SCSP->Slots+i;
-		if(EFSDL(slot))
+		for(i=0; i<16; ++i)
 		{
-			unsigned short Enc=((EFPAN(slot))<<0x8)|((EFSDL(slot))<<0xd);
-			smpl+=(SCSP->DSP.EFREG[i]*SCSP->LPANTABLE[Enc])>>SHIFT;
-			smpr+=(SCSP->DSP.EFREG[i]*SCSP->RPANTABLE[Enc])>>SHIFT;
+			struct _SLOT *slot=SCSP->Slots+i;
+			if(EFSDL(slot))
+			{
+				unsigned short Enc=((EFPAN(slot))<<0x8)|((EFSDL(slot))<<0xd);
+				smpl+=(SCSP->DSP.EFREG[i]*SCSP->LPANTABLE[Enc])>>SHIFT;
+				smpr+=(SCSP->DSP.EFREG[i]*SCSP->RPANTABLE[Enc])>>SHIFT;
+			}
 		}
-	}
 
-	sample->l = ICLIP16(smpl>>2);
-	sample->r = ICLIP16(smpr>>2);
+		out->l = ICLIP16(smpl>>2);
+		out->r = ICLIP16(smpr>>2);
+	}
 
 	SCSP_TimersAddTicks(SCSP, 1);
 	CheckPendingIRQ(SCSP);
@@ -903,7 +942,7 @@ static void SCSP_DoMasterSample(struct _SCSP *SCSP, stereo_sample_t *sample)
 
 static void dma_scsp(struct _SCSP *SCSP)
 {
-	static UINT16 tmp_dma[3], *scsp_regs;
+	static AO_THREAD_LOCAL UINT16 tmp_dma[3], *scsp_regs;
 
 	scsp_regs = (UINT16 *)SCSP->udata.datab;
 
@@ -960,36 +999,67 @@ int SCSP_IRQCB(void *param)
 
 void SCSP_Update(void *param, INT16 **inputs, stereo_sample_t *sample)
 {
-	SCSP_DoMasterSample(&SCSP, sample);
+	SCSP_DoMasterSample(SCSP_chip, sample);
+}
+
+void SCSP_Skip(void)
+{
+	SCSP_DoMasterSample(SCSP_chip, NULL);
+}
+
+void SCSP_State(state_t *state)
+{
+	// The pan tables are constant, and take up most of the structure.
+	uint8 *chip = (uint8 *)SCSP_chip;
+	size_t tables_start = offsetof(struct _SCSP, LPANTABLE);
+	size_t tables_end = offsetof(struct _SCSP, TimPris);
+
+	state_data(state, chip, tables_start);
+	state_data(state, chip + tables_end, sizeof(struct _SCSP) - tables_end);
+	STATE_VAR(state, RBUFDST);
 }
 
 void *scsp_start(const void *config)
 {
 	const struct SCSPinterface *intf = config;
 
-	memset(&SCSP, 0, sizeof(struct _SCSP));
+	if (!SCSP_chip)
+	{
+		SCSP_chip = malloc(sizeof(struct _SCSP));
+		if (!SCSP_chip)
+		{
+			return NULL;
+		}
+	}
+	memset(SCSP_chip, 0, sizeof(struct _SCSP));
 
 	// init the emulation
-	SCSP_Init(&SCSP, intf);
+	SCSP_Init(SCSP_chip, intf);
 
 	// set up the IRQ callbacks
-	SCSP.Int68kCB = intf->irq_callback[0];
-	// SCSP.stream = stream_create(0, 2, 44100, SCSP, SCSP_Update);
+	SCSP_chip->Int68kCB = intf->irq_callback[0];
+	// SCSP_chip->stream = stream_create(0, 2, 44100, SCSP, SCSP_Update);
 
-	return &SCSP;
+	return SCSP_chip;
+}
+
+void scsp_stop(void)
+{
+	free(SCSP_chip);
+	SCSP_chip = NULL;
 }
 
 
 void SCSP_set_ram_base(int which, void *base)
 {
-	SCSP.SCSPRAM = base;
-	SCSP.DSP.SCSPRAM = base;
+	SCSP_chip->SCSPRAM = base;
+	SCSP_chip->DSP.SCSPRAM = base;
 }
 
 
 READ16_HANDLER( SCSP_0_r )
 {
-	return SCSP_r16(&SCSP, offset*2);
+	return SCSP_r16(SCSP_chip, offset*2);
 }
 
 extern UINT32* stv_scu;
@@ -998,11 +1068,11 @@ WRITE16_HANDLER( SCSP_0_w )
 {
 	UINT16 tmp, *scsp_regs;
 
-	tmp = SCSP_r16(&SCSP, offset*2);
+	tmp = SCSP_r16(SCSP_chip, offset*2);
 	COMBINE_DATA(&tmp);
-	SCSP_w16(&SCSP,offset*2, tmp);
+	SCSP_w16(SCSP_chip,offset*2, tmp);
 
-	scsp_regs = (UINT16 *)SCSP.udata.datab;
+	scsp_regs = (UINT16 *)SCSP_chip->udata.datab;
 
 	switch(offset*2)
 	{
@@ -1010,14 +1080,14 @@ WRITE16_HANDLER( SCSP_0_w )
 		case 0x412:
 			/*DMEA [15:1]*/
 			/*Sound memory address*/
-			SCSP.scsp_dmea = (((scsp_regs[0x14/2] & 0xf000)>>12)*0x10000) | (scsp_regs[0x12/2] & 0xfffe);
+			SCSP_chip->scsp_dmea = (((scsp_regs[0x14/2] & 0xf000)>>12)*0x10000) | (scsp_regs[0x12/2] & 0xfffe);
 			break;
 		case 0x414:
 			/*DMEA [19:16]*/
-			SCSP.scsp_dmea = (((scsp_regs[0x14/2] & 0xf000)>>12)*0x10000) | (scsp_regs[0x12/2] & 0xfffe);
+			SCSP_chip->scsp_dmea = (((scsp_regs[0x14/2] & 0xf000)>>12)*0x10000) | (scsp_regs[0x12/2] & 0xfffe);
 			/*DRGA [11:1]*/
 			/*Register memory address*/
-			SCSP.scsp_drga = scsp_regs[0x14/2] & 0x0ffe;
+			SCSP_chip->scsp_drga = scsp_regs[0x14/2] & 0x0ffe;
 			break;
 		case 0x416:
 			/*DGATE[14]*/
@@ -1028,10 +1098,10 @@ WRITE16_HANDLER( SCSP_0_w )
 			/*starting bit*/
 			/*DTLG[11:1]*/
 			/*size of transfer*/
-			SCSP.scsp_dtlg = scsp_regs[0x16/2] & 0x0ffe;
+			SCSP_chip->scsp_dtlg = scsp_regs[0x16/2] & 0x0ffe;
 			if(scsp_dexe)
 			{
-				dma_scsp(&SCSP);
+				dma_scsp(SCSP_chip);
 				scsp_regs[0x16/2]^=0x1000;//disable starting bit
 			}
 			break;
@@ -1054,14 +1124,14 @@ WRITE16_HANDLER( SCSP_0_w )
 
 WRITE16_HANDLER( SCSP_MidiIn )
 {
-	SCSP.MidiStack[SCSP.MidiW++]=data;
-	SCSP.MidiW &= 15;
+	SCSP_chip->MidiStack[SCSP_chip->MidiW++]=data;
+	SCSP_chip->MidiW &= 15;
 }
 
 READ16_HANDLER( SCSP_MidiOutR )
 {
-	unsigned char val = SCSP.MidiStack[SCSP.MidiR++];
-	SCSP.MidiR&=7;
+	unsigned char val = SCSP_chip->MidiStack[SCSP_chip->MidiR++];
+	SCSP_chip->MidiR&=7;
 	return val;
 }
 
@@ -217,7 +217,6 @@ struct _SCSP
 	struct _SCSPDSP DSP;
 };
 
-extern struct _SCSP SCSP;
 
 struct SCSPinterface
 {
@@ -228,7 +227,12 @@ struct SCSPinterface
 };
 
 void *scsp_start(const void *config);
+void scsp_stop(void);
 void SCSP_Update(void *param, INT16 **inputs, stereo_sample_t *sample);
+// Advances the chip by one sample without generating any output.
+void SCSP_Skip(void);
+// Saves or restores the chip state.
+void SCSP_State(state_t *state);
 
 #define READ16_HANDLER(name)	data16_t name(offs_t offset, data16_t mem_mask)
 #define WRITE16_HANDLER(name)	void     name(offs_t offset, data16_t data, data16_t mem_mask)
@@ -28,41 +28,48 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <zlib.h>
 
 #include "argparse/argparse.h"
 #include "ao.h"
+#include "corlett.h"
 #include "debug.h"
 #include "eng_protos.h"
+#include "eng_qsf/qsound.h"
 #include "m1sdr.h"
 #include "mididump.h"
+#include "resample.h"
+#include "utils.h"
 #include "wavedump.h"
 
 /* file types */
 static uint32 type;
 static wavedump_t song_dump;
-volatile ao_bool ao_song_done;
+AO_THREAD_LOCAL volatile ao_bool ao_song_done;
 
 static struct
 {
 	uint32 sig;
 	char *name;
 	int32 (*start)(uint8 *, uint32);
-	int32 (*sample)(stereo_sample_t *);
+	int32 (*render)(stereo_sample_t *, uint32);
 	int32 (*frame)(void);
 	int32 (*stop)(void);
 	int32 (*command)(int32, int32);
+	int32 (*state)(state_t *);
 	uint32 rate;
+	uint32 sample_rate;
 	int32 (*fillinfo)(ao_display_info *);
 } types[] =
 {
-	{ 0x50534641, "Capcom QSound (.qsf)", qsf_start, qsf_sample, qsf_frame, qsf_stop, qsf_command, 60, qsf_fill_info },
-	{ 0x50534611, "Sega Saturn (.ssf)", ssf_start, ssf_sample, ssf_frame, ssf_stop, ssf_command, 60, ssf_fill_info },
-	{ 0x50534601, "Sony PlayStation (.psf)", psf_start, psf_sample, psf_frame, psf_stop, psf_command, 60, psf_fill_info },
-	{ 0x53505500, "Sony PlayStation (.spu)", spu_start, spu_sample, spu_frame, spu_stop, spu_command, 60, spu_fill_info },
-	{ 0x50534602, "Sony PlayStation 2 (.psf2)", psf2_start, psf2_sample, psf2_frame, psf2_stop, psf2_command, 60, psf2_fill_info },
-	{ 0x50534612, "Sega Dreamcast (.dsf)", dsf_start, dsf_sample, dsf_frame, dsf_stop, dsf_command, 60, dsf_fill_info },
-
-	{ 0xffffffff, "", NULL, NULL, NULL, NULL, NULL, 0, NULL }
+	{ 0x50534641, "Capcom QSound (.qsf)", qsf_start, qsf_render, qsf_frame, qsf_stop, qsf_command, qsf_state, 60, QSOUND_RATE, qsf_fill_info },
+	{ 0x50534611, "Sega Saturn (.ssf)", ssf_start, ssf_render, ssf_frame, ssf_stop, ssf_command, ssf_state, 60, AUDIO_RATE, ssf_fill_info },
+	{ 0x50534601, "Sony PlayStation (.psf)", psf_start, psf_render, psf_frame, psf_stop, psf_command, psf_state, 60, AUDIO_RATE, psf_fill_info },
+	{ 0x53505500, "Sony PlayStation (.spu)", spu_start, spu_render, spu_frame, spu_stop, spu_command, spu_state, 60, AUDIO_RATE, spu_fill_info },
+	{ 0x50534602, "Sony PlayStation 2 (.psf2)", psf2_start, psf2_render, psf2_frame, psf2_stop, psf2_command, psf2_state, 60, AUDIO_RATE, psf2_fill_info },
+	{ 0x50534612, "Sega Dreamcast (.dsf)", dsf_start, dsf_render, dsf_frame, dsf_stop, dsf_command, dsf_state, 60, AUDIO_RATE, dsf_fill_info },
+
+	{ 0xffffffff, "", NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, NULL }
 };
 
 #ifndef NOGUI
@@ -77,22 +84,17 @@ static debug_hw_t *debug[] = {
 #endif
 
 /* redirect stubs to interface the Z80 core to the QSF engine */
-uint8 memory_read(uint16 addr)
+uint8 memory_read_io(uint16 addr)
 {
 	return qsf_memory_read(addr);
 }
 
-uint8 memory_readop(uint16 addr)
-{
-	return memory_read(addr);
-}
-
 uint8 memory_readport(uint16 addr)
 {
 	return qsf_memory_readport(addr);
 }
 
-void memory_write(uint16 addr, uint8 byte)
+void memory_write_io(uint16 addr, uint8 byte)
 {
 	qsf_memory_write(addr, byte);
 }
@@ -102,58 +104,196 @@ void memory_writeport(uint16 addr, uint8 byte)
 	qsf_memory_writeport(addr, byte);
 }
 
-/* ao_get_lib: called to load secondary files */
+// Song that is currently being rendered on this thread. Libraries are looked
+// up relative to its directory first, and then relative to the current one.
+static AO_THREAD_LOCAL const char *song_fn;
+
+static FILE* lib_open(const char *filename)
+{
+	FILE *ret = NULL;
+	const char *sep = song_fn ? strrchr(song_fn, '/') : NULL;
+	#ifdef WIN32
+	const char *sep_win = song_fn ? strrchr(song_fn, '\\') : NULL;
+	if (sep_win > sep)
+	{
+		sep = sep_win;
+	}
+	#endif
+
+	if (sep)
+	{
+		size_t dir_len = (sep - song_fn) + 1;
+		char *path = malloc(dir_len + strlen(filename) + 1);
+		if (path)
+		{
+			memcpy(path, song_fn, dir_len);
+			strcpy(path + dir_len, filename);
+			ret = ao_fopen(path, "rb");
+			free(path);
+		}
+	}
+	return ret ? ret : ao_fopen(filename, "rb");
+}
+
+/* file_read: maps all of [file] into memory, and closes it */
+static int file_read(FILE *file, uint8 **buffer, uint32 *length)
+{
+	uint64 size;
+	uint8 *filebuf = ao_file_map(file, &size);
+
+	if (!filebuf)
+	{
+		printf("ERROR: could not map file into memory\n");
+		return AO_FAIL;
+	}
+	if (size > 0xffffffff)
+	{
+		ao_file_unmap(filebuf, size);
+		printf("ERROR: file is larger than 4 GB\n");
+		return AO_FAIL;
+	}
+
+	*buffer = filebuf;
+	*length = (uint32)size;
+
+	return AO_SUCCESS;
+}
+
+/* ao_get_lib: called to load secondary files, which are released with ao_file_unmap() */
 int ao_get_lib(const char *filename, uint8 **buffer, uint64 *length)
 {
-	uint8 *filebuf;
-	uint32 size;
 	FILE *auxfile;
 
-	auxfile = ao_fopen(filename, "rb");
+	auxfile = lib_open(filename);
 	if (!auxfile)
 	{
 		printf("Unable to find auxiliary file %s\n", filename);
 		return AO_FAIL;
 	}
 
-	fseek(auxfile, 0, SEEK_END);
-	size = ftell(auxfile);
-	fseek(auxfile, 0, SEEK_SET);
+	*buffer = ao_file_map(auxfile, length);
+	if (!*buffer)
+	{
+		printf("Unable to map auxiliary file %s\n", filename);
+		return AO_FAIL;
+	}
 
-	filebuf = malloc(size);
+	return AO_SUCCESS;
+}
 
-	if (!filebuf)
+/* type_identify: returns the types[] index for the given file, or -1 if it's unknown */
+static int type_identify(const uint8 *buffer, uint32 size)
+{
+	int i;
+	uint32 filesig;
+
+	if (size < 4)
 	{
-		fclose(auxfile);
-		printf("ERROR: could not allocate %d bytes of memory\n", size);
-		return AO_FAIL;
+		return -1;
+	}
+	filesig = buffer[0]<<24 | buffer[1]<<16 | buffer[2]<<8 | buffer[3];
+	for (i = 0; types[i].sig != 0xffffffff; i++)
+	{
+		if (filesig == types[i].sig)
+		{
+			return i;
+		}
 	}
+	return -1;
+}
 
-	fread(filebuf, size, 1, auxfile);
-	fclose(auxfile);
+// All engines render at AUDIO_RATE or below.
+#define FRAME_SAMPLES_MAX AUDIO_FRAME_SAMPLES
 
-	*buffer = filebuf;
-	*length = (uint64)size;
+// Range of the --rate option
+#define OUTPUT_RATE_MIN 8000
+#define OUTPUT_RATE_MAX 192000
 
-	return AO_SUCCESS;
+// Returns the number of samples in one frame of [song_type], at the native
+// rate of its engine.
+static uint32 frame_samples(int song_type)
+{
+	return types[song_type].sample_rate / types[song_type].rate;
+}
+
+// Converts the [*count] samples in [buf] to the output rate if [resampler] is
+// not NULL, and updates [*count] accordingly. Returns the converted samples,
+// or NULL if we ran out of memory.
+static const stereo_sample_t* frame_resample(
+	resampler_t *resampler, const stereo_sample_t *buf, uint32 *count
+)
+{
+	if (resampler)
+	{
+		PROFILE_ENTER(PROFILE_RESAMPLE);
+		buf = resampler_process(resampler, buf, *count, count);
+		PROFILE_LEAVE();
+	}
+	return buf;
 }
 
+static uint32 song_samples;
+static songend_t song_end;
+
+// Only used if the output rate differs from the native rate of the engine
+static resampler_t song_resampler;
+static ao_bool song_resampling;
+
+// Output samples that didn't fit into the last buffer passed to do_frame()
+static stereo_sample_t *song_fifo;
+static uint32 song_fifo_len;
+static uint32 song_fifo_capacity;
+
 static void do_frame(unsigned long sample_count, stereo_sample_t *buffer)
 {
-	unsigned long i;
-	stereo_sample_t *p = buffer;
-	for (i = 0; i < sample_count; i++)
+	// Render as many whole frames as necessary to fill [buffer], since the
+	// playback backend runs at the output rate.
+	while (song_fifo_len < sample_count)
 	{
-		(*types[type].sample)(p);
-		p++;
+		stereo_sample_t frame[FRAME_SAMPLES_MAX];
+		uint32 count = frame_samples(type);
+		const stereo_sample_t *out;
+
+		(*types[type].render)(frame, count);
+		(*types[type].frame)();
+		songend_check(&song_end, frame, count);
+		song_samples += count;
+
+		out = frame_resample(song_resampling ? &song_resampler : NULL, frame, &count);
+		if (out && (song_fifo_len + count) > song_fifo_capacity)
+		{
+			uint32 capacity = song_fifo_len + count + sample_count;
+			stereo_sample_t *fifo = realloc(song_fifo, capacity * sizeof(stereo_sample_t));
+			song_fifo = fifo ? fifo : song_fifo;
+			song_fifo_capacity = fifo ? capacity : song_fifo_capacity;
+			out = fifo ? out : NULL;
+		}
+		if (!out)
+		{
+			printf("ERROR: out of memory\n");
+			ao_song_done = 1;
+			memset(buffer, 0, sample_count * sizeof(stereo_sample_t));
+			return;
+		}
+		memcpy(&song_fifo[song_fifo_len], out, count * sizeof(stereo_sample_t));
+		song_fifo_len += count;
 	}
+	memcpy(buffer, song_fifo, sample_count * sizeof(stereo_sample_t));
+	song_fifo_len -= sample_count;
+	memmove(song_fifo, &song_fifo[sample_count], song_fifo_len * sizeof(stereo_sample_t));
+
+	PROFILE_ENTER(PROFILE_OUTPUT);
 	wavedump_append(&song_dump, sample_count * sizeof(stereo_sample_t), buffer);
-	(*types[type].frame)();
+	PROFILE_LEAVE();
 }
 
+// [ao_song_done] is thread-local, while signal handlers and the Windows debug
+// thread don't necessarily run on the main thread.
+static volatile ao_bool stop_requested;
+
 static void intr_handler(int sig)
 {
-	ao_song_done = 1;
+	stop_requested = 1;
 }
 
 #if defined(WIN32) && !defined(NOGUI)
@@ -161,20 +301,719 @@ unsigned long __stdcall debug_thread(void *param)
 {
 	debug_hw_t *hw = (debug_hw_t*)param;
 	if(debug_start()) {
-		while(!ao_song_done) {
-			ao_song_done |= debug_frame(hw);
+		while(!stop_requested) {
+			stop_requested |= debug_frame(hw);
 		}
 	}
 	return 0;
 }
 #endif
 
+// Converts [seconds] to a sample count for COMMAND_SEEK in [song_type],
+// rounded down to whole frames.
+static uint32 seek_samples(float seconds, int song_type)
+{
+	if (seconds <= 0)
+	{
+		return 0;
+	}
+	return (uint32)(seconds * types[song_type].rate) * frame_samples(song_type);
+}
+
+// Moves the engine of [song_type] from sample [pos] to sample [target]. If
+// [keyframes] holds a snapshot that is closer to [target] than [pos], or any
+// snapshot before [target] when going backwards, the engine resumes from the
+// latest such snapshot and only skips the rest of the way.
+static ao_bool song_seek(keyframes_t *keyframes, int song_type, uint32 pos, uint32 target)
+{
+	int32 (*command)(int32, int32) = types[song_type].command;
+	unsigned int i = keyframes ? keyframes->count : 0;
+
+	while ((i > 0) && (keyframes->frames[i - 1].sample > target))
+	{
+		i--;
+	}
+	if ((i > 0) && ((keyframes->frames[i - 1].sample > pos) || (pos > target)))
+	{
+		return keyframes_seek(keyframes, target, command);
+	}
+	if (pos > target)
+	{
+		return false;
+	}
+	return (pos == target) || ((*command)(COMMAND_SEEK, target - pos) == AO_SUCCESS);
+}
+
+/// Batch rendering
+/// ---------------
+typedef struct {
+	char **fns;
+	long count;
+	long capacity;
+	const char *dirname;
+
+	// Settings
+	ao_bool nowave;
+	ao_bool nomidi;
+	uint32 length_max;
+	float seek;
+	uint32 rate;
+	double silence_end;
+	ao_bool loop_end;
+	double loop_fade;
+	ao_bool seek_check;
+
+	// Progress, shared between all worker threads
+	volatile long next;
+	volatile long failed;
+} batch_t;
+
+static ao_bool batch_add(batch_t *batch, const char *fn)
+{
+	char *fn_copy;
+	if (batch->count == batch->capacity)
+	{
+		long capacity = batch->capacity ? batch->capacity * 2 : 64;
+		char **fns = realloc(batch->fns, capacity * sizeof(char *));
+		if (!fns)
+		{
+			return false;
+		}
+		batch->fns = fns;
+		batch->capacity = capacity;
+	}
+	fn_copy = malloc(strlen(fn) + 1);
+	if (!fn_copy)
+	{
+		return false;
+	}
+	strcpy(fn_copy, fn);
+	batch->fns[batch->count++] = fn_copy;
+	return true;
+}
+
+// Adds [fn] from the batch directory if it's a song we can play. Libraries
+// share the signature of the songs that reference them, and are skipped by
+// their extension (.psflib, .psf2lib, .ssflib, ...).
+static void batch_dir_add(const char *fn, void *param)
+{
+	batch_t *batch = (batch_t *)param;
+	size_t fn_len = strlen(fn);
+	char *path;
+	FILE *file;
+	uint8 sig[4];
+	ao_bool is_song = false;
+
+	if (fn_len >= 3 && !strcmp(fn + fn_len - 3, "lib"))
+	{
+		return;
+	}
+	path = malloc(strlen(batch->dirname) + 1 + fn_len + 1);
+	if (!path)
+	{
+		return;
+	}
+	sprintf(path, "%s/%s", batch->dirname, fn);
+	file = ao_fopen(path, "rb");
+	if (file)
+	{
+		is_song = fread(sig, sizeof(sig), 1, file) == 1
+			&& type_identify(sig, sizeof(sig)) >= 0;
+		fclose(file);
+	}
+	if (is_song)
+	{
+		batch_add(batch, path);
+	}
+	free(path);
+}
+
+static int batch_fn_compare(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static ao_bool batch_song_render(batch_t *batch, const char *fn)
+{
+	FILE *file;
+	uint8 *buffer;
+	uint32 size;
+	int song_type;
+	wavedump_t dump = {0};
+	songend_t songend;
+	resampler_t resampler;
+	ao_bool resampling = false;
+	uint32 sample_rate;
+	uint32 samples = 0;
+	uint32 samples_seek;
+	uint32 samples_max;
+	double time_start, time_render, time_song;
+
+	file = ao_fopen(fn, "rb");
+	if (!file)
+	{
+		printf("%s: could not open file\n", fn);
+		return false;
+	}
+	if (file_read(file, &buffer, &size) != AO_SUCCESS)
+	{
+		printf("%s: could not read file\n", fn);
+		return false;
+	}
+	song_type = type_identify(buffer, size);
+	if (song_type < 0)
+	{
+		printf("%s: file is unknown\n", fn);
+		ao_file_unmap(buffer, size);
+		return false;
+	}
+	sample_rate = types[song_type].sample_rate;
+	samples_max = batch->length_max * sample_rate;
+	samples_seek = seek_samples(batch->seek, song_type);
+
+	// Only the wave dump is affected by the output rate.
+	if (!batch->nowave && (batch->rate != sample_rate))
+	{
+		if (!resampler_init(&resampler, sample_rate, batch->rate))
+		{
+			printf("%s: out of memory\n", fn);
+			ao_file_unmap(buffer, size);
+			return false;
+		}
+		resampling = true;
+	}
+
+	song_fn = fn;
+	nomidi = batch->nomidi;
+	ao_song_done = 0;
+	if ((*types[song_type].start)(buffer, size) != AO_SUCCESS)
+	{
+		printf("%s: engine rejected file\n", fn);
+		(*types[song_type].stop)();
+		mididump_free();
+		if (resampling)
+		{
+			resampler_free(&resampler);
+		}
+		ao_file_unmap(buffer, size);
+		song_fn = NULL;
+		return false;
+	}
+	if (!batch->nowave)
+	{
+		wavedump_open(&dump, fn, batch->rate, 16, 2);
+	}
+
+	time_start = ao_time();
+	if (samples_seek)
+	{
+		song_seek(NULL, song_type, 0, samples_seek);
+		samples = samples_seek;
+	}
+	songend_init(
+		&songend, sample_rate,
+		batch->silence_end, batch->loop_end, batch->loop_fade
+	);
+	while (!ao_song_done && !stop_requested && (!samples_max || samples < samples_max))
+	{
+		stereo_sample_t buf[FRAME_SAMPLES_MAX];
+		uint32 count = frame_samples(song_type);
+		const stereo_sample_t *out;
+		uint32 out_count = count;
+
+		(*types[song_type].render)(buf, count);
+		out = frame_resample(resampling ? &resampler : NULL, buf, &out_count);
+		if (!out)
+		{
+			printf("%s: out of memory\n", fn);
+			break;
+		}
+		PROFILE_ENTER(PROFILE_OUTPUT);
+		wavedump_append(&dump, out_count * sizeof(stereo_sample_t), out);
+		PROFILE_LEAVE();
+		(*types[song_type].frame)();
+		songend_check(&songend, buf, count);
+		samples += count;
+	}
+	time_render = ao_time() - time_start;
+	time_song = (samples - samples_seek) / (double)sample_rate;
+	songend_free(&songend);
+	if (resampling)
+	{
+		resampler_free(&resampler);
+	}
+
+	wavedump_finish(&dump);
+	(*types[song_type].stop)();
+	ao_file_unmap(buffer, size);
+	if (!batch->nomidi)
+	{
+		mididump_write(fn);
+	}
+	mididump_free();
+	song_fn = NULL;
+
+	printf(
+		"%s: %.2f s rendered in %.2f s (%.2fx realtime)%s\n",
+		fn, time_song, time_render,
+		time_render > 0 ? (time_song / time_render) : 0.0,
+		ao_song_done ? "" : (stop_requested ? ", interrupted" : ", cut off at maximum length")
+	);
+	return true;
+}
+
+// Renders the song in [fn] up to [batch->length_max] twice: once straight
+// from the start, and once after seeking to [batch->seek]. Fails if the
+// samples after the seek position differ between the two.
+static ao_bool batch_song_seek_check(batch_t *batch, const char *fn)
+{
+	FILE *file;
+	uint8 *buffer;
+	uint32 size;
+	int song_type;
+	uint32 samples_seek;
+	uint32 samples_max;
+	uint32 samples[2];
+	uint32 crc[2];
+	int pass;
+
+	file = ao_fopen(fn, "rb");
+	if (!file)
+	{
+		printf("%s: could not open file\n", fn);
+		return false;
+	}
+	if (file_read(file, &buffer, &size) != AO_SUCCESS)
+	{
+		printf("%s: could not read file\n", fn);
+		return false;
+	}
+	song_type = type_identify(buffer, size);
+	if (song_type < 0)
+	{
+		printf("%s: file is unknown\n", fn);
+		ao_file_unmap(buffer, size);
+		return false;
+	}
+	samples_max = batch->length_max * types[song_type].sample_rate;
+	samples_seek = seek_samples(batch->seek, song_type);
+
+	song_fn = fn;
+	nomidi = true;
+	for (pass = 0; pass < 2; pass++)
+	{
+		ao_song_done = 0;
+		samples[pass] = 0;
+		crc[pass] = crc32(0, NULL, 0);
+		if ((*types[song_type].start)(buffer, size) != AO_SUCCESS)
+		{
+			printf("%s: engine rejected file\n", fn);
+			(*types[song_type].stop)();
+			break;
+		}
+		if (pass == 1)
+		{
+			song_seek(NULL, song_type, 0, samples_seek);
+			samples[pass] = samples_seek;
+		}
+		while (!ao_song_done && !stop_requested && samples[pass] < samples_max)
+		{
+			stereo_sample_t buf[FRAME_SAMPLES_MAX];
+			uint32 count = frame_samples(song_type);
+
+			(*types[song_type].render)(buf, count);
+			(*types[song_type].frame)();
+			if (samples[pass] >= samples_seek)
+			{
+				crc[pass] = crc32(crc[pass], (const Bytef *)buf, count * sizeof(buf[0]));
+			}
+			samples[pass] += count;
+		}
+		(*types[song_type].stop)();
+	}
+	mididump_free();
+	song_fn = NULL;
+	ao_file_unmap(buffer, size);
+
+	if (pass < 2 || stop_requested)
+	{
+		return false;
+	}
+	if ((samples[0] != samples[1]) || (crc[0] != crc[1]))
+	{
+		printf(
+			"%s: output after seeking to %.2f s differs from a straight render\n",
+			fn, batch->seek
+		);
+		return false;
+	}
+	printf(
+		"%s: output after seeking to %.2f s matches a straight render for %.2f s\n",
+		fn, batch->seek, (samples[0] - samples_seek) / (double)types[song_type].sample_rate
+	);
+	return true;
+}
+
+static void batch_worker(void *param)
+{
+	batch_t *batch = (batch_t *)param;
+	long i;
+	while (!stop_requested && (i = ao_atomic_add(&batch->next, 1)) < batch->count)
+	{
+		const char *fn = batch->fns[i];
+		ao_bool ok = batch->seek_check
+			? batch_song_seek_check(batch, fn)
+			: batch_song_render(batch, fn);
+		if (!ok)
+		{
+			ao_atomic_add(&batch->failed, 1);
+		}
+	}
+}
+
+// Renders all songs in the directory [source], or in the playlist read from
+// standard input if [source] is "-", on [jobs] threads in parallel.
+static int batch_run(batch_t *batch, const char *source, int jobs)
+{
+	ao_thread_t **threads;
+	double time_start;
+	long i;
+
+	if (!strcmp(source, "-"))
+	{
+		char line[PATH_MAX + 2];
+		while (fgets(line, sizeof(line), stdin))
+		{
+			line[strcspn(line, "\r\n")] = '\0';
+			if (line[0] && !batch_add(batch, line))
+			{
+				printf("ERROR: out of memory\n");
+				return -1;
+			}
+		}
+	}
+	else
+	{
+		batch->dirname = source;
+		if (!ao_dir_iterate(source, batch_dir_add, batch))
+		{
+			printf("ERROR: could not open directory %s\n", source);
+			return -1;
+		}
+		qsort(batch->fns, batch->count, sizeof(char *), batch_fn_compare);
+	}
+
+	if (batch->count == 0)
+	{
+		printf("No songs to render.\n");
+		return -1;
+	}
+	if (jobs <= 0)
+	{
+		jobs = ao_cpu_count();
+	}
+	if (jobs > batch->count)
+	{
+		jobs = batch->count;
+	}
+	printf("Rendering %ld songs on %d threads.\n", batch->count, jobs);
+
+	signal(SIGINT, intr_handler);
+	time_start = ao_time();
+
+	// The main thread also renders, so that we still make progress if no
+	// additional threads can be created.
+	threads = calloc(jobs, sizeof(ao_thread_t *));
+	// The workers already occupy their CPUs, so the engines shouldn't start
+	// parallel decompression threads on top of them.
+	ao_parallel_reserve(jobs - 1);
+	for (i = 1; threads && i < jobs; i++)
+	{
+		threads[i] = ao_thread_start(batch_worker, batch);
+	}
+	batch_worker(batch);
+	for (i = 1; threads && i < jobs; i++)
+	{
+		if (threads[i])
+		{
+			ao_thread_join(threads[i]);
+		}
+	}
+	ao_parallel_reserve(-(jobs - 1));
+	free(threads);
+
+	printf(
+		"Finished %ld songs in %.2f s, %ld failed.\n",
+		batch->count, ao_time() - time_start, batch->failed
+	);
+
+	for (i = 0; i < batch->count; i++)
+	{
+		free(batch->fns[i]);
+	}
+	free(batch->fns);
+	return batch->failed ? -1 : 0;
+}
+/// ---------------
+
+/// Benchmarking
+/// ------------
+typedef struct {
+	int song_type; // -1 if the song failed
+	uint32 samples; // rendered per run
+	uint32 crc; // CRC-32 of the rendered samples
+	double speed_min; // in samples per second
+	double speed_median;
+	double speed_max;
+} bench_result_t;
+
+static int bench_speed_compare(const void *a, const void *b)
+{
+	double sa = *(const double *)a;
+	double sb = *(const double *)b;
+	return (sa > sb) - (sa < sb);
+}
+
+// Moves the running song from [*pos] to [samples_seek], then renders up to
+// [samples_max] samples without any output, only summing them up into
+// [crc]. The first run records a keyframe at [samples_seek] into
+// [keyframes], which all later runs return to. Returns the emulation speed
+// in samples per second, or a negative value if the seek failed.
+static double bench_song_run(
+	int song_type, keyframes_t *keyframes, uint32 *pos, uint32 samples_seek,
+	uint32 samples_max, uint32 *samples, uint32 *crc
+)
+{
+	double time_start, time_render;
+
+	ao_song_done = 0;
+	*samples = 0;
+	*crc = crc32(0, NULL, 0);
+	if (
+		!song_seek(keyframes, song_type, *pos, samples_seek) ||
+		!keyframes_update(keyframes, samples_seek)
+	)
+	{
+		return -1;
+	}
+
+	time_start = ao_time();
+	while (!ao_song_done && !stop_requested && *samples < samples_max)
+	{
+		stereo_sample_t buf[FRAME_SAMPLES_MAX];
+		uint32 count = frame_samples(song_type);
+
+		(*types[song_type].render)(buf, count);
+		(*types[song_type].frame)();
+		*crc = crc32(*crc, (const Bytef *)buf, count * sizeof(buf[0]));
+		*samples += count;
+	}
+	time_render = ao_time() - time_start;
+	*pos = samples_seek + *samples;
+	return (time_render > 0) ? (*samples / time_render) : 0;
+}
+
+// Benchmarks [seconds] of the song in [fn], starting [seek] seconds into it,
+// at the native rate of its engine. The song is only loaded once, and every
+// run after the first one restores the engine state from the start of the
+// first run, which must then render the exact same samples.
+static ao_bool bench_song(
+	bench_result_t *result, const char *fn, uint32 seconds, float seek, int runs
+)
+{
+	FILE *file;
+	uint8 *buffer;
+	uint32 size;
+	uint32 samples_max;
+	uint32 samples_seek;
+	uint32 pos = 0;
+	uint32 crc_first = 0;
+	keyframes_t keyframes;
+	double *speeds;
+	int run;
+
+	result->song_type = -1;
+	file = ao_fopen(fn, "rb");
+	if (!file)
+	{
+		printf("%s: could not open file\n", fn);
+		return false;
+	}
+	if (file_read(file, &buffer, &size) != AO_SUCCESS)
+	{
+		printf("%s: could not read file\n", fn);
+		return false;
+	}
+	result->song_type = type_identify(buffer, size);
+	if (result->song_type < 0)
+	{
+		printf("%s: file is unknown\n", fn);
+		ao_file_unmap(buffer, size);
+		return false;
+	}
+	samples_max = seconds * types[result->song_type].sample_rate;
+	samples_seek = seek_samples(seek, result->song_type);
+	speeds = malloc(runs * sizeof(double));
+	if (!speeds)
+	{
+		printf("ERROR: out of memory\n");
+		ao_file_unmap(buffer, size);
+		return false;
+	}
+
+	song_fn = fn;
+	ao_song_done = 0;
+	if ((*types[result->song_type].start)(buffer, size) != AO_SUCCESS)
+	{
+		printf("%s: engine rejected file\n", fn);
+		run = 0;
+	}
+	else
+	{
+		keyframes_init(&keyframes, types[result->song_type].state, samples_max + 1);
+		for (run = 0; run < runs && !stop_requested; run++)
+		{
+			speeds[run] = bench_song_run(
+				result->song_type, &keyframes, &pos, samples_seek, samples_max,
+				&result->samples, &result->crc
+			);
+			if (speeds[run] < 0)
+			{
+				printf("%s: could not seek to %.2f s\n", fn, seek);
+				break;
+			}
+			if (run == 0)
+			{
+				crc_first = result->crc;
+			}
+			else if (result->crc != crc_first)
+			{
+				printf("%s: run %d rendered different samples than run 1\n", fn, run + 1);
+				break;
+			}
+		}
+		keyframes_free(&keyframes);
+	}
+	(*types[result->song_type].stop)();
+	mididump_free();
+	song_fn = NULL;
+	ao_file_unmap(buffer, size);
+
+	if (run < runs)
+	{
+		result->song_type = -1;
+		free(speeds);
+		return false;
+	}
+	qsort(speeds, runs, sizeof(double), bench_speed_compare);
+	result->speed_min = speeds[0];
+	result->speed_max = speeds[runs - 1];
+	result->speed_median = ((runs % 2) == 0)
+		? ((speeds[(runs / 2) - 1] + speeds[runs / 2]) / 2)
+		: speeds[runs / 2];
+	free(speeds);
+	return true;
+}
+
+// Adds [path] to [batch], or all songs in it if it's a directory.
+static ao_bool bench_add(batch_t *batch, const char *path)
+{
+	long first = batch->count;
+
+	batch->dirname = path;
+	if (ao_dir_iterate(path, batch_dir_add, batch))
+	{
+		qsort(
+			batch->fns + first, batch->count - first, sizeof(char *),
+			batch_fn_compare
+		);
+		return true;
+	}
+	return batch_add(batch, path);
+}
+
+// Renders [seconds] of every song in [batch], starting at [batch->seek], [runs]
+// times without any output, and prints the minimum, median and maximum
+// emulation speed of each song as tab-separated values, together with a
+// checksum of the output for spotting changes in emulation behavior.
+static int bench_run(batch_t *batch, int seconds, int runs)
+{
+	bench_result_t *results;
+	long i;
+
+	if (batch->count == 0)
+	{
+		printf("No songs to benchmark.\n");
+		return -1;
+	}
+	results = calloc(batch->count, sizeof(bench_result_t));
+	if (!results)
+	{
+		printf("ERROR: out of memory\n");
+		return -1;
+	}
+	nomidi = true;
+	signal(SIGINT, intr_handler);
+
+	for (i = 0; i < batch->count; i++)
+	{
+		results[i].song_type = -1;
+		if (!stop_requested && !bench_song(&results[i], batch->fns[i], seconds, batch->seek, runs))
+		{
+			batch->failed++;
+		}
+	}
+
+	// Only print the results once all songs are done, so that they aren't
+	// interleaved with any messages from the engines.
+	printf("file\tformat\truns\tseconds\tmin_samples_per_s\tmedian_samples_per_s\tmax_samples_per_s\tmedian_realtime\tcrc32\n");
+	for (i = 0; i < batch->count; i++)
+	{
+		const bench_result_t *result = &results[i];
+		double sample_rate;
+		if (result->song_type < 0)
+		{
+			continue;
+		}
+		sample_rate = types[result->song_type].sample_rate;
+		printf(
+			"%s\t%s\t%d\t%.2f\t%.0f\t%.0f\t%.0f\t%.2f\t%08x\n",
+			batch->fns[i], types[result->song_type].name, runs,
+			result->samples / sample_rate,
+			result->speed_min, result->speed_median, result->speed_max,
+			result->speed_median / sample_rate, result->crc
+		);
+	}
+
+	for (i = 0; i < batch->count; i++)
+	{
+		free(batch->fns[i]);
+	}
+	free(batch->fns);
+	free(results);
+	return (batch->failed || stop_requested) ? -1 : 0;
+}
+/// ------------
+
 int main(int argc, const char *argv[])
 {
 	FILE *file;
 	uint8 *buffer;
-	uint32 size, filesig;
+	uint32 size;
+	int song_type;
 	char *device = NULL;
+	const char *batch_source = NULL;
+	int jobs = 0;
+	int length_max = 600;
+	float seek = 0;
+	int seek_check = false;
+	int rate = AUDIO_RATE;
+	float silence_end = 0;
+	int loop_end = false;
+	float loop_fade = 10;
+	int bench_seconds = 0;
+	int bench_runs = 5;
+	int ret;
 	int list_devices = false;
 	int nogui = false;
 	// int nomidi = false; // declared as a global in mididump.c
@@ -183,10 +1022,20 @@ int main(int argc, const char *argv[])
 #endif
 	int nosamples = false;
 	int nowave = false;
+	const char *wave_fn = NULL;
+	int raw = false;
+	FILE *wave_file = NULL;
+#ifdef AO_PROFILE
+	int profile_show = false;
+	double time_play;
+#endif
 
 	const char *const usages[] =
 	{
 		"aosdk filename",
+		"aosdk --batch directory [-j jobs]",
+		"aosdk --batch - [-j jobs] < playlist",
+		"aosdk --bench seconds [-r runs] file-or-directory...",
 		NULL
 	};
 
@@ -208,6 +1057,24 @@ int main(int argc, const char *argv[])
 		#endif
 		OPT_BOOLEAN('s', "nosamples", &nosamples, "don't dump any instrument samples"),
 		OPT_BOOLEAN('w', "nowave", &nowave, "don't dump the song to a .wav file"),
+		OPT_STRING('o', "output", &wave_fn, "dump the song to this file instead, or to standard output if '-'"),
+		OPT_BOOLEAN('\0', "raw", &raw, "dump raw 16-bit stereo PCM data without a WAV header"),
+		OPT_FLOAT('t', "seek", &seek, "start playback this many seconds into the song"),
+		OPT_INTEGER('\0', "rate", &rate, "output sample rate in Hz, songs are resampled from the native rate of their sound chip if it differs (default: 44100)"),
+		OPT_FLOAT('S', "silence-end", &silence_end, "end songs after this many seconds of digital silence, 0 = never (default: 0)"),
+		OPT_BOOLEAN('L', "loop-end", &loop_end, "fade out songs without a length once they have looped"),
+		OPT_FLOAT('\0', "loop-fade", &loop_fade, "length of the fade-out for --loop-end, in seconds (default: 10)"),
+		#ifdef AO_PROFILE
+		OPT_BOOLEAN('\0', "profile", &profile_show, "print a breakdown of the render time by emulation stage after the song has stopped"),
+		#endif
+		OPT_GROUP("Batch rendering"),
+		OPT_STRING('b', "batch", &batch_source, "render all songs in this directory without playback, or all files listed on standard input if '-'"),
+		OPT_INTEGER('j', "jobs", &jobs, "number of songs to render in parallel (default: number of CPUs)"),
+		OPT_INTEGER('l', "length-max", &length_max, "stop songs that don't end on their own after this many seconds, 0 = never (default: 600)"),
+		OPT_BOOLEAN('\0', "seek-check", &seek_check, "instead of dumping anything, render each song up to --length-max once from the start and once from the --seek position, and fail if the output after the seek position differs"),
+		OPT_GROUP("Benchmarking"),
+		OPT_INTEGER('\0', "bench", &bench_seconds, "render this many seconds of each given song, or each song in the given directories, from the --seek position without any output, and print the emulation speed"),
+		OPT_INTEGER('r', "runs", &bench_runs, "number of times to render each song for --bench (default: 5)"),
 		OPT_END()
 	};
 
@@ -222,6 +1089,12 @@ int main(int argc, const char *argv[])
 
 	argc = argparse_parse(&argparse, argc, argv);
 
+	if (rate < OUTPUT_RATE_MIN || rate > OUTPUT_RATE_MAX)
+	{
+		printf("ERROR: --rate must be between %d and %d Hz\n", OUTPUT_RATE_MIN, OUTPUT_RATE_MAX);
+		return -1;
+	}
+
 #ifndef NOPLAY
 	if (list_devices)
 	{
@@ -231,6 +1104,50 @@ int main(int argc, const char *argv[])
 	}
 #endif
 
+	if (batch_source)
+	{
+		batch_t batch = {0};
+		batch.nowave = nowave;
+		batch.nomidi = nomidi;
+		batch.length_max = (length_max > 0) ? length_max : 0;
+		batch.seek = seek;
+		batch.rate = rate;
+		batch.silence_end = silence_end;
+		batch.loop_end = loop_end;
+		batch.loop_fade = loop_fade;
+		batch.seek_check = seek_check;
+		if (seek_check && ((seek <= 0) || (batch.length_max <= seek)))
+		{
+			printf("ERROR: --seek-check needs a --seek position before --length-max\n");
+			return -1;
+		}
+		ret = batch_run(&batch, batch_source, jobs);
+		corlett_cache_free();
+		return ret;
+	}
+
+	if (bench_seconds > 0)
+	{
+		batch_t batch = {0};
+		int i;
+		batch.seek = seek;
+		if (bench_runs < 1)
+		{
+			bench_runs = 1;
+		}
+		for (i = 0; i < argc; i++)
+		{
+			if (!bench_add(&batch, argv[i]))
+			{
+				printf("ERROR: out of memory\n");
+				return -1;
+			}
+		}
+		ret = bench_run(&batch, bench_seconds, bench_runs);
+		corlett_cache_free();
+		return ret;
+	}
+
 	// check if an argument was given
 	if (argc < 1)
 	{
@@ -238,6 +1155,17 @@ int main(int argc, const char *argv[])
 		return -1;
 	}
 
+	// This has to happen before anything else is printed.
+	if (!nowave && wave_fn && !strcmp(wave_fn, "-"))
+	{
+		wave_file = ao_stdout_claim();
+		if (!wave_file)
+		{
+			printf("ERROR: could not write to standard output\n");
+			return -1;
+		}
+	}
+
 	file = ao_fopen(argv[0], "rb");
 
 	if (!file)
@@ -251,62 +1179,81 @@ int main(int argc, const char *argv[])
 		sampledump_init();
 	}
 
-	// get the length of the file by seeking to the end then reading the current position
-	fseek(file, 0, SEEK_END);
-	size = ftell(file);
-	// reset the pointer
-	fseek(file, 0, SEEK_SET);
-
-	buffer = malloc(size);
-
-	if (!buffer)
+	// read the file
+	if (file_read(file, &buffer, &size) != AO_SUCCESS)
 	{
-		fclose(file);
-		printf("ERROR: could not allocate %d bytes of memory\n", size);
 		return -1;
 	}
 
-	// read the file
-	fread(buffer, size, 1, file);
-	fclose(file);
-
 	// now try to identify the file
-	type = 0;
-	filesig = buffer[0]<<24 | buffer[1]<<16 | buffer[2]<<8 | buffer[3];
-	while (types[type].sig != 0xffffffff)
-	{
-		if (filesig == types[type].sig)
-		{
-			break;
-		}
-		else
-		{
-			type++;
-		}
-	}
-
-	// now did we identify it above or just fall through?
-	if (types[type].sig != 0xffffffff)
+	song_type = type_identify(buffer, size);
+	if (song_type >= 0)
 	{
+		type = song_type;
 		printf("File identified as %s\n", types[type].name);
 	}
 	else
 	{
 		printf("ERROR: File is unknown, signature bytes are %02x %02x %02x %02x\n", buffer[0], buffer[1], buffer[2], buffer[3]);
-		free(buffer);
+		ao_file_unmap(buffer, size);
 		return -1;
 	}
 
+	song_fn = argv[0];
+
 	if ((*types[type].start)(buffer, size) != AO_SUCCESS)
 	{
-		free(buffer);
+		ao_file_unmap(buffer, size);
 		printf("ERROR: Engine rejected file!\n");
 		return -1;
 	}
 
-	if(!nowave && wavedump_open(&song_dump, argv[0]))
+	if (seek > 0)
+	{
+		double time_start = ao_time();
+		song_seek(NULL, type, 0, seek_samples(seek, type));
+		printf("Seeked to %.2f s in %.2f s.\n", seek, ao_time() - time_start);
+	}
+
+	songend_init(
+		&song_end, types[type].sample_rate, silence_end, loop_end, loop_fade
+	);
+
+	song_resampling = ((uint32)rate != types[type].sample_rate);
+	if (song_resampling && !resampler_init(&song_resampler, types[type].sample_rate, rate))
 	{
-		printf("Dumping to %s%s.\n", argv[0], ".wav");
+		printf("ERROR: out of memory\n");
+		(*types[type].stop)();
+		ao_file_unmap(buffer, size);
+		return -1;
+	}
+
+	if(!nowave)
+	{
+		const char *ext = raw ? ".raw" : ".wav";
+		if (!wave_fn)
+		{
+			wave_file = fopen_derivative(argv[0], ext);
+		}
+		else if (!wave_file)
+		{
+			wave_file = ao_fopen(wave_fn, "wb");
+			if (!wave_file)
+			{
+				printf("ERROR: could not open %s for writing\n", wave_fn);
+			}
+		}
+		if (wavedump_open_file(&song_dump, wave_file, raw, rate, 16, 2))
+		{
+			if (!wave_fn)
+			{
+				printf("Dumping to %s%s.\n", argv[0], ext);
+			}
+			else
+			{
+				printf("Dumping to %s.\n", strcmp(wave_fn, "-") ? wave_fn : "standard output");
+			}
+		}
 	}
 
 	signal(SIGINT, intr_handler);
@@ -336,7 +1283,7 @@ int main(int argc, const char *argv[])
 #ifndef NOPLAY
 	if(!noplay)
 	{
-		m1sdr_Init(device, 44100);
+		m1sdr_Init(device, rate);
 		m1sdr_SetCallback(do_frame);
 		m1sdr_PlayStart();
 		printf("Playing.  ");
@@ -347,7 +1294,12 @@ int main(int argc, const char *argv[])
 		nogui ? "" : "or close the debug window "
 	);
 
-	while (!ao_song_done)
+	#ifdef AO_PROFILE
+	time_play = ao_time();
+	profile_start();
+	#endif
+
+	while (!ao_song_done && !stop_requested)
 	{
 		m1sdr_ret_t ret = M1SDR_OK;
 #ifndef NOPLAY
@@ -358,8 +1310,8 @@ int main(int argc, const char *argv[])
 		else
 #endif
 		{
-			stereo_sample_t buffer[44100 / 60];
-			do_frame(sizeof(buffer) / sizeof(stereo_sample_t), buffer);
+			stereo_sample_t buffer[OUTPUT_RATE_MAX / 60];
+			do_frame(rate / 60, buffer);
 		}
 		#if !defined(NOGUI) && !defined(WIN32)
 		if(!nogui)
@@ -375,9 +1327,26 @@ int main(int argc, const char *argv[])
 	}
 
 	signal(SIGINT, SIG_IGN);
-	wavedump_finish(&song_dump, 44100, 16, 2);
+	stop_requested = 1;
+	#ifdef AO_PROFILE
+	if(profile_show) {
+		profile_report(
+			ao_time() - time_play,
+			song_samples / (double)types[type].sample_rate
+		);
+	}
+	#endif
+	wavedump_finish(&song_dump);
+	songend_free(&song_end);
+	if (song_resampling)
+	{
+		resampler_free(&song_resampler);
+	}
+	free(song_fifo);
+	(*types[type].stop)();
+	corlett_cache_free();
 
-	free(buffer);
+	ao_file_unmap(buffer, size);
 
 	if(!nomidi) {
 		mididump_write(argv[0]);
@@ -7,8 +7,48 @@
 
 // mem.h
 
-uint8 memory_read(uint16 addr);
-uint8 memory_readop(uint16 addr);
+// The Z80 address space is split into 16 pages of 4 KB, each pointing
+// straight at the host memory that backs it. Pages without a pointer go
+// through memory_read_io() and memory_write_io().
+#define MEMORY_PAGE_SHIFT	12
+#define MEMORY_PAGE_SIZE	(1 << MEMORY_PAGE_SHIFT)
+#define MEMORY_PAGES	(0x10000 >> MEMORY_PAGE_SHIFT)
+
+typedef struct {
+	uint8 *read[MEMORY_PAGES];
+	uint8 *write[MEMORY_PAGES];
+	// Opcode fetches, which differ from [read] for encrypted programs.
+	uint8 *op[MEMORY_PAGES];
+} memory_map_t;
+
+extern AO_THREAD_LOCAL memory_map_t memory_map;
+
+uint8 memory_read_io(uint16 addr);
 uint8 memory_readport(uint16 addr);
-void memory_write(uint16 addr, uint8 byte);
+void memory_write_io(uint16 addr, uint8 byte);
 void memory_writeport(uint16 addr, uint8 byte);
+
+INLINE uint8 memory_read(uint16 addr)
+{
+	uint8 *page = memory_map.read[addr >> MEMORY_PAGE_SHIFT];
+	return page ? page[addr & (MEMORY_PAGE_SIZE - 1)] : memory_read_io(addr);
+}
+
+INLINE uint8 memory_readop(uint16 addr)
+{
+	uint8 *page = memory_map.op[addr >> MEMORY_PAGE_SHIFT];
+	return page ? page[addr & (MEMORY_PAGE_SIZE - 1)] : memory_read_io(addr);
+}
+
+INLINE void memory_write(uint16 addr, uint8 byte)
+{
+	uint8 *page = memory_map.write[addr >> MEMORY_PAGE_SHIFT];
+	if (page)
+	{
+		page[addr & (MEMORY_PAGE_SIZE - 1)] = byte;
+	}
+	else
+	{
+		memory_write_io(addr, byte);
+	}
+}
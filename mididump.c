@@ -15,7 +15,7 @@
 #include "mididump.h"
 #include "utils.h"
 
-ao_bool nomidi = false;
+AO_THREAD_LOCAL ao_bool nomidi = false;
 
 #define MSB(ctl) ctl
 #define LSB(ctl) ctl+0x20
@@ -61,7 +61,7 @@ typedef struct {
 	event_t *last;
 } vchan_t;
 
-int64 first_note_distance = -1;
+AO_THREAD_LOCAL int64 first_note_distance = -1;
 
 static void vchan_event_push(
 	vchan_t *vchan, event_type_t type, event_param_t param
@@ -127,7 +127,7 @@ static void vchan_free(vchan_t *vchan)
 
 /// Virtual channel hash table
 /// --------------------------
-hashtable_t vchans;
+AO_THREAD_LOCAL hashtable_t vchans;
 
 vchan_t* vchans_get(int id)
 {
@@ -462,5 +462,6 @@ ao_bool mididump_write(const char *fn)
 void mididump_free(void)
 {
 	vchans_free();
+	first_note_distance = -1;
 }
 /// ----------
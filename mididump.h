@@ -6,7 +6,7 @@
  * Author: Nmlgc
  */
 
-extern ao_bool nomidi;
+extern AO_THREAD_LOCAL ao_bool nomidi;
 
 typedef enum {
 	// MSB values of the 14-bit controller types from 0x00 to 0x31.
@@ -0,0 +1,61 @@
+/*
+ * Audio Overload SDK
+ *
+ * Per-stage render time profiling
+ *
+ * Author: Nmlgc
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "ao.h"
+
+#ifdef AO_PROFILE
+
+AO_THREAD_LOCAL profile_t profile;
+
+static const char *const STAGE_NAMES[PROFILE_STAGE_COUNT] = {
+	"Other",
+	"Guest CPU",
+	"Sound chip",
+	"DSP",
+	"Reverb",
+	"Resampler",
+	"Output",
+};
+
+void profile_start(void)
+{
+	memset(&profile, 0, sizeof(profile));
+	profile.last = profile_ticks();
+}
+
+void profile_report(double time, double seconds)
+{
+	uint64 total = 0;
+	int i;
+
+	profile_switch();
+	for(i = 0; i < PROFILE_STAGE_COUNT; i++) {
+		total += profile.ticks[i];
+	}
+	if(total == 0) {
+		return;
+	}
+	printf("Profile of %.2f s rendered in %.2f s:\n", seconds, time);
+	for(i = 0; i < PROFILE_STAGE_COUNT; i++) {
+		double share = (double)profile.ticks[i] / total;
+		printf(
+			"%12s: %8.3f s (%5.1f%%)\n",
+			STAGE_NAMES[i], share * time, share * 100
+		);
+	}
+	if(seconds > 0) {
+		printf(
+			"%12s: %.0f per emulated second\n",
+			"Instructions", profile.insns / seconds
+		);
+	}
+}
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Audio Overload SDK
+ *
+ * Per-stage render time profiling
+ *
+ * Author: Nmlgc
+ */
+
+#pragma once
+
+/// Profiling
+/// ---------
+// Compiled in by defining AO_PROFILE (`make PROFILE=1`); otherwise, all
+// macros below expand to nothing and cost nothing.
+// Time is always attributed to the innermost active stage, so a DSP step
+// called from within a sound chip update only counts towards PROFILE_DSP.
+// Everything outside of an explicitly marked stage counts as PROFILE_OTHER.
+
+typedef enum {
+	PROFILE_OTHER,
+	PROFILE_CPU, // guest CPU, including memory-mapped I/O it performs
+	PROFILE_CHIP, // sound chip, excluding its DSP
+	PROFILE_DSP, // effect DSP of the sound chip
+	PROFILE_REVERB, // PEOpS SPU reverb
+	PROFILE_RESAMPLE, // conversion to the output sample rate
+	PROFILE_OUTPUT, // writing rendered samples to disk
+
+	PROFILE_STAGE_COUNT
+} profile_stage_t;
+
+#ifdef AO_PROFILE
+
+#define PROFILE_DEPTH_MAX 8
+
+typedef struct {
+	uint64 ticks[PROFILE_STAGE_COUNT];
+	uint64 insns; // guest instructions executed
+	uint64 last; // timestamp of the last stage switch
+	profile_stage_t stack[PROFILE_DEPTH_MAX];
+	unsigned int depth;
+} profile_t;
+
+extern AO_THREAD_LOCAL profile_t profile;
+
+// Returns a timestamp in unspecified units. Only the ratio between two
+// tick counts is meaningful.
+INLINE uint64 profile_ticks(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	return __builtin_ia32_rdtsc();
+#else
+	return (uint64)(ao_time() * 1e9);
+#endif
+}
+
+// Charges the time since the last switch to the current stage.
+INLINE void profile_switch(void)
+{
+	uint64 now = profile_ticks();
+	profile.ticks[profile.stack[profile.depth]] += now - profile.last;
+	profile.last = now;
+}
+
+INLINE void profile_enter(profile_stage_t stage)
+{
+	profile_switch();
+	profile.stack[++profile.depth] = stage;
+}
+
+INLINE void profile_leave(void)
+{
+	profile_switch();
+	profile.depth--;
+}
+
+// Resets all counters of the calling thread and starts the clock.
+void profile_start(void);
+
+// Prints the time spent in every stage since profile_start(), given the
+// wall-clock [time] of that period and the [seconds] of audio rendered
+// during it.
+void profile_report(double time, double seconds);
+
+#define PROFILE_ENTER(stage) profile_enter(stage)
+#define PROFILE_LEAVE() profile_leave()
+#define PROFILE_INSN() (profile.insns++)
+
+#else
+
+#define PROFILE_ENTER(stage)
+#define PROFILE_LEAVE()
+#define PROFILE_INSN()
+
+#endif
+/// ---------
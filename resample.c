@@ -0,0 +1,209 @@
+/*
+ * Audio Overload SDK
+ *
+ * Sample rate conversion
+ *
+ * Author: Nmlgc
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ao.h"
+#include "resample.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+# include <xmmintrin.h>
+# define RESAMPLE_SSE
+#endif
+
+// Fraction of the lower Nyquist frequency that is kept
+#define RESAMPLE_CUTOFF 0.9
+#define RESAMPLE_KAISER_BETA 8.0
+
+#ifndef M_PI
+# define M_PI 3.14159265358979323846
+#endif
+
+/// Kernel
+/// ------
+// Zeroth-order modified Bessel function of the first kind
+static double resample_bessel_i0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	int k;
+	for(k = 1; k < 64; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+		if(term < (sum * 1e-12)) {
+			break;
+		}
+	}
+	return sum;
+}
+
+// Fills the kernel of [r] for a low-pass filter at [fc] times the input
+// Nyquist frequency.
+static void resample_kernel_fill(resampler_t *r, double fc)
+{
+	double half = r->taps / 2;
+	double i0_beta = resample_bessel_i0(RESAMPLE_KAISER_BETA);
+	uint32 p, j;
+
+	for(p = 0; p <= RESAMPLE_PHASES; p++) {
+		float *row = &r->kernel[p * r->taps];
+		double sum = 0;
+		for(j = 0; j < r->taps; j++) {
+			// Distance between the output sample and input sample [j]
+			double x = (half - 1 - j) + ((double)p / RESAMPLE_PHASES);
+			double sinc = (x == 0) ? 1.0 : (sin(M_PI * fc * x) / (M_PI * fc * x));
+			double w = 1.0 - ((x / half) * (x / half));
+			double window = (w > 0)
+				? (resample_bessel_i0(RESAMPLE_KAISER_BETA * sqrt(w)) / i0_beta)
+				: 0;
+			row[j] = (float)(sinc * window);
+			sum += row[j];
+		}
+		// Unity gain at DC for every phase
+		for(j = 0; j < r->taps; j++) {
+			row[j] = (float)(row[j] / sum);
+		}
+	}
+}
+/// ------
+
+ao_bool resampler_init(resampler_t *r, uint32 rate_in, uint32 rate_out)
+{
+	double fc = RESAMPLE_CUTOFF;
+	uint32 factor = 1;
+
+	memset(r, 0, sizeof(*r));
+	r->rate_in = rate_in;
+	r->rate_out = rate_out;
+	if(rate_out < rate_in) {
+		fc = (fc * rate_out) / rate_in;
+		factor = (rate_in + rate_out - 1) / rate_out;
+	}
+	r->taps = RESAMPLE_TAPS * factor;
+	r->kernel = malloc((RESAMPLE_PHASES + 1) * r->taps * sizeof(float));
+	r->hist_l = calloc(r->taps + RESAMPLE_CHUNK, sizeof(float));
+	r->hist_r = calloc(r->taps + RESAMPLE_CHUNK, sizeof(float));
+	if(!r->kernel || !r->hist_l || !r->hist_r) {
+		resampler_free(r);
+		return false;
+	}
+	resample_kernel_fill(r, fc);
+	r->hist_len = (r->taps / 2) - 1;
+	return true;
+}
+
+INLINE INT16 resample_clip(float v)
+{
+	v += ((v >= 0) ? 0.5f : -0.5f);
+	if(v > 32767.0f) {
+		return 32767;
+	} else if(v < -32768.0f) {
+		return -32768;
+	}
+	return (INT16)v;
+}
+
+// Filters the history at the current position into [out].
+INLINE void resample_point(const resampler_t *r, stereo_sample_t *out)
+{
+	double phase = ((double)r->pos_frac * RESAMPLE_PHASES) / r->rate_out;
+	uint32 p = (uint32)phase;
+	const float *k0 = &r->kernel[p * r->taps];
+	const float *k1 = (k0 + r->taps);
+	const float *xl = &r->hist_l[r->pos];
+	const float *xr = &r->hist_r[r->pos];
+	float w = (float)(phase - p);
+	float l, rr;
+	uint32 j;
+
+#ifdef RESAMPLE_SSE
+	__m128 vw = _mm_set1_ps(w);
+	__m128 acc_l = _mm_setzero_ps();
+	__m128 acc_r = _mm_setzero_ps();
+	float sums[4];
+
+	for(j = 0; j < r->taps; j += 4) {
+		__m128 c0 = _mm_loadu_ps(k0 + j);
+		__m128 c1 = _mm_loadu_ps(k1 + j);
+		__m128 c = _mm_add_ps(c0, _mm_mul_ps(_mm_sub_ps(c1, c0), vw));
+		acc_l = _mm_add_ps(acc_l, _mm_mul_ps(c, _mm_loadu_ps(xl + j)));
+		acc_r = _mm_add_ps(acc_r, _mm_mul_ps(c, _mm_loadu_ps(xr + j)));
+	}
+	_mm_storeu_ps(sums, acc_l);
+	l = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+	_mm_storeu_ps(sums, acc_r);
+	rr = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+#else
+	l = rr = 0;
+	for(j = 0; j < r->taps; j++) {
+		float c = k0[j] + ((k1[j] - k0[j]) * w);
+		l += (c * xl[j]);
+		rr += (c * xr[j]);
+	}
+#endif
+	out->l = resample_clip(l);
+	out->r = resample_clip(rr);
+}
+
+const stereo_sample_t* resampler_process(
+	resampler_t *r, const stereo_sample_t *in, uint32 count, uint32 *out_count
+)
+{
+	uint32 out_max = (uint32)(
+		((uint64)(count + r->taps) * r->rate_out) / r->rate_in
+	) + 1;
+	uint32 n = 0;
+
+	if(r->out_capacity < out_max) {
+		stereo_sample_t *out = realloc(r->out, out_max * sizeof(stereo_sample_t));
+		if(!out) {
+			return NULL;
+		}
+		r->out = out;
+		r->out_capacity = out_max;
+	}
+	while(count > 0) {
+		uint32 chunk = (count < RESAMPLE_CHUNK) ? count : RESAMPLE_CHUNK;
+		uint32 i;
+
+		for(i = 0; i < chunk; i++) {
+			r->hist_l[r->hist_len + i] = in[i].l;
+			r->hist_r[r->hist_len + i] = in[i].r;
+		}
+		r->hist_len += chunk;
+		in += chunk;
+		count -= chunk;
+
+		while((r->pos + r->taps) <= r->hist_len) {
+			resample_point(r, &r->out[n++]);
+			r->pos_frac += r->rate_in;
+			r->pos += (r->pos_frac / r->rate_out);
+			r->pos_frac %= r->rate_out;
+		}
+
+		// Keep only the samples that are still needed. Since the position
+		// never advances by more than [taps] samples at once, it's always
+		// inside the history at this point.
+		r->hist_len -= r->pos;
+		memmove(r->hist_l, &r->hist_l[r->pos], r->hist_len * sizeof(float));
+		memmove(r->hist_r, &r->hist_r[r->pos], r->hist_len * sizeof(float));
+		r->pos = 0;
+	}
+	*out_count = n;
+	return r->out;
+}
+
+void resampler_free(resampler_t *r)
+{
+	free(r->kernel);
+	free(r->hist_l);
+	free(r->hist_r);
+	free(r->out);
+	memset(r, 0, sizeof(*r));
+}
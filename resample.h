@@ -0,0 +1,60 @@
+/*
+ * Audio Overload SDK
+ *
+ * Sample rate conversion
+ *
+ * Author: Nmlgc
+ */
+
+#pragma once
+
+/// Resampling
+/// ----------
+// Polyphase windowed-sinc resampler between two arbitrary sample rates.
+// The filter kernel is tabulated at RESAMPLE_PHASES fractional positions
+// between two input samples, and linearly interpolated in between, which
+// keeps the table small even for rate pairs without a small common divisor,
+// like QSound's 24096 Hz and 44100 Hz.
+// Input is collected in a deinterleaved float history, so that each output
+// sample boils down to two dot products that map well onto SIMD registers.
+
+// Filter taps when upsampling. Downsampling multiplies this by the ratio.
+// Always a multiple of 4.
+#define RESAMPLE_TAPS 64
+#define RESAMPLE_PHASES 256
+
+// Input samples converted per batch
+#define RESAMPLE_CHUNK 1024
+
+typedef struct {
+	uint32 rate_in;
+	uint32 rate_out;
+	uint32 taps;
+	float *kernel; // (RESAMPLE_PHASES + 1) rows of [taps] coefficients
+
+	// Input history, preceded by (taps / 2 - 1) samples of silence at the
+	// start, so that the output is not delayed relative to the input.
+	float *hist_l;
+	float *hist_r;
+	uint32 hist_len;
+
+	// Position of the next output sample in the history, as an integer
+	// sample and a fraction in units of 1/rate_out
+	uint32 pos;
+	uint32 pos_frac;
+
+	stereo_sample_t *out;
+	uint32 out_capacity;
+} resampler_t;
+
+ao_bool resampler_init(resampler_t *r, uint32 rate_in, uint32 rate_out);
+
+// Converts [count] samples from [in], and returns a pointer to the converted
+// samples, whose number is returned in [out_count]. The pointer stays valid
+// until the next call. Returns NULL if we ran out of memory.
+const stereo_sample_t* resampler_process(
+	resampler_t *r, const stereo_sample_t *in, uint32 count, uint32 *out_count
+);
+
+void resampler_free(resampler_t *r);
+/// ----------
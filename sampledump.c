@@ -10,7 +10,7 @@
 #include "utils.h"
 
 // int32 -> ao_bool
-hashtable_t samples_seen;
+AO_THREAD_LOCAL hashtable_t samples_seen;
 
 void sampledump_init(void)
 {
@@ -0,0 +1,332 @@
+/*
+ * Audio Overload SDK
+ *
+ * Song end detection
+ *
+ * Author: Nmlgc
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ao.h"
+#include "corlett.h"
+#include "songend.h"
+
+/// Window sets
+/// -----------
+static songend_window_t* songend_set_slot(songend_set_t *set, uint64 hash)
+{
+	uint32 mask = set->capacity - 1;
+	uint32 i = (uint32)(hash ^ (hash >> 32)) & mask;
+	while(set->windows[i].hash && set->windows[i].hash != hash) {
+		i = (i + 1) & mask;
+	}
+	return &set->windows[i];
+}
+
+static ao_bool songend_set_grow(songend_set_t *set)
+{
+	songend_window_t *old = set->windows;
+	uint32 old_capacity = set->capacity;
+	uint32 capacity = old_capacity ? (old_capacity * 2) : 4096;
+	uint32 i;
+
+	set->windows = calloc(capacity, sizeof(songend_window_t));
+	if(!set->windows) {
+		set->windows = old;
+		return false;
+	}
+	set->capacity = capacity;
+	for(i = 0; i < old_capacity; i++) {
+		if(old[i].hash) {
+			*songend_set_slot(set, old[i].hash) = old[i];
+		}
+	}
+	free(old);
+	return true;
+}
+
+// Looks up [hash] in [set], and adds it together with [keyon] if it's not in
+// there yet. Returns the entry, or NULL if we ran out of memory.
+static songend_window_t* songend_set_add(
+	songend_set_t *set, uint64 hash, uint32 keyon
+)
+{
+	songend_window_t *slot;
+
+	// Keep the load factor at 50% at most.
+	if((set->count + 1) * 2 > set->capacity && !songend_set_grow(set)) {
+		return NULL;
+	}
+	if(!hash) {
+		hash = 1;
+	}
+	slot = songend_set_slot(set, hash);
+	if(!slot->hash) {
+		slot->hash = hash;
+		slot->keyon = keyon;
+		set->count++;
+	}
+	return slot;
+}
+
+static void songend_set_free(songend_set_t *set)
+{
+	free(set->windows);
+	memset(set, 0, sizeof(*set));
+}
+/// -----------
+
+// Base of the polynomial window hash
+#define SONGEND_HASH_BASE 0x100000001b3ULL
+
+AO_THREAD_LOCAL uint32 songend_clock;
+
+static AO_THREAD_LOCAL songend_t *songend_active;
+
+// Stops loop detection for [songend], and frees everything it needed.
+static void songend_loop_stop(songend_t *songend)
+{
+	if(songend_active == songend) {
+		songend_active = NULL;
+	}
+	free(songend->keyons);
+	songend->keyons = NULL;
+	songend->keyon_capacity = 0;
+	songend_set_free(&songend->seen);
+}
+
+void songend_init(
+	songend_t *songend, uint32 sample_rate,
+	double silence_seconds, ao_bool loop, double fade_seconds
+)
+{
+	uint32 i;
+
+	memset(songend, 0, sizeof(*songend));
+	if(silence_seconds > 0) {
+		songend->silence_max = (uint32)(silence_seconds * sample_rate);
+	}
+	songend->fade_seconds = fade_seconds;
+	songend->chord_samples = ((sample_rate * SONGEND_CHORD_MS) / 1000);
+	songend->tolerance = (sample_rate / 60);
+	songend->window_factor = 1;
+	for(i = 0; i < SONGEND_WINDOW_KEYONS; i++) {
+		songend->window_factor *= SONGEND_HASH_BASE;
+	}
+
+	// Songs with a length end by themselves.
+	songend_active = ((loop && !corlett_length_known()) ? songend : NULL);
+}
+
+static ao_bool songend_near(uint32 a, uint32 b, uint32 tolerance)
+{
+	return ((a + tolerance) >= b) && (a <= (b + tolerance));
+}
+
+// Returns whether key-on [k] repeats the one [period] key-ons before it,
+// [period_samples] later, give or take [tolerance] samples.
+static ao_bool songend_keyon_repeats(
+	const songend_t *songend, uint32 k,
+	uint32 period, uint32 period_samples, uint32 tolerance
+)
+{
+	const songend_keyon_t *cur = &songend->keyons[k];
+	const songend_keyon_t *prev = &songend->keyons[k - period];
+	return (
+		(cur->hash == prev->hash) &&
+		songend_near(cur->sample - prev->sample, period_samples, tolerance)
+	);
+}
+
+// Adds [keyon] to the list, and checks whether the window that ends with it
+// repeats an earlier one. Returns false if we ran out of memory.
+static ao_bool songend_keyon_add(
+	songend_t *songend, const songend_keyon_t *keyon, uint32 tolerance
+)
+{
+	uint32 n = songend->keyon;
+	songend_window_t *seen;
+	uint32 period;
+	uint32 period_samples;
+	uint32 k;
+
+	if(n == songend->keyon_capacity) {
+		uint32 capacity = n ? (n * 2) : 4096;
+		songend_keyon_t *keyons = realloc(
+			songend->keyons, capacity * sizeof(songend_keyon_t)
+		);
+		if(!keyons) {
+			return false;
+		}
+		songend->keyons = keyons;
+		songend->keyon_capacity = capacity;
+	}
+	songend->keyons[n] = *keyon;
+	songend->window_hash = (songend->window_hash * SONGEND_HASH_BASE) + keyon->hash;
+	if(n >= SONGEND_WINDOW_KEYONS) {
+		songend->window_hash -= (
+			songend->keyons[n - SONGEND_WINDOW_KEYONS].hash * songend->window_factor
+		);
+	}
+	songend->keyon = ++n;
+
+	if(n < SONGEND_WINDOW_KEYONS) {
+		return true;
+	}
+	seen = songend_set_add(&songend->seen, songend->window_hash, n);
+	if(!seen) {
+		return false;
+	}
+	if((n - seen->keyon) < SONGEND_WINDOW_KEYONS) {
+		return true;
+	}
+	period = (n - seen->keyon);
+	period_samples = (
+		songend->keyons[n - 1].sample - songend->keyons[seen->keyon - 1].sample
+	);
+
+	// Compare any later repetition against this one.
+	seen->keyon = n;
+
+	for(k = (n - SONGEND_WINDOW_KEYONS); k < n; k++) {
+		if(!songend_keyon_repeats(
+			songend, k, period, period_samples, tolerance
+		)) {
+			// Same notes with a different rhythm
+			return true;
+		}
+	}
+	if(
+		(songend->period == period) &&
+		songend_near(songend->period_samples, period_samples, tolerance)
+	) {
+		// Only count a second window that doesn't overlap the first.
+		songend->looped = (
+			(n - songend->period_keyon) >= SONGEND_WINDOW_KEYONS
+		);
+	} else {
+		songend->period = period;
+		songend->period_samples = period_samples;
+		songend->period_keyon = n;
+	}
+	return true;
+}
+
+static int songend_hash_compare(const void *a, const void *b)
+{
+	uint64 ha = ((const songend_keyon_t *)a)->hash;
+	uint64 hb = ((const songend_keyon_t *)b)->hash;
+	return (ha > hb) - (ha < hb);
+}
+
+// Returns the number of pending key-ons that belong to chords which are
+// definitely over.
+static uint32 songend_chord_end(const songend_t *songend)
+{
+	const songend_keyon_t *chord = songend->chord;
+	uint32 i = songend->chord_count;
+
+	if(!i || ((songend_clock - chord[i - 1].sample) > songend->chord_samples)) {
+		return i;
+	}
+	// The last chord might still get more key-ons.
+	for(i--; i > 0; i--) {
+		if((chord[i].sample - chord[i - 1].sample) > songend->chord_samples) {
+			break;
+		}
+	}
+	return i;
+}
+
+// Sorts the first [count] pending key-ons by their hash within each chord,
+// and adds them to the list.
+static void songend_chord_flush(songend_t *songend, uint32 count)
+{
+	songend_keyon_t *chord = songend->chord;
+	uint32 start = 0;
+
+	while((start < count) && (songend_active == songend) && !songend->looped) {
+		uint32 end = (start + 1);
+		while(
+			(end < count) &&
+			((chord[end].sample - chord[end - 1].sample) <= songend->chord_samples)
+		) {
+			end++;
+		}
+		qsort(
+			&chord[start], (end - start), sizeof(songend_keyon_t),
+			songend_hash_compare
+		);
+		for(; (start < end) && !songend->looped; start++) {
+			if(!songend_keyon_add(songend, &chord[start], songend->tolerance)) {
+				// Out of memory, so give up on this song.
+				songend_loop_stop(songend);
+				break;
+			}
+		}
+		start = end;
+	}
+	songend->chord_count -= count;
+	memmove(chord, &chord[count], (songend->chord_count * sizeof(songend_keyon_t)));
+}
+
+void songend_keyon(const void *regs, size_t size)
+{
+	songend_t *songend = songend_active;
+	const uint8 *p = (const uint8 *)regs;
+	uint64 hash = 0xcbf29ce484222325ULL;
+	songend_keyon_t *keyon;
+
+	if(!songend || songend->looped) {
+		return;
+	}
+	while(size--) {
+		hash = (hash ^ *(p++)) * 0x100000001b3ULL;
+	}
+	// Finalize each hash before combining them, so that similar registers
+	// don't end up with similar hashes.
+	hash ^= (hash >> 33);
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= (hash >> 33);
+
+	if(songend->chord_count >= SONGEND_CHORD_KEYONS) {
+		songend_chord_flush(songend, songend->chord_count);
+	}
+	keyon = &songend->chord[songend->chord_count++];
+	keyon->hash = hash;
+	keyon->sample = songend_clock;
+}
+
+void songend_check(songend_t *songend, const stereo_sample_t *buf, uint32 count)
+{
+	if(songend->silence_max) {
+		uint32 i;
+		for(i = 0; i < count; i++) {
+			if(buf[i].l || buf[i].r) {
+				songend->heard = true;
+				songend->silence = 0;
+			} else if(songend->heard) {
+				songend->silence++;
+			}
+		}
+		if(songend->silence >= songend->silence_max) {
+			ao_song_done = 1;
+			return;
+		}
+	}
+	if(songend_active == songend) {
+		songend_chord_flush(songend, songend_chord_end(songend));
+	}
+	if(songend->looped) {
+		corlett_fade_start(songend->fade_seconds);
+		songend->looped = false;
+		songend_loop_stop(songend);
+	}
+}
+
+void songend_free(songend_t *songend)
+{
+	songend_loop_stop(songend);
+}
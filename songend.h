@@ -0,0 +1,123 @@
+/*
+ * Audio Overload SDK
+ *
+ * Song end detection
+ *
+ * Author: Nmlgc
+ */
+
+#pragma once
+
+/// Song end detection
+/// ------------------
+// Ends songs that would otherwise play forever, using two optional methods:
+//
+// - Silence: The song ends after a run of the given length of samples that
+//   are all exactly zero.
+//
+// - Loop: For songs without a length, the sound chips report every key-on,
+//   together with the registers that describe the keyed-on voice. Key-ons are
+//   then combined into an ordered hash of the last SONGEND_WINDOW_KEYONS
+//   ones. Once a window repeats at least a full window length later, and all
+//   of its key-ons happened the same amount of time after their counterparts
+//   in the earlier window, the song might have looped. It is only considered
+//   to have looped, and faded out, once a second window, starting after the
+//   first one ended, repeats with the same period in both key-ons and time.
+//   This ignores the emulated CPU and RAM, which tend to contain running
+//   counters, as well as the actual voice numbers, which are often allocated
+//   round-robin. Key-ons are timed to the sample they happened at, using
+//   [songend_clock]. Timings may be off by up to one frame between loop
+//   iterations, since the sound driver rarely ticks in sync with the loop.
+//   Key-ons less than SONGEND_CHORD_MS apart form a chord, whose key-ons are
+//   sorted by their hash rather than kept in the order the chip processed
+//   them. That order often depends on the voice numbers, and the key-ons of
+//   a chord can be a sample apart in one loop iteration and at the same
+//   sample in the next.
+
+#define SONGEND_WINDOW_KEYONS 256
+#define SONGEND_CHORD_MS 10
+
+// Chords are cut off after this many key-ons.
+#define SONGEND_CHORD_KEYONS 128
+
+// Sample clock of the calling thread, advanced by the sound chips for every
+// sample they emulate.
+extern AO_THREAD_LOCAL uint32 songend_clock;
+
+typedef struct {
+	uint64 hash;
+	uint32 sample; // [songend_clock] at the key-on
+} songend_keyon_t;
+
+// Window hash and the key-on it ended at
+typedef struct {
+	uint64 hash; // 0 = empty
+	uint32 keyon;
+} songend_window_t;
+
+// Open-addressed hash map of windows
+typedef struct {
+	songend_window_t *windows;
+	uint32 count;
+	uint32 capacity; // always a power of two
+} songend_set_t;
+
+typedef struct {
+	// Settings
+	uint32 silence_max; // 0 = disabled
+	double fade_seconds;
+
+	// Current run of silent samples, only counted after the first non-silent
+	// one to skip any silence at the start of the song.
+	ao_bool heard;
+	uint32 silence;
+
+	// Key-ons of the chord that might still be going on
+	songend_keyon_t chord[SONGEND_CHORD_KEYONS];
+	uint32 chord_count;
+	uint32 chord_samples;
+
+	// Maximum timing difference between the key-ons of two loop iterations
+	uint32 tolerance;
+
+	// Every key-on so far
+	songend_keyon_t *keyons;
+	uint32 keyon;
+	uint32 keyon_capacity;
+
+	// Ordered hash of the last SONGEND_WINDOW_KEYONS key-ons, and the factor
+	// that removes the oldest one from it
+	uint64 window_hash;
+	uint64 window_factor;
+
+	songend_set_t seen;
+
+	// Period of the first repeating window, in key-ons and samples, and the
+	// key-on that window ended at. [period] is 0 if there is none.
+	uint32 period;
+	uint32 period_samples;
+	uint32 period_keyon;
+
+	ao_bool looped;
+} songend_t;
+
+// Initializes [songend] to end a song rendered at [sample_rate] after
+// [silence_seconds] of silence, and to fade it out over [fade_seconds] once it
+// loops if [loop] is true and the song has no length. Key-ons on the calling
+// thread are reported to [songend] until songend_free().
+void songend_init(
+	songend_t *songend, uint32 sample_rate,
+	double silence_seconds, ao_bool loop, double fade_seconds
+);
+
+// Checks the [count] freshly rendered samples in [buf], which make up one
+// frame. Sets [ao_song_done] or starts the fade if the song should end.
+void songend_check(songend_t *songend, const stereo_sample_t *buf, uint32 count);
+
+void songend_free(songend_t *songend);
+
+// Sound chip hook, called for every voice that is keyed on, with the
+// registers that define the voice's sound. Registers that the chip updates on
+// its own must not be part of [regs].
+void songend_keyon(const void *regs, size_t size);
+/// ------------------
@@ -0,0 +1,179 @@
+/*
+ * Audio Overload SDK
+ *
+ * Engine state snapshots
+ *
+ * Author: Nmlgc
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ao.h"
+#include "state.h"
+
+#include <zlib.h>
+
+/// Snapshots
+/// ---------
+void state_data(state_t *state, void *data, size_t size)
+{
+	if(state->mode != STATE_MEASURE && state->pos + size <= state->size) {
+		if(state->mode == STATE_SAVE) {
+			memcpy(state->buf + state->pos, data, size);
+		} else {
+			memcpy(data, state->buf + state->pos, size);
+		}
+	}
+	state->pos += size;
+}
+
+ao_bool state_save(state_t *state, state_func_t func)
+{
+	state_t measure = {STATE_MEASURE};
+	func(&measure);
+
+	state->buf = malloc(measure.pos);
+	if(!state->buf) {
+		printf(
+			"ERROR: could not allocate %lu bytes of memory\n",
+			(unsigned long)measure.pos
+		);
+		return false;
+	}
+	state->mode = STATE_SAVE;
+	state->size = measure.pos;
+	state->pos = 0;
+	func(state);
+	return true;
+}
+
+ao_bool state_load(state_t *state, state_func_t func)
+{
+	state->mode = STATE_LOAD;
+	state->pos = 0;
+	func(state);
+	if(state->pos != state->size) {
+		printf(
+			"ERROR: snapshot has %lu bytes, but the engine read %lu\n",
+			(unsigned long)state->size, (unsigned long)state->pos
+		);
+		return false;
+	}
+	ao_song_done = 0;
+	return true;
+}
+
+void state_free(state_t *state)
+{
+	free(state->buf);
+	state->buf = NULL;
+	state->size = 0;
+	state->pos = 0;
+}
+/// ---------
+
+/// Keyframe index
+/// --------------
+void keyframes_init(keyframes_t *index, state_func_t func, uint32 interval)
+{
+	memset(index, 0, sizeof(*index));
+	index->func = func;
+	index->interval = interval;
+}
+
+ao_bool keyframes_update(keyframes_t *index, uint32 sample)
+{
+	state_t state = {0};
+	keyframe_t *frame;
+	uint8 *buf;
+
+	if(index->count > 0) {
+		const keyframe_t *last = &index->frames[index->count - 1];
+		if(sample < last->sample + index->interval) {
+			return true;
+		}
+	}
+	if(index->count == index->capacity) {
+		unsigned int capacity = index->capacity ? (index->capacity * 2) : 16;
+		keyframe_t *frames = realloc(
+			index->frames, capacity * sizeof(keyframe_t)
+		);
+		if(!frames) {
+			return false;
+		}
+		index->frames = frames;
+		index->capacity = capacity;
+	}
+	if(!state_save(&state, index->func)) {
+		return false;
+	}
+
+	frame = &index->frames[index->count];
+	frame->sample = sample;
+	frame->raw_size = state.size;
+	frame->size = compressBound(state.size);
+	frame->buf = malloc(frame->size);
+	if(!frame->buf || compress2(
+		frame->buf, &frame->size, state.buf, state.size, Z_BEST_SPEED
+	) != Z_OK) {
+		free(frame->buf);
+		state_free(&state);
+		return false;
+	}
+	state_free(&state);
+
+	// Give back the unused part of the compression bound.
+	buf = realloc(frame->buf, frame->size);
+	if(buf) {
+		frame->buf = buf;
+	}
+	index->count++;
+	return true;
+}
+
+ao_bool keyframes_seek(
+	keyframes_t *index, uint32 sample, int32 (*command)(int32, int32)
+)
+{
+	state_t state = {0};
+	const keyframe_t *frame = NULL;
+	unsigned long raw_size;
+	unsigned int i;
+	ao_bool ret;
+
+	for(i = 0; i < index->count && index->frames[i].sample <= sample; i++) {
+		frame = &index->frames[i];
+	}
+	if(!frame) {
+		return false;
+	}
+
+	state.buf = malloc(frame->raw_size);
+	if(!state.buf) {
+		return false;
+	}
+	state.size = frame->raw_size;
+	raw_size = frame->raw_size;
+	ret = (
+		uncompress(state.buf, &raw_size, frame->buf, frame->size) == Z_OK &&
+		raw_size == frame->raw_size &&
+		state_load(&state, index->func)
+	);
+	state_free(&state);
+	if(ret && sample > frame->sample) {
+		ret = (command(COMMAND_SEEK, sample - frame->sample) == AO_SUCCESS);
+	}
+	return ret;
+}
+
+void keyframes_free(keyframes_t *index)
+{
+	unsigned int i;
+	for(i = 0; i < index->count; i++) {
+		free(index->frames[i].buf);
+	}
+	free(index->frames);
+	memset(index, 0, sizeof(*index));
+}
+/// --------------
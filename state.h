@@ -0,0 +1,92 @@
+/*
+ * Audio Overload SDK
+ *
+ * Engine state snapshots
+ *
+ * Author: Nmlgc
+ */
+
+#pragma once
+
+/// Snapshots
+/// ---------
+// Every module serializes its emulation state by passing each of its state
+// variables to state_data(), in a fixed order. Depending on the mode, this
+// either measures, saves or restores that state, so that a module only needs
+// a single function for all three operations.
+// Snapshots contain raw pointers into the heap blocks of the engine that
+// created them, and are therefore only valid for that engine instance, until
+// it is stopped. They can't be written to disk and restored in another
+// process.
+
+typedef enum {
+	STATE_MEASURE,
+	STATE_SAVE,
+	STATE_LOAD,
+} state_mode_t;
+
+typedef struct {
+	state_mode_t mode;
+	uint8 *buf;
+	size_t size;
+	size_t pos;
+} state_t;
+
+// Engine-level state function, as implemented by XXX_state().
+typedef int32 (*state_func_t)(state_t *state);
+
+// Measures, saves or restores the [size] bytes at [data].
+void state_data(state_t *state, void *data, size_t size);
+
+#define STATE_VAR(state, var) state_data(state, (void *)&(var), sizeof(var))
+
+// Allocates [state] and saves the current engine state into it.
+ao_bool state_save(state_t *state, state_func_t func);
+
+// Restores the engine state from the snapshot in [state]. Fails if the
+// engine didn't read back exactly the amount of data in the snapshot, in
+// which case the engine state is undefined.
+ao_bool state_load(state_t *state, state_func_t func);
+
+void state_free(state_t *state);
+/// ---------
+
+/// Keyframe index
+/// --------------
+// Periodic, compressed engine state snapshots, recorded while rendering a
+// song for the first time. Later seeks can then resume from the nearest
+// keyframe, rather than emulating the song all the way from the beginning.
+
+typedef struct {
+	uint32 sample;
+	uint8 *buf; // zlib-compressed snapshot
+	unsigned long size;
+	size_t raw_size;
+} keyframe_t;
+
+typedef struct {
+	state_func_t func;
+	uint32 interval;
+	keyframe_t *frames;
+	unsigned int count;
+	unsigned int capacity;
+} keyframes_t;
+
+// Initializes [index] to record a keyframe every [interval] samples, using
+// the given engine state function.
+void keyframes_init(keyframes_t *index, state_func_t func, uint32 interval);
+
+// Records a new keyframe if playback has reached the next keyframe position.
+// Should be called after every rendered frame, with [sample] being the
+// number of samples rendered so far.
+ao_bool keyframes_update(keyframes_t *index, uint32 sample);
+
+// Restores the engine to the latest keyframe at or before [sample], then
+// calls [command] with COMMAND_SEEK for the rest of the distance. Fails if
+// there is no such keyframe.
+ao_bool keyframes_seek(
+	keyframes_t *index, uint32 sample, int32 (*command)(int32, int32)
+);
+
+void keyframes_free(keyframes_t *index);
+/// --------------
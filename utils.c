@@ -180,6 +180,8 @@ void hashtable_free(hashtable_t *table)
 			free(bucket_cur);
 		}
 	}
+	free(table->buckets);
+	table->buckets = NULL;
 }
 /// ----------
 
@@ -202,3 +204,23 @@ FILE* fopen_derivative(const char *fn, const char *suffix)
 	free(full_fn);
 	return ret;
 }
+
+int32 render_discard(
+	int32 (*render)(stereo_sample_t *, uint32),
+	int32 (*frame)(void),
+	uint32 count
+)
+{
+	stereo_sample_t buf[AUDIO_FRAME_SAMPLES];
+	while(count > 0 && !ao_song_done) {
+		uint32 block = count < countof(buf) ? count : countof(buf);
+		if(render(buf, block) != AO_SUCCESS) {
+			return AO_FAIL;
+		}
+		if(block == countof(buf)) {
+			frame();
+		}
+		count -= block;
+	}
+	return AO_SUCCESS;
+}
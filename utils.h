@@ -67,4 +67,12 @@ void hashtable_free(hashtable_t *table);
 // Opens "[fn].[suffix]" for writing.
 FILE* fopen_derivative(const char *fn, const char *suffix);
 
+// Calls the block rendering function [render] for [count] samples, followed
+// by [frame] after every 1/60th of a second, and throws away the output.
+int32 render_discard(
+	int32 (*render)(stereo_sample_t *, uint32),
+	int32 (*frame)(void),
+	uint32 count
+);
+
 #endif /* UTILS_H */
@@ -8,6 +8,7 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "ao.h"
 #include "utils.h"
@@ -35,9 +36,25 @@ typedef struct {
 // flags for wFormatTag field of WAVEFORMAT
 #define WAVE_FORMAT_PCM 1
 
+// Data size fields of RF64 files, as specified in EBU Tech 3306. Split into
+// 32-bit halves to avoid padding.
+typedef struct {
+	uint32 riffSizeLow;
+	uint32 riffSizeHigh;
+	uint32 dataSizeLow;
+	uint32 dataSizeHigh;
+	uint32 sampleCountLow;
+	uint32 sampleCountHigh;
+	uint32 tableLength;
+} DS64;
+
 typedef struct {
 	RIFFCHUNK cRIFF;
 	uint32 WAVE;
+	// "JUNK" chunk reserving space for a "ds64" chunk, in case the file
+	// turns out to need RF64.
+	RIFFCHUNK cds64;
+	DS64 ds64;
 	RIFFCHUNK cfmt;
 	WAVEFORMAT_PCM Format;
 	RIFFCHUNK cdata;
@@ -57,7 +74,8 @@ typedef struct {
 	uint32 dwSampleOffset; // offset from [dwBlockStart] to the sample
 } CUEPOINT;
 
-static void wavedump_LIST_adtl_labl_write(
+// Returns the number of bytes written.
+static uint32 wavedump_LIST_adtl_labl_write(
 	wavedump_t *wave, uint32 point_id, const char *label
 )
 {
@@ -80,46 +98,180 @@ static void wavedump_LIST_adtl_labl_write(
 	fwrite(&clabl, sizeof(clabl), 1, wave->file);
 	fwrite(&point_id, sizeof(point_id), 1, wave->file);
 	fwrite(label, label_len, 1, wave->file);
+	return sizeof(cLIST) + cLIST.Size;
 }
 
 static void wavedump_header_fill(
-	WAVEHEADER *h, uint32 data_size, uint32 file_size,
-	uint32 sample_rate, uint16 bits_per_sample, uint16 channels
+	WAVEHEADER *h, const wavedump_t *wave, uint64 data_size, uint64 file_size
 )
 {
-	h->cRIFF.FOURCC = LE32(*(uint32*)"RIFF");
-	h->cRIFF.Size = LE32(file_size - sizeof(RIFFCHUNK));
+	uint64 riff_size = file_size - sizeof(RIFFCHUNK);
+
+	memset(&h->ds64, 0, sizeof(h->ds64));
+	if(riff_size > 0xFFFFFFFF) {
+		uint64 sample_count = data_size / (
+			(wave->channels * wave->bits_per_sample) / 8
+		);
+		h->cRIFF.FOURCC = LE32(*(uint32*)"RF64");
+		h->cRIFF.Size = LE32(0xFFFFFFFF);
+		h->cds64.FOURCC = LE32(*(uint32*)"ds64");
+		h->ds64.riffSizeLow = LE32((uint32)riff_size);
+		h->ds64.riffSizeHigh = LE32((uint32)(riff_size >> 32));
+		h->ds64.dataSizeLow = LE32((uint32)data_size);
+		h->ds64.dataSizeHigh = LE32((uint32)(data_size >> 32));
+		h->ds64.sampleCountLow = LE32((uint32)sample_count);
+		h->ds64.sampleCountHigh = LE32((uint32)(sample_count >> 32));
+		h->cdata.Size = LE32(0xFFFFFFFF);
+	} else {
+		h->cRIFF.FOURCC = LE32(*(uint32*)"RIFF");
+		h->cRIFF.Size = LE32((uint32)riff_size);
+		h->cds64.FOURCC = LE32(*(uint32*)"JUNK");
+		h->cdata.Size = LE32((uint32)data_size);
+	}
+	h->cds64.Size = LE32(sizeof(h->ds64));
 	h->WAVE = LE32(*(uint32*)"WAVE");
 	h->cfmt.FOURCC = LE32(*(uint32*)"fmt ");
 	h->cfmt.Size = LE32(sizeof(h->Format));
 	h->Format.wFormatTag = LE16(WAVE_FORMAT_PCM);
-	h->Format.nChannels = LE16(channels);
-	h->Format.nSamplesPerSec = LE16(sample_rate);
-	h->Format.nBlockAlign = LE16((channels * bits_per_sample) / 8);
+	h->Format.nChannels = LE16(wave->channels);
+	h->Format.nSamplesPerSec = LE32(wave->sample_rate);
+	h->Format.nBlockAlign = LE16((wave->channels * wave->bits_per_sample) / 8);
 	h->Format.nAvgBytesPerSec = LE32(
-		h->Format.nSamplesPerSec * h->Format.nBlockAlign
+		wave->sample_rate * ((wave->channels * wave->bits_per_sample) / 8)
 	);
-	h->Format.wBitsPerSample = LE16(bits_per_sample);
+	h->Format.wBitsPerSample = LE16(wave->bits_per_sample);
 	h->cdata.FOURCC = LE32(*(uint32*)"data");
-	h->cdata.Size = LE32(data_size);
 }
 
-ao_bool wavedump_open(wavedump_t *wave, const char *fn)
+/// Writer thread
+/// -------------
+static void wavedump_writer(void *param)
+{
+	wavedump_t *wave = (wavedump_t*)param;
+	uint32 len;
+
+	for(;;) {
+		ao_sem_wait(wave->full);
+		len = wave->lens[wave->tail];
+		if(len == 0) {
+			break;
+		}
+		fwrite(wave->bufs[wave->tail], len, 1, wave->file);
+		wave->tail = (wave->tail + 1) % WAVEDUMP_BUFFER_COUNT;
+		ao_sem_post(wave->empty);
+	}
+}
+
+static ao_bool wavedump_writer_start(wavedump_t *wave)
+{
+	unsigned int i;
+
+	// bufs[head] is owned by the caller. Anything allocated by a previous
+	// failed attempt is reused.
+	for(i = 1; i < WAVEDUMP_BUFFER_COUNT; i++) {
+		if(!wave->bufs[i]) {
+			wave->bufs[i] = malloc(WAVEDUMP_BUFFER_SIZE);
+		}
+		if(!wave->bufs[i]) {
+			return false;
+		}
+	}
+	if(!wave->full) {
+		wave->full = ao_sem_create(0);
+	}
+	if(!wave->empty) {
+		wave->empty = ao_sem_create(WAVEDUMP_BUFFER_COUNT - 1);
+	}
+	if(wave->full && wave->empty) {
+		wave->writer = ao_thread_start(wavedump_writer, wave);
+	}
+	return wave->writer != NULL;
+}
+
+// Hands bufs[head] to the writer thread, and waits for the next buffer to
+// become available. Falls back on writing on the calling thread if the
+// writer thread can't be started.
+static void wavedump_submit(wavedump_t *wave)
+{
+	if(!wave->writer && !wavedump_writer_start(wave)) {
+		fwrite(wave->bufs[wave->head], wave->fill, 1, wave->file);
+		wave->fill = 0;
+		return;
+	}
+	wave->lens[wave->head] = wave->fill;
+	ao_sem_post(wave->full);
+	wave->head = (wave->head + 1) % WAVEDUMP_BUFFER_COUNT;
+	wave->fill = 0;
+	ao_sem_wait(wave->empty);
+}
+
+// Writes all buffered data, then stops the writer thread and frees all
+// buffers.
+static void wavedump_flush(wavedump_t *wave)
+{
+	unsigned int i;
+
+	if(wave->fill) {
+		wavedump_submit(wave);
+	}
+	if(wave->writer) {
+		wave->lens[wave->head] = 0;
+		ao_sem_post(wave->full);
+		ao_thread_join(wave->writer);
+		wave->writer = NULL;
+	}
+	if(wave->full) {
+		ao_sem_free(wave->full);
+		wave->full = NULL;
+	}
+	if(wave->empty) {
+		ao_sem_free(wave->empty);
+		wave->empty = NULL;
+	}
+	for(i = 0; i < WAVEDUMP_BUFFER_COUNT; i++) {
+		free(wave->bufs[i]);
+		wave->bufs[i] = NULL;
+	}
+}
+/// -------------
+
+ao_bool wavedump_open_file(
+	wavedump_t *wave, FILE *file, ao_bool raw,
+	uint32 sample_rate, uint16 bits_per_sample, uint16 channels
+)
 {
-	uint32 temp = 0;
 	assert(wave);
 
-	wave->data_size = 0;
-	wave->loop_sample = 0;
-	wave->file = fopen_derivative(fn, ".wav");
-	if(!wave->file) {
+	memset(wave, 0, sizeof(*wave));
+	if(!file) {
 		return false;
 	}
-	// Jump over header, we write that one later
-	fwrite(&temp, 1, sizeof(WAVEHEADER), wave->file);
+	wave->file = file;
+	wave->raw = raw;
+	wave->seekable = (fseek(file, 0, SEEK_CUR) == 0);
+	wave->sample_rate = sample_rate;
+	wave->bits_per_sample = bits_per_sample;
+	wave->channels = channels;
+	if(!raw) {
+		// Seekable files get the correct header in wavedump_finish().
+		WAVEHEADER h;
+		wavedump_header_fill(&h, wave, 0xFFFFFFFF, 0xFFFFFFFF + sizeof(RIFFCHUNK));
+		fwrite(&h, sizeof(h), 1, wave->file);
+	}
 	return true;
 }
 
+ao_bool wavedump_open(
+	wavedump_t *wave, const char *fn,
+	uint32 sample_rate, uint16 bits_per_sample, uint16 channels
+)
+{
+	return wavedump_open_file(
+		wave, fopen_derivative(fn, ".wav"), false,
+		sample_rate, bits_per_sample, channels
+	);
+}
+
 void wavedump_loop_set(wavedump_t *wave, uint32 loop_sample)
 {
 	assert(wave);
@@ -127,25 +279,52 @@ void wavedump_loop_set(wavedump_t *wave, uint32 loop_sample)
 	wave->loop_sample = loop_sample;
 }
 
-void wavedump_append(wavedump_t *wave, uint32 len, void *buf)
+void wavedump_append(wavedump_t *wave, uint32 len, const void *buf)
 {
+	const uint8 *p = (const uint8*)buf;
+
 	assert(wave);
-	if(wave->file) {
-		wave->data_size += len;
-		// XXX: Doesn't the data need to be swapped on big-endian platforms?
-		// That would mean that we need to know the target wave format on
-		// opening time.
-		fwrite(buf, len, 1, wave->file);
+	if(!wave->file) {
+		return;
+	}
+	wave->data_size += len;
+	// XXX: Doesn't the data need to be swapped on big-endian platforms?
+	// That would mean that we need to know the target wave format on
+	// opening time.
+	while(len > 0) {
+		uint32 chunk = WAVEDUMP_BUFFER_SIZE - wave->fill;
+		if(!wave->bufs[wave->head]) {
+			// Only the first buffer can be missing, since the writer
+			// thread allocates all others.
+			wave->bufs[wave->head] = malloc(WAVEDUMP_BUFFER_SIZE);
+			if(!wave->bufs[wave->head]) {
+				fwrite(p, len, 1, wave->file);
+				return;
+			}
+		}
+		if(chunk > len) {
+			chunk = len;
+		}
+		memcpy(wave->bufs[wave->head] + wave->fill, p, chunk);
+		wave->fill += chunk;
+		p += chunk;
+		len -= chunk;
+		if(wave->fill == WAVEDUMP_BUFFER_SIZE) {
+			wavedump_submit(wave);
+		}
 	}
 }
 
-void wavedump_finish(
-	wavedump_t *wave, uint32 sample_rate, uint16 bits_per_sample, uint16 channels
-)
+void wavedump_finish(wavedump_t *wave)
 {
 	assert(wave);
-	if(wave->file) {
+	if(!wave->file) {
+		return;
+	}
+	wavedump_flush(wave);
+	if(!wave->raw && wave->seekable) {
 		WAVEHEADER h;
+		uint64 file_size = sizeof(WAVEHEADER) + wave->data_size;
 		// RIFF chunks have to be word-aligned, so we have to pad out the
 		// data chunk if the number of samples happens to be odd.
 		if(wave->data_size & 1) {
@@ -153,6 +332,7 @@ void wavedump_finish(
 			// fwrite() rather than wavedump_append(), as the chunk size
 			// obviously doesn't include the padding.
 			fwrite(&pad, sizeof(pad), 1, wave->file);
+			file_size += sizeof(pad);
 		}
 		if(wave->loop_sample) {
 			// Write the "cue " chunk, as well as an additional
@@ -172,15 +352,13 @@ void wavedump_finish(
 
 			fwrite(&cue, sizeof(cue), 1, wave->file);
 			fwrite(&point, sizeof(point), 1, wave->file);
-			wavedump_LIST_adtl_labl_write(wave, 0, "Loop point");
+			file_size += sizeof(cue) + sizeof(point);
+			file_size += wavedump_LIST_adtl_labl_write(wave, 0, "Loop point");
 		}
-		wavedump_header_fill(
-			&h, wave->data_size, ftell(wave->file),
-			sample_rate, bits_per_sample, channels
-		);
+		wavedump_header_fill(&h, wave, wave->data_size, file_size);
 		fseek(wave->file, 0, SEEK_SET);
 		fwrite(&h, sizeof(h), 1, wave->file);
-		fclose(wave->file);
-		wave->file = NULL;
 	}
+	fclose(wave->file);
+	wave->file = NULL;
 }
@@ -8,13 +8,52 @@
 
 #pragma once
 
+// Appended data is collected in buffers of this size. Once the first one is
+// full, the buffers are written by a separate thread, so that rendering
+// doesn't have to wait for the disk.
+#define WAVEDUMP_BUFFER_SIZE (1024 * 1024)
+#define WAVEDUMP_BUFFER_COUNT 4
+
 typedef struct {
 	FILE *file;
+	ao_bool raw; // no header, just PCM data
+	ao_bool seekable; // can the header be updated in wavedump_finish()?
+	uint32 sample_rate;
+	uint16 bits_per_sample;
+	uint16 channels;
 	uint32 loop_sample;
-	uint32 data_size;
+	uint64 data_size;
+
+	// Single-producer, single-consumer ring of buffers. The semaphores only
+	// block if the ring is full or empty.
+	uint8 *bufs[WAVEDUMP_BUFFER_COUNT];
+	uint32 lens[WAVEDUMP_BUFFER_COUNT]; // 0 = stop the writer thread
+	uint32 fill; // of bufs[head]
+	unsigned int head; // buffer currently being filled
+	unsigned int tail; // next buffer to be written by the writer thread
+	ao_sem_t *full;
+	ao_sem_t *empty;
+	ao_thread_t *writer;
 } wavedump_t;
 
-ao_bool wavedump_open(wavedump_t *wave, const char *fn);
+// Opens "[fn].wav" for writing.
+ao_bool wavedump_open(
+	wavedump_t *wave, const char *fn,
+	uint32 sample_rate, uint16 bits_per_sample, uint16 channels
+);
+
+// Writes to the already opened [file], which is closed by wavedump_finish().
+// If [raw] is true, only the PCM data is written. Otherwise, if [file] can't
+// be seeked, as is the case for pipes, the header is written up front with
+// the sizes set to 0xFFFFFFFF.
+ao_bool wavedump_open_file(
+	wavedump_t *wave, FILE *file, ao_bool raw,
+	uint32 sample_rate, uint16 bits_per_sample, uint16 channels
+);
+
 void wavedump_loop_set(wavedump_t *wave, uint32 loop_sample);
-void wavedump_append(wavedump_t *wave, uint32 len, void *buffer);
-void wavedump_finish(wavedump_t *wave, uint32 sample_rate, uint16 bits_per_sample, uint16 channels);
+void wavedump_append(wavedump_t *wave, uint32 len, const void *buffer);
+
+// Writes all remaining data and closes the file. Files with more than 4 GiB
+// of data are turned into RF64 files.
+void wavedump_finish(wavedump_t *wave);